@@ -0,0 +1,274 @@
+/*
+ *  badmap.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "badmap.h"
+
+/* a map that doesn't exist yet is empty */
+badmap *
+badmap_load(const char *const fileName) {
+   badmap *bm = (badmap*)calloc(1, sizeof(badmap));
+   unsigned long long offset, length;
+   char line[256];
+   char status;
+   FILE *in;
+   
+   pthread_mutex_init(&bm->lock, NULL);
+   
+   if (fileName == NULL) {
+      return bm;
+   }
+   
+   if ((in = fopen(fileName, "r")) == NULL) {
+      if (errno != ENOENT) {
+         perror("fopen");
+         badmap_destroy(bm);
+         return NULL;
+      }
+      
+      return bm;
+   }
+   
+   while (fgets(line, sizeof(line), in) != NULL) {
+      if (line[0] == '#' || sscanf(line, "%llx %llx %c", &offset, &length, 
+               &status) != 3) {
+         continue;
+      }
+      
+      if (status == BADMAP_SKIPPED || status == BADMAP_BAD) {
+         badmap_mark(bm, offset, length, status);
+      }
+   }
+   
+   fclose(in);
+   return bm;
+}
+
+/* the map is replaced atomically, so an interrupted run keeps the old one */
+int 
+badmap_save(badmap *bm, const char *const fileName) {
+   char *tmpName = (char*)malloc(strlen(fileName) + 5);
+   FILE *out;
+   u_int32_t i;
+   int error;
+   
+   sprintf(tmpName, "%s.tmp", fileName);
+   
+   if ((out = fopen(tmpName, "w")) == NULL) {
+      perror("fopen");
+      free(tmpName);
+      return -1;
+   }
+   
+   pthread_mutex_lock(&bm->lock);
+   fprintf(out, "# bad range map\n# offset length status\n");
+   
+   for (i = 0; i < bm->count; i++) {
+      fprintf(out, "0x%08llX 0x%08llX %c\n", 
+            (unsigned long long)bm->ranges[i].offset, 
+            (unsigned long long)bm->ranges[i].length, bm->ranges[i].status);
+   }
+   
+   pthread_mutex_unlock(&bm->lock);
+   error = fclose(out) != 0;
+   
+   if (error || rename(tmpName, fileName) == -1) {
+      perror("unable to save the bad range map");
+      unlink(tmpName);
+      free(tmpName);
+      return -1;
+   }
+   
+   free(tmpName);
+   return 0;
+}
+
+void 
+badmap_destroy(badmap *bm) {
+   pthread_mutex_destroy(&bm->lock);
+   free(bm->ranges);
+   free(bm);
+}
+
+static void 
+badmap_append(badmap_range *ranges, u_int32_t *const count, 
+      u_int64_t offset, u_int64_t length, char status) {
+   badmap_range *last = *count > 0 ? &ranges[*count - 1] : NULL;
+   
+   if (length == 0) {
+      return;
+   }
+   
+   if (last != NULL && last->status == status 
+         && last->offset + last->length == offset) {
+      last->length += length;
+      return;
+   }
+   
+   ranges[*count].offset = offset;
+   ranges[*count].length = length;
+   ranges[*count].status = status;
+   (*count)++;
+}
+
+/* sets the status of a range, BADMAP_GOOD removes it from the map. the 
+ * ranges it touches, and neighbours it may merge with, are replaced in 
+ * place by at most three: what is left of the first one, the new range and 
+ * what is left of the last one.
+ */
+void 
+badmap_mark(badmap *bm, u_int64_t offset, u_int64_t length, char status) {
+   u_int64_t end = offset + length, rEnd = 0;
+   badmap_range pieces[3], *first, *last = NULL;
+   u_int32_t count = 0, lo = 0, hi, mid;
+   
+   if (length == 0) {
+      return;
+   }
+   
+   pthread_mutex_lock(&bm->lock);
+   hi = bm->count;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      
+      if (bm->ranges[mid].offset + bm->ranges[mid].length <= offset) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+   
+   if (lo > 0 && bm->ranges[lo-1].offset + bm->ranges[lo-1].length == offset) {
+      lo--;
+   }
+   
+   for (hi = lo; hi < bm->count && bm->ranges[hi].offset < end; hi++);
+   
+   if (hi < bm->count && bm->ranges[hi].offset == end) {
+      hi++;
+   }
+   
+   if (hi > lo) {
+      first = &bm->ranges[lo];
+      last = &bm->ranges[hi-1];
+      rEnd = last->offset + last->length;
+      badmap_append(pieces, &count, first->offset, 
+            first->offset < offset ? offset - first->offset : 0, 
+            first->status);
+   }
+   
+   if (status != BADMAP_GOOD) {
+      badmap_append(pieces, &count, offset, length, status);
+   }
+   
+   if (hi > lo && rEnd > end) {
+      badmap_append(pieces, &count, end, rEnd - end, last->status);
+   }
+   
+   if (bm->count - (hi - lo) + count > bm->size) {
+      bm->size = bm->size ? bm->size*2 : 64;
+      
+      if ((bm->ranges = (badmap_range*)realloc(bm->ranges, 
+                  bm->size*sizeof(badmap_range))) == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   memmove(&bm->ranges[lo + count], &bm->ranges[hi], 
+         (bm->count - hi)*sizeof(badmap_range));
+   memcpy(&bm->ranges[lo], pieces, count*sizeof(badmap_range));
+   bm->count = bm->count - (hi - lo) + count;
+   pthread_mutex_unlock(&bm->lock);
+}
+
+/* the first range overlapping [offset, end). returns 0 if there is none. */
+int 
+badmap_next(badmap *bm, u_int64_t offset, u_int64_t end, 
+      badmap_range *const range) {
+   u_int32_t lo = 0, hi, mid;
+   int found = 0;
+   
+   pthread_mutex_lock(&bm->lock);
+   hi = bm->count;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      
+      if (bm->ranges[mid].offset + bm->ranges[mid].length <= offset) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+   
+   if (lo < bm->count && bm->ranges[lo].offset < end) {
+      *range = bm->ranges[lo];
+      found = 1;
+   }
+   
+   pthread_mutex_unlock(&bm->lock);
+   return found;
+}
+
+u_int64_t 
+badmap_bytes(badmap *bm, char status) {
+   u_int64_t bytes = 0;
+   u_int32_t i;
+   
+   pthread_mutex_lock(&bm->lock);
+   
+   for (i = 0; i < bm->count; i++) {
+      if (bm->ranges[i].status == status) {
+         bytes += bm->ranges[i].length;
+      }
+   }
+   
+   pthread_mutex_unlock(&bm->lock);
+   return bytes;
+}
+
+/* a snapshot of the ranges with a status, to work on while the map changes */
+badmap_range *
+badmap_copy(badmap *bm, char status, u_int32_t *const count) {
+   badmap_range *ranges;
+   u_int32_t i;
+   
+   pthread_mutex_lock(&bm->lock);
+   ranges = (badmap_range*)malloc((bm->count + 1)*sizeof(badmap_range));
+   *count = 0;
+   
+   for (i = 0; i < bm->count; i++) {
+      if (bm->ranges[i].status == status) {
+         ranges[(*count)++] = bm->ranges[i];
+      }
+   }
+   
+   pthread_mutex_unlock(&bm->lock);
+   return ranges;
+}
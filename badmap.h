@@ -0,0 +1,77 @@
+/*
+ *  badmap.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <pthread.h>
+
+#ifndef __BADMAP_H_
+#define __BADMAP_H_
+
+/* the status of a range, as in ddrescue's map files */
+#define BADMAP_SKIPPED '*'
+#define BADMAP_BAD     '-'
+#define BADMAP_GOOD    '+'
+
+/* device ranges that couldn't be read, sorted and not overlapping. good 
+ * ranges are not kept.
+ */
+typedef struct {
+   u_int64_t offset;
+   u_int64_t length;
+   char status;
+} badmap_range;
+
+typedef struct {
+   badmap_range *ranges;
+   u_int32_t count;
+   u_int32_t size;
+   pthread_mutex_t lock;
+} badmap;
+
+badmap *
+badmap_load(const char *const fileName);
+
+int 
+badmap_save(badmap *bm, const char *const fileName);
+
+void 
+badmap_destroy(badmap *bm);
+
+void 
+badmap_mark(badmap *bm, u_int64_t offset, u_int64_t length, char status);
+
+int 
+badmap_next(badmap *bm, u_int64_t offset, u_int64_t end, 
+      badmap_range *const range);
+
+u_int64_t 
+badmap_bytes(badmap *bm, char status);
+
+badmap_range *
+badmap_copy(badmap *bm, char status, u_int32_t *const count);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ *  batch.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "batch.h"
+#include "io.h"
+
+batch *
+batch_create() {
+   batch *b = (batch*)calloc(1, sizeof(batch));
+   b->size = 64;
+   b->items = (batch_item*)malloc(b->size*sizeof(batch_item));
+   return b;
+}
+
+void 
+batch_destroy(batch *b) {
+   free(b->items);
+   free(b);
+}
+
+void 
+batch_add(batch *b, u_int32_t startBlock, u_int32_t endBlock, void *item) {
+   if (b->count == b->size) {
+      if ((b->items = (batch_item*)realloc(b->items, 
+                  (b->size *= 2)*sizeof(batch_item))) == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   b->items[b->count].startBlock = startBlock;
+   b->items[b->count].endBlock = endBlock;
+   b->items[b->count].item = item;
+   b->count++;
+}
+
+static int 
+batch_itemComparator(const void *i1, const void *i2) {
+   u_int32_t k1 = ((batch_item*)i1)->startBlock;
+   u_int32_t k2 = ((batch_item*)i2)->startBlock;
+
+   if( k1 < k2 ) return -1;
+   if( k1 > k2 ) return  1;
+   return 0;
+}
+
+/* sorts the items by their position on the device and groups items which
+ * lie close to each other. every group is read with one request into the 
+ * block cache, from where the handler's reads of the single items are 
+ * served.
+ */
+void 
+batch_run(batch *b, HFSPlusVolume *vol, 
+      void(*handler)(void *item, void *retVal), void *retVal) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t maxSpan = BATCH_SPAN_SIZE / blockSize;
+   u_int32_t maxGap = BATCH_MAX_GAP / blockSize;
+   u_int32_t first, last, i, start, end;
+   
+   qsort(b->items, b->count, sizeof(batch_item), &batch_itemComparator);
+   
+   for (first = 0; first < b->count; first = last) {
+      start = b->items[first].startBlock;
+      end = b->items[first].endBlock;
+      
+      for (last = first + 1; last < b->count; last++) {
+         if (b->items[last].startBlock > end + maxGap 
+               || b->items[last].endBlock - start > maxSpan) {
+            break;
+         }
+         
+         end = b->items[last].endBlock > end ? b->items[last].endBlock : end;
+      }
+      
+      /* a failed read is not fatal, the items are then read one by one */
+      if (last - first > 1) {
+         cacheBlocks(vol, start, end - start);
+      }
+      
+      for (i = first; i < last; i++) {
+         (*handler)(b->items[i].item, retVal);
+      }
+      
+      dropBlockCache(vol);
+   }
+}
@@ -0,0 +1,65 @@
+/*
+ *  batch.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+
+#ifndef __BATCH_H_
+#define __BATCH_H_
+
+/* largest span read at once to serve a group of small files */
+#define BATCH_SPAN_SIZE (4*1024*1024)
+/* unused space tolerated between two files of the same group */
+#define BATCH_MAX_GAP (256*1024)
+
+typedef struct {
+   u_int32_t startBlock;
+   u_int32_t endBlock;
+   void *item;
+} batch_item;
+
+typedef struct {
+   batch_item *items;
+   u_int32_t count;
+   u_int32_t size;
+} batch;
+
+batch *
+batch_create();
+
+void 
+batch_destroy(batch *b);
+
+void 
+batch_add(batch *b, u_int32_t startBlock, u_int32_t endBlock, void *item);
+
+struct _HFSPlusVolume;
+
+void 
+batch_run(batch *b, struct _HFSPlusVolume *vol, 
+      void(*handler)(void *item, void *retVal), void *retVal);
+
+#endif
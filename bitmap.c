@@ -0,0 +1,203 @@
+/*
+ *  bitmap.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "bitmap.h"
+#include "io.h"
+
+/* reads the allocation file through the data path. bits past the last 
+ * block of the volume are set, so they never show up as free space.
+ */
+bitmap *
+bitmap_load(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const orderedlist *const extList, u_int32_t totalBlocks) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t chunkBlocks = vol->dataBufSize / blockSize;
+   HFSPlusExtentDescriptor *exts;
+   bitmap *bm;
+   char *bytes;
+   u_int64_t needed, done = 0, len;
+   u_int32_t count, e, block, left, n, i;
+   
+   if ((exts = collectForkExtents(fork, extList, &count)) == NULL) {
+      return NULL;
+   }
+   
+   bm = (bitmap*)calloc(1, sizeof(bitmap));
+   bm->totalBlocks = totalBlocks;
+   bm->wordCount = (totalBlocks + 63) / 64;
+   bm->words = (u_int64_t*)calloc(bm->wordCount + 1, sizeof(u_int64_t));
+   bytes = (char*)bm->words;
+   needed = ((u_int64_t)totalBlocks + 7) / 8;
+   
+   for (e = 0; e < count && done < needed; e++) {
+      block = exts[e].startBlock;
+      left = exts[e].blockCount;
+      
+      while (left > 0 && done < needed) {
+         n = left < chunkBlocks ? left : chunkBlocks;
+         
+         if (readBlocks(vol, block, n, vol->dataBuf) == -1) {
+            fprintf(stderr, "unable to read the allocation file\n");
+            free(exts);
+            bitmap_destroy(bm);
+            return NULL;
+         }
+         
+         len = (u_int64_t)n*blockSize;
+         len = len < needed - done ? len : needed - done;
+         memcpy(bytes + done, vol->dataBuf, len);
+         done += len;
+         block += n;
+         left -= n;
+      }
+   }
+   
+   free(exts);
+   
+   if (done < needed) {
+      fprintf(stderr, "the allocation file is too short for %u blocks\n", 
+            totalBlocks);
+   }
+   
+   for (i = 0; i < bm->wordCount; i++) {
+      bm->words[i] = CFSwapInt64BigToHost(bm->words[i]);
+   }
+   
+   if (totalBlocks % 64 != 0) {
+      bm->words[bm->wordCount-1] |= ~0ULL >> (totalBlocks % 64);
+   }
+   
+   bm->allocated = bitmap_countAllocated(bm, 0, totalBlocks);
+   return bm;
+}
+
+void 
+bitmap_destroy(bitmap *bm) {
+   free(bm->words);
+   free(bm);
+}
+
+int 
+bitmap_isAllocated(const bitmap *const bm, u_int32_t block) {
+   if (block >= bm->totalBlocks) {
+      return 0;
+   }
+   
+   return (bm->words[block / 64] >> (63 - block % 64)) & 1;
+}
+
+/* the bits of the word from the bit of block on down to the bit of end - 1 */
+static inline u_int64_t 
+bitmap_mask(u_int32_t from, u_int32_t to) {
+   u_int64_t mask = ~0ULL >> from;
+   return to < 64 ? mask & ~(~0ULL >> to) : mask;
+}
+
+/* counts whole words with popcount, which the compiler turns into the 
+ * popcnt instruction or vector code where the target has it
+ */
+u_int32_t 
+bitmap_countAllocated(const bitmap *const bm, u_int32_t start, 
+      u_int32_t count) {
+   u_int64_t end = (u_int64_t)start + count;
+   u_int32_t w, last, n = 0;
+   
+   end = end < bm->totalBlocks ? end : bm->totalBlocks;
+   
+   if (start >= end) {
+      return 0;
+   }
+   
+   w = start / 64;
+   last = (end - 1) / 64;
+   
+   if (w == last) {
+      return __builtin_popcountll(bm->words[w] 
+            & bitmap_mask(start % 64, end - (u_int64_t)w*64));
+   }
+   
+   n = __builtin_popcountll(bm->words[w] & bitmap_mask(start % 64, 64));
+   
+   for (w++; w < last; w++) {
+      n += __builtin_popcountll(bm->words[w]);
+   }
+   
+   return n + __builtin_popcountll(bm->words[last] 
+         & bitmap_mask(0, end - (u_int64_t)last*64));
+}
+
+/* finds the first block at or after block whose bit equals the bit of set,
+ * skipping whole words that can't contain it. returns totalBlocks if there
+ * is none.
+ */
+static u_int32_t 
+bitmap_next(const bitmap *const bm, u_int32_t block, u_int64_t set) {
+   u_int32_t w;
+   u_int64_t bits;
+   
+   if (block >= bm->totalBlocks) {
+      return bm->totalBlocks;
+   }
+   
+   w = block / 64;
+   bits = (set ? bm->words[w] : ~bm->words[w]) & (~0ULL >> (block % 64));
+   
+   while (bits == 0) {
+      if (++w >= bm->wordCount) {
+         return bm->totalBlocks;
+      }
+      bits = set ? bm->words[w] : ~bm->words[w];
+   }
+   
+   block = w*64 + __builtin_clzll(bits);
+   return block < bm->totalBlocks ? block : bm->totalBlocks;
+}
+
+u_int32_t 
+bitmap_nextAllocated(const bitmap *const bm, u_int32_t block) {
+   return bitmap_next(bm, block, 1);
+}
+
+u_int32_t 
+bitmap_nextFree(const bitmap *const bm, u_int32_t block) {
+   return bitmap_next(bm, block, 0);
+}
+
+/* calls the handler for every run of free blocks in ascending order */
+void 
+bitmap_freeRanges(const bitmap *const bm, 
+      void(*handler)(u_int32_t start, u_int32_t count, void *retVal), 
+      void *retVal) {
+   u_int32_t start = bitmap_nextFree(bm, 0), end;
+   
+   while (start < bm->totalBlocks) {
+      end = bitmap_nextAllocated(bm, start);
+      (*handler)(start, end - start, retVal);
+      start = bitmap_nextFree(bm, end);
+   }
+}
@@ -0,0 +1,72 @@
+/*
+ *  bitmap.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "orderedlist.h"
+
+#ifndef __BITMAP_H_
+#define __BITMAP_H_
+
+/* the allocation file with one bit per allocation block. the bits are kept
+ * in host order 64 bit words, the most significant bit of word w stands 
+ * for block w*64.
+ */
+typedef struct {
+   u_int64_t *words;
+   u_int32_t wordCount;
+   u_int32_t totalBlocks;
+   u_int32_t allocated;
+} bitmap;
+
+struct _HFSPlusVolume;
+
+bitmap *
+bitmap_load(struct _HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const orderedlist *const extList, u_int32_t totalBlocks);
+
+void 
+bitmap_destroy(bitmap *bm);
+
+int 
+bitmap_isAllocated(const bitmap *const bm, u_int32_t block);
+
+u_int32_t 
+bitmap_countAllocated(const bitmap *const bm, u_int32_t start, 
+      u_int32_t count);
+
+u_int32_t 
+bitmap_nextAllocated(const bitmap *const bm, u_int32_t block);
+
+u_int32_t 
+bitmap_nextFree(const bitmap *const bm, u_int32_t block);
+
+void 
+bitmap_freeRanges(const bitmap *const bm, 
+      void(*handler)(u_int32_t start, u_int32_t count, void *retVal), 
+      void *retVal);
+
+#endif
@@ -50,6 +50,24 @@ btree_create(int(*keyComparator)(void *key1, void *key2)) {
     return tree;
 }
 
+static void 
+btree_destroy_subtree(btree_node *node) {
+   if (node == NULL) {
+      return;
+   }
+   
+   btree_destroy_subtree(node->lnode);
+   btree_destroy_subtree(node->rnode);
+   btree_destroy_node(node);
+}
+
+/* frees the nodes, the keys and values belong to the caller */
+void 
+btree_destroy(btree *tree) {
+   btree_destroy_subtree(tree->root);
+   free(tree);
+}
+
 void 
 btree_insert_node(btree *tree, btree_node *indexNode, btree_node *valueNode) {
     btree_node **insertNode;
@@ -54,6 +54,9 @@ btree_destroy_node(btree_node *node);
 btree *
 btree_create(int(*keyComparator)(void *key1, void *key2));
 
+void 
+btree_destroy(btree *tree);
+
 void 
 btree_insert_node(btree *tree, btree_node *indexNode, btree_node *valueNode);
 
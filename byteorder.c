@@ -84,6 +84,13 @@ convertHFSPlusCatalogFileToHostByteOrder(HFSPlusCatalogFile *const cat) {
    cat->accessDate = CFSwapInt32BigToHost(cat->accessDate);
    cat->backupDate = CFSwapInt32BigToHost(cat->backupDate);
    cat->textEncoding = CFSwapInt32BigToHost(cat->textEncoding);
+   cat->bsdInfo.ownerID = CFSwapInt32BigToHost(cat->bsdInfo.ownerID);
+   cat->bsdInfo.groupID = CFSwapInt32BigToHost(cat->bsdInfo.groupID);
+   cat->bsdInfo.fileMode = CFSwapInt16BigToHost(cat->bsdInfo.fileMode);
+   cat->bsdInfo.special.iNodeNum = 
+      CFSwapInt32BigToHost(cat->bsdInfo.special.iNodeNum);
+   cat->userInfo.fdType = CFSwapInt32BigToHost(cat->userInfo.fdType);
+   cat->userInfo.fdCreator = CFSwapInt32BigToHost(cat->userInfo.fdCreator);
    cat->userInfo.fdFlags = CFSwapInt16BigToHost(cat->userInfo.fdFlags);   
    
    convertFileToHostByteOrder(&cat->dataFork);
@@ -122,3 +129,9 @@ convertHFSPlusExtentRecordToHostByteOrder(HFSPlusExtentRecord *const ext) {
       desc->blockCount = CFSwapInt32BigToHost(desc->blockCount);
    }
 }
+
+void 
+convertAttributeDataToHostByteOrder(attributeData *const attr) {
+   attr->recordType = CFSwapInt32BigToHost(attr->recordType);
+   attr->size = CFSwapInt32BigToHost(attr->size);
+}
@@ -29,6 +29,8 @@
  *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "definitions.h"
+
 void 
 convertNodeDescriptorToHostByteOrder(BTNodeDescriptor *const desc);
 
@@ -49,3 +51,6 @@ convertHFSPlusCatalogThreadToHostByteOrder(HFSPlusCatalogThread *const cat);
 
 void 
 convertHFSPlusExtentRecordToHostByteOrder(HFSPlusExtentRecord *const ext);
+
+void 
+convertAttributeDataToHostByteOrder(attributeData *const attr);
@@ -0,0 +1,301 @@
+/*
+ *  carve.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "carve.h"
+#include "watchdog.h"
+
+typedef struct {
+   watchdog *watchdog;
+   int fd;
+   u_int64_t start;
+   u_int64_t end;
+   u_int64_t next;
+   pthread_mutex_t lock;
+   carve_result *result;
+} carve_job;
+
+/* the bytes 8 to 15 of a leaf node descriptor: kind -1, height 1, any 
+ * number of records and a zero reserved field
+ */
+static const unsigned char carve_leafBits[8] = 
+   { 0xFF, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static const unsigned char carve_leafMask[8] = 
+   { 0xFF, 0xFF, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00 };
+
+static inline u_int16_t 
+carve_u16(const unsigned char *p) {
+   return (u_int16_t)(p[0] << 8 | p[1]);
+}
+
+static void 
+carve_add(carve_result *r, u_int64_t offset, u_int32_t nodeSize, 
+      u_int32_t type) {
+   if (r->count == r->size) {
+      r->size = r->size ? r->size*2 : 1024;
+      
+      if ((r->nodes = (carve_node*)realloc(r->nodes, 
+                  r->size*sizeof(carve_node))) == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   r->nodes[r->count].offset = offset;
+   r->nodes[r->count].nodeSize = nodeSize;
+   r->nodes[r->count].type = type;
+   r->count++;
+}
+
+/* the smallest node size for which the offset table at the end of the 
+ * node starts at 14 and ascends to a free space offset that doesn't 
+ * overlap the table. returns 0 if there is none.
+ */
+static u_int32_t 
+carve_inferNodeSize(const unsigned char *node, u_int64_t avail) {
+   u_int16_t numRecords = carve_u16(node + 10);
+   u_int32_t size, i;
+   u_int16_t prev, off;
+   
+   for (size = CARVE_SECTOR_SIZE; size <= CARVE_MAX_NODE_SIZE && size <= avail;
+         size *= 2) {
+      if (2*(numRecords + 1) + 14 > size 
+            || carve_u16(node + size - 2) != 14) {
+         continue;
+      }
+      
+      for (i = 1, prev = 14; i <= numRecords; i++, prev = off) {
+         off = carve_u16(node + size - 2 - 2*i);
+         
+         if (off <= prev) {
+            break;
+         }
+      }
+      
+      if (i > numRecords && prev <= size - 2*(numRecords + 1)) {
+         return size;
+      }
+   }
+   
+   return 0;
+}
+
+/* tells catalog from extents leaf nodes by their first key */
+static int 
+carve_classify(const unsigned char *node) {
+   u_int16_t keyLength = carve_u16(node + 14);
+   u_int16_t recordType;
+   
+   if (keyLength == kHFSPlusExtentKeyMaximumLength) {
+      if ((node[16] == 0x00 || node[16] == 0xFF) && node[17] == 0) {
+         return CARVE_EXTENTS;
+      }
+      return -1;
+   }
+   
+   if (keyLength < 6 || keyLength > kHFSPlusCatalogKeyMaximumLength 
+         || keyLength != 6 + 2*carve_u16(node + 20)) {
+      return -1;
+   }
+   
+   recordType = carve_u16(node + 16 + keyLength);
+   return recordType >= kHFSPlusFolderRecord 
+      && recordType <= kHFSPlusFileThreadRecord ? CARVE_CATALOG : -1;
+}
+
+/* checks every sector of the buffer. a single masked compare of the 
+ * descriptor word rejects nearly all of them, only the few left are 
+ * looked at more closely.
+ */
+static void 
+carve_scanBuffer(const unsigned char *buf, u_int64_t len, u_int64_t scanLen,
+      u_int64_t base, carve_result *r) {
+   u_int64_t bits, mask, word, pos;
+   u_int32_t nodeSize;
+   int type;
+   
+   memcpy(&bits, carve_leafBits, sizeof(bits));
+   memcpy(&mask, carve_leafMask, sizeof(mask));
+   
+   for (pos = 0; pos < scanLen && pos + CARVE_SECTOR_SIZE <= len; 
+         pos += CARVE_SECTOR_SIZE) {
+      memcpy(&word, buf + pos + 8, sizeof(word));
+      
+      if ((word & mask) != bits || carve_u16(buf + pos + 10) == 0) {
+         continue;
+      }
+      
+      if ((nodeSize = carve_inferNodeSize(buf + pos, len - pos)) != 0 
+            && (type = carve_classify(buf + pos)) != -1) {
+         carve_add(r, base + pos, nodeSize, type);
+      }
+   }
+}
+
+static void *
+carve_worker(void *arg) {
+   carve_job *job = (carve_job*)arg;
+   u_int64_t bufSize = CARVE_CHUNK_SIZE + CARVE_MAX_NODE_SIZE;
+   unsigned char *buf = (unsigned char*)malloc(bufSize);
+   carve_result local;
+   u_int64_t chunk, want, done;
+   ssize_t n;
+   
+   memset(&local, 0, sizeof(local));
+   
+   for (;;) {
+      pthread_mutex_lock(&job->lock);
+      chunk = job->next;
+      job->next += CARVE_CHUNK_SIZE;
+      pthread_mutex_unlock(&job->lock);
+      
+      if (chunk >= job->end) {
+         break;
+      }
+      
+      /* read past the chunk, so nodes starting near its end are complete */
+      want = job->end - chunk < bufSize ? job->end - chunk : bufSize;
+      done = 0;
+      
+      while (done < want) {
+         if ((n = watchdog_pread(job->watchdog, job->fd, buf + done, 
+                     want - done, chunk + done)) == -1 && errno == EINTR) {
+            continue;
+         }
+         
+         if (n <= 0) {
+            break;
+         }
+         
+         done += n;
+      }
+      
+#ifdef POSIX_FADV_DONTNEED
+      posix_fadvise(job->fd, chunk, CARVE_CHUNK_SIZE, POSIX_FADV_DONTNEED);
+#endif
+      
+      carve_scanBuffer(buf, done, CARVE_CHUNK_SIZE, chunk, &local);
+   }
+   
+   pthread_mutex_lock(&job->lock);
+   
+   while (local.count > 0) {
+      local.count--;
+      carve_add(job->result, local.nodes[local.count].offset, 
+            local.nodes[local.count].nodeSize, local.nodes[local.count].type);
+   }
+   
+   pthread_mutex_unlock(&job->lock);
+   free(local.nodes);
+   free(buf);
+   return NULL;
+}
+
+static int 
+carve_offsetComparator(const void *n1, const void *n2) {
+   u_int64_t o1 = ((const carve_node*)n1)->offset;
+   u_int64_t o2 = ((const carve_node*)n2)->offset;
+   return o1 < o2 ? -1 : o1 > o2;
+}
+
+/* scans the device from start to end for catalog and extents leaf nodes,
+ * with CARVE_THREADS threads reading CARVE_CHUNK_SIZE chunks each. the 
+ * nodes found are returned sorted by their offset.
+ */
+carve_result *
+carve_scan(watchdog *wd, int fd, u_int64_t start, u_int64_t end) {
+   pthread_t threads[CARVE_THREADS];
+   carve_job job;
+   int t;
+   
+   memset(&job, 0, sizeof(job));
+   job.watchdog = wd;
+   job.fd = fd;
+   job.start = job.next = start;
+   job.end = end;
+   job.result = (carve_result*)calloc(1, sizeof(carve_result));
+   pthread_mutex_init(&job.lock, NULL);
+   
+#ifdef POSIX_FADV_SEQUENTIAL
+   posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+#endif
+   
+   for (t = 0; t < CARVE_THREADS; t++) {
+      if (pthread_create(&threads[t], NULL, &carve_worker, &job) != 0) {
+         perror("pthread_create");
+         break;
+      }
+   }
+   
+   if (t == 0) {
+      carve_worker(&job);
+   }
+   
+   while (t-- > 0) {
+      pthread_join(threads[t], NULL);
+   }
+   
+   pthread_mutex_destroy(&job.lock);
+   qsort(job.result->nodes, job.result->count, sizeof(carve_node), 
+         &carve_offsetComparator);
+   return job.result;
+}
+
+/* the most common node size among the nodes of a type */
+u_int32_t 
+carve_nodeSize(const carve_result *const r, u_int32_t type) {
+   u_int64_t counts[7];
+   u_int64_t i;
+   u_int32_t size, best = 0;
+   int s;
+   
+   memset(counts, 0, sizeof(counts));
+   
+   for (i = 0; i < r->count; i++) {
+      if (r->nodes[i].type == type) {
+         for (s = 0, size = CARVE_SECTOR_SIZE; size < r->nodes[i].nodeSize; 
+               s++, size *= 2);
+         counts[s]++;
+      }
+   }
+   
+   for (s = 0, size = CARVE_SECTOR_SIZE; s < 7; s++, size *= 2) {
+      if (counts[s] > 0 && (best == 0 || counts[s] > counts[best-1])) {
+         best = s + 1;
+      }
+   }
+   
+   return best == 0 ? 0 : CARVE_SECTOR_SIZE << (best - 1);
+}
+
+void 
+carve_destroy(carve_result *r) {
+   free(r->nodes);
+   free(r);
+}
@@ -0,0 +1,64 @@
+/*
+ *  carve.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "watchdog.h"
+
+#ifndef __CARVE_H_
+#define __CARVE_H_
+
+/* nodes start on sector boundaries and are at most this large */
+#define CARVE_SECTOR_SIZE   512
+#define CARVE_MAX_NODE_SIZE 32768
+#define CARVE_CHUNK_SIZE    (16*1024*1024)
+#define CARVE_THREADS       8
+
+#define CARVE_CATALOG 0
+#define CARVE_EXTENTS 1
+
+typedef struct {
+   u_int64_t offset;
+   u_int32_t nodeSize;
+   u_int32_t type;
+} carve_node;
+
+typedef struct {
+   carve_node *nodes;
+   u_int64_t count;
+   u_int64_t size;
+} carve_result;
+
+carve_result *
+carve_scan(watchdog *wd, int fd, u_int64_t start, u_int64_t end);
+
+u_int32_t 
+carve_nodeSize(const carve_result *const r, u_int32_t type);
+
+void 
+carve_destroy(carve_result *r);
+
+#endif
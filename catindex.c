@@ -0,0 +1,430 @@
+/*
+ *  catindex.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "catindex.h"
+#include "definitions.h"
+#include "orderedlist.h"
+#include "io.h"
+
+typedef struct {
+   FILE *out;
+   char *strings;
+   u_int64_t stringSize;
+   u_int64_t stringCapacity;
+   u_int64_t count;
+   int error;
+} catindex_writer;
+
+static u_int64_t 
+catindex_addString(catindex_writer *w, const char *const str) {
+   u_int64_t offset = w->stringSize;
+   u_int64_t len = strlen(str) + 1;
+   
+   while (w->stringSize + len > w->stringCapacity) {
+      w->stringCapacity = w->stringCapacity ? w->stringCapacity*2 : 65536;
+      
+      if ((w->strings = (char*)realloc(w->strings, w->stringCapacity)) 
+            == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   memcpy(w->strings + offset, str, len);
+   w->stringSize += len;
+   return offset;
+}
+
+static void 
+catindex_write(catindex_writer *w, const void *const rec, size_t size) {
+   if (fwrite(rec, size, 1, w->out) != 1) {
+      w->error = 1;
+   }
+   w->count++;
+}
+
+static void 
+catindex_writeFolder(btree_node *node, void *retVal) {
+   catindex_writer *w = (catindex_writer*)retVal;
+   folder *fldr = (folder*)node->value;
+   catindex_folder rec;
+   
+   memset(&rec, 0, sizeof(rec));
+   rec.folderID = fldr->folderID;
+   rec.parentID = fldr->parentID;
+   rec.nameOffset = catindex_addString(w, fldr->name);
+   catindex_write(w, &rec, sizeof(rec));
+}
+
+static void 
+catindex_writeFile(btree_node *node, void *retVal) {
+   catindex_writer *w = (catindex_writer*)retVal;
+   file *f;
+   catindex_file rec;
+   u_int32_t versions = 0;
+   
+   for (f = ((file*)node->value)->versions; f != NULL; f = f->versions) {
+      versions++;
+   }
+   
+   for (f = (file*)node->value; f != NULL; f = f->versions) {
+      memset(&rec, 0, sizeof(rec));
+      rec.fileID = f->fileID;
+      rec.parentID = f->parentID;
+      rec.nameOffset = catindex_addString(w, f->name);
+      rec.flags = f->flags & FILE_STALE;
+      rec.node = f->node;
+      rec.versions = versions;
+      memcpy(&rec.hfsFile, f->hfsFile, sizeof(HFSPlusCatalogFile));
+      catindex_write(w, &rec, sizeof(rec));
+      versions = 0;
+   }
+}
+
+static void 
+catindex_writeExtents(btree_node *node, void *retVal) {
+   catindex_writer *w = (catindex_writer*)retVal;
+   extentKey *key = (extentKey*)node->key;
+   ol_node *ext = ((orderedlist*)node->value)->head;
+   catindex_extent rec;
+   
+   for (; ext != NULL; ext = ext->next) {
+      memset(&rec, 0, sizeof(rec));
+      rec.fileID = key->fileID;
+      rec.forkType = key->forkType;
+      rec.startBlock = *(u_int32_t*)ext->key;
+      memcpy(&rec.record, ext->value, sizeof(HFSPlusExtentRecord));
+      catindex_write(w, &rec, sizeof(rec));
+   }
+}
+
+int 
+catindex_save(const HFSPlusVolume *const vol, const char *const fileName, 
+      btree *folders, btree *files, btree *extents) {
+   catindex_header hdr;
+   catindex_writer w;
+   char *tmpName = (char*)malloc(strlen(fileName) + 5);
+   
+   sprintf(tmpName, "%s.tmp", fileName);
+   memset(&w, 0, sizeof(w));
+   memset(&hdr, 0, sizeof(hdr));
+   
+   if ((w.out = fopen(tmpName, "w")) == NULL) {
+      perror("fopen");
+      free(tmpName);
+      return -1;
+   }
+   
+   memcpy(hdr.magic, CATINDEX_MAGIC, sizeof(CATINDEX_MAGIC));
+   hdr.version = CATINDEX_VERSION;
+   hdr.byteOrder = CATINDEX_BYTE_ORDER;
+   hdr.volOffset = vol->volOffset;
+   hdr.volHeader = vol->volHeader;
+   hdr.scanFlags = vol->options.scanFlags;
+   
+   /* the header is rewritten once all offsets are known */
+   catindex_write(&w, &hdr, sizeof(hdr));
+   
+   hdr.folderOffset = ftello(w.out);
+   w.count = 0;
+   btree_inorderTraverseWithReturn(folders, &catindex_writeFolder, &w);
+   hdr.folderCount = w.count;
+   
+   hdr.fileOffset = ftello(w.out);
+   w.count = 0;
+   btree_inorderTraverseWithReturn(files, &catindex_writeFile, &w);
+   hdr.fileCount = w.count;
+   
+   hdr.extentOffset = ftello(w.out);
+   w.count = 0;
+   btree_inorderTraverseWithReturn(extents, &catindex_writeExtents, &w);
+   hdr.extentCount = w.count;
+   
+   hdr.stringOffset = ftello(w.out);
+   hdr.stringSize = w.stringSize;
+   
+   if (w.stringSize > 0) {
+      catindex_write(&w, w.strings, w.stringSize);
+   }
+   
+   if (fseeko(w.out, 0, SEEK_SET) == -1) {
+      w.error = 1;
+   }
+   
+   catindex_write(&w, &hdr, sizeof(hdr));
+   
+   if (fclose(w.out) != 0 || w.error) {
+      fprintf(stderr, "unable to write catalog index: %s\n", tmpName);
+      unlink(tmpName);
+      free(tmpName);
+      free(w.strings);
+      return -1;
+   }
+   
+   if (rename(tmpName, fileName) == -1) {
+      perror("rename");
+      unlink(tmpName);
+      free(tmpName);
+      free(w.strings);
+      return -1;
+   }
+   
+   free(tmpName);
+   free(w.strings);
+   return 0;
+}
+
+/* the records are stored in key order. inserting them in that order would 
+ * degenerate the trees to lists, so the middle element goes in first.
+ */
+static void 
+catindex_insertFolders(btree *tree, folder *fldrs, u_int64_t lo, u_int64_t hi) {
+   u_int64_t mid;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      btree_insert(tree, &fldrs[mid].folderID, &fldrs[mid]);
+      catindex_insertFolders(tree, fldrs, lo, mid);
+      lo = mid + 1;
+   }
+}
+
+static void 
+catindex_insertFiles(btree *tree, file **files, u_int64_t lo, u_int64_t hi) {
+   u_int64_t mid;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      btree_insert(tree, &files[mid]->fileID, files[mid]);
+      catindex_insertFiles(tree, files, lo, mid);
+      lo = mid + 1;
+   }
+}
+
+static void 
+catindex_insertExtents(btree *tree, extentKey *keys, orderedlist **lists, 
+      u_int64_t lo, u_int64_t hi) {
+   u_int64_t mid;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      btree_insert(tree, &keys[mid], lists[mid]);
+      catindex_insertExtents(tree, keys, lists, lo, mid);
+      lo = mid + 1;
+   }
+}
+
+static int 
+catindex_startBlockComparator(void *key1, void *key2) {
+   u_int32_t k1 = *(u_int32_t*)key1;
+   u_int32_t k2 = *(u_int32_t*)key2;
+
+   if( k1 < k2 ) return -1;
+   if( k1 > k2 ) return  1;
+   return 0;
+}
+
+/* a section must be aligned and lie between the header and the strings */
+static int 
+catindex_validSection(const catindex_header *const hdr, u_int64_t offset, 
+      u_int64_t count, size_t recSize) {
+   return offset % 8 == 0 && offset >= sizeof(catindex_header) 
+      && offset <= hdr->stringOffset 
+      && count <= (hdr->stringOffset - offset) / recSize;
+}
+
+/* names are used in place, so each must start within the strings, which 
+ * end with a NUL
+ */
+static int 
+catindex_validNames(const catindex_header *const hdr, 
+      const catindex_folder *const fldrRecs, 
+      const catindex_file *const fileRecs) {
+   u_int64_t i;
+   
+   for (i = 0; i < hdr->folderCount; i++) {
+      if (fldrRecs[i].nameOffset >= hdr->stringSize) {
+         return 0;
+      }
+   }
+   
+   for (i = 0; i < hdr->fileCount; i++) {
+      if (fileRecs[i].nameOffset >= hdr->stringSize) {
+         return 0;
+      }
+   }
+   
+   return 1;
+}
+
+/* the versions of a file follow it and must end within the section */
+static int 
+catindex_validVersions(const catindex_header *const hdr, 
+      const catindex_file *const fileRecs) {
+   u_int64_t i;
+   
+   for (i = 0; i < hdr->fileCount; i += (u_int64_t)fileRecs[i].versions + 1) {
+      if (fileRecs[i].versions >= hdr->fileCount - i) {
+         return 0;
+      }
+   }
+   
+   return 1;
+}
+
+int 
+catindex_load(const HFSPlusVolume *const vol, const char *const fileName, 
+      btree *folders, btree *files, btree *extents) {
+   struct stat st;
+   catindex_header *hdr;
+   catindex_folder *fldrRecs;
+   catindex_file *fileRecs;
+   catindex_extent *extRecs;
+   folder *fldrs;
+   file *fs;
+   file **current;
+   extentKey *keys;
+   orderedlist **lists;
+   char *base, *strings;
+   u_int64_t i, v, keyCount = 0, currentCount = 0;
+   int fd;
+   
+   if ((fd = open(fileName, O_RDONLY)) == -1) {
+      return -1;
+   }
+   
+   if (fstat(fd, &st) == -1 || st.st_size < sizeof(catindex_header)) {
+      close(fd);
+      return -1;
+   }
+   
+   if ((base = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, 
+               MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+      perror("mmap");
+      close(fd);
+      return -1;
+   }
+   
+   close(fd);
+   hdr = (catindex_header*)base;
+   
+   if (memcmp(hdr->magic, CATINDEX_MAGIC, sizeof(CATINDEX_MAGIC)) != 0 
+         || hdr->version != CATINDEX_VERSION 
+         || hdr->byteOrder != CATINDEX_BYTE_ORDER 
+         || hdr->scanFlags != vol->options.scanFlags 
+         || hdr->volOffset != vol->volOffset 
+         || memcmp(&hdr->volHeader, &vol->volHeader, 
+            sizeof(HFSPlusVolumeHeader)) != 0) {
+      fprintf(stderr, "catalog index %s doesn't match the volume\n", fileName);
+      munmap(base, st.st_size);
+      return -1;
+   }
+   
+   if (hdr->stringOffset > (u_int64_t)st.st_size 
+         || hdr->stringSize > (u_int64_t)st.st_size - hdr->stringOffset 
+         || !catindex_validSection(hdr, hdr->folderOffset, hdr->folderCount, 
+            sizeof(catindex_folder)) 
+         || !catindex_validSection(hdr, hdr->fileOffset, hdr->fileCount, 
+            sizeof(catindex_file)) 
+         || !catindex_validSection(hdr, hdr->extentOffset, hdr->extentCount, 
+            sizeof(catindex_extent)) 
+         || (hdr->stringSize > 0 
+            && base[hdr->stringOffset + hdr->stringSize - 1] != '\0')) {
+      fprintf(stderr, "catalog index %s is damaged\n", fileName);
+      munmap(base, st.st_size);
+      return -1;
+   }
+   
+   fldrRecs = (catindex_folder*)(base + hdr->folderOffset);
+   fileRecs = (catindex_file*)(base + hdr->fileOffset);
+   extRecs = (catindex_extent*)(base + hdr->extentOffset);
+   strings = base + hdr->stringOffset;
+   
+   if (!catindex_validNames(hdr, fldrRecs, fileRecs) 
+         || !catindex_validVersions(hdr, fileRecs)) {
+      fprintf(stderr, "catalog index %s is damaged\n", fileName);
+      munmap(base, st.st_size);
+      return -1;
+   }
+   
+   /* names and catalog records are used in place */
+   fldrs = (folder*)calloc(hdr->folderCount + 1, sizeof(folder));
+   
+   for (i = 0; i < hdr->folderCount; i++) {
+      fldrs[i].folderID = fldrRecs[i].folderID;
+      fldrs[i].parentID = fldrRecs[i].parentID;
+      fldrs[i].name = strings + fldrRecs[i].nameOffset;
+   }
+   
+   fs = (file*)calloc(hdr->fileCount + 1, sizeof(file));
+   
+   current = (file**)calloc(hdr->fileCount + 1, sizeof(file*));
+   
+   for (i = 0; i < hdr->fileCount; i++) {
+      fs[i].fileID = fileRecs[i].fileID;
+      fs[i].parentID = fileRecs[i].parentID;
+      fs[i].name = strings + fileRecs[i].nameOffset;
+      fs[i].hfsFile = &fileRecs[i].hfsFile;
+      fs[i].flags = fileRecs[i].flags;
+      fs[i].node = fileRecs[i].node;
+   }
+   
+   /* only the current version of each file goes into the tree */
+   for (i = 0; i < hdr->fileCount; i += (u_int64_t)fileRecs[i].versions + 1) {
+      current[currentCount++] = &fs[i];
+      
+      for (v = 0; v < fileRecs[i].versions; v++) {
+         fs[i+v].versions = &fs[i+v+1];
+      }
+   }
+   
+   keys = (extentKey*)calloc(hdr->extentCount + 1, sizeof(extentKey));
+   lists = (orderedlist**)calloc(hdr->extentCount + 1, sizeof(orderedlist*));
+   
+   for (i = 0; i < hdr->extentCount; i++) {
+      if (keyCount == 0 || keys[keyCount-1].fileID != extRecs[i].fileID 
+            || keys[keyCount-1].forkType != extRecs[i].forkType) {
+         keys[keyCount].fileID = extRecs[i].fileID;
+         keys[keyCount].forkType = extRecs[i].forkType;
+         lists[keyCount] = ol_create(&catindex_startBlockComparator);
+         keyCount++;
+      }
+      
+      ol_insert(lists[keyCount-1], &extRecs[i].startBlock, 
+            &extRecs[i].record);
+   }
+   
+   catindex_insertFolders(folders, fldrs, 0, hdr->folderCount);
+   catindex_insertFiles(files, current, 0, currentCount);
+   catindex_insertExtents(extents, keys, lists, 0, keyCount);
+   free(lists);
+   free(current);
+   return 0;
+}
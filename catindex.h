@@ -0,0 +1,94 @@
+/*
+ *  catindex.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "btree.h"
+#include "io.h"
+
+#ifndef __CATINDEX_H_
+#define __CATINDEX_H_
+
+#define CATINDEX_MAGIC "HFSRIDX"
+#define CATINDEX_VERSION 3
+#define CATINDEX_BYTE_ORDER 0x01020304
+
+/* the index is written in host byte order with all records 8 byte aligned,
+ * so it can be mapped and used in place
+ */
+typedef struct {
+   char magic[8];
+   u_int32_t version;
+   u_int32_t byteOrder;
+   u_int64_t volOffset;
+   HFSPlusVolumeHeader volHeader;
+   u_int32_t scanFlags;
+   u_int32_t folderCount;
+   u_int64_t fileCount;
+   u_int64_t extentCount;
+   u_int64_t folderOffset;
+   u_int64_t fileOffset;
+   u_int64_t extentOffset;
+   u_int64_t stringOffset;
+   u_int64_t stringSize;
+} catindex_header;
+
+typedef struct {
+   u_int32_t folderID;
+   u_int32_t parentID;
+   u_int64_t nameOffset;
+} catindex_folder;
+
+/* a file is followed by the records of its other versions */
+typedef struct {
+   u_int32_t fileID;
+   u_int32_t parentID;
+   u_int64_t nameOffset;
+   u_int32_t flags;
+   u_int32_t node;
+   u_int32_t versions;
+   u_int32_t reserved;
+   HFSPlusCatalogFile hfsFile;
+} catindex_file;
+
+typedef struct {
+   u_int32_t fileID;
+   u_int8_t forkType;
+   u_int8_t pad[3];
+   u_int32_t startBlock;
+   u_int32_t reserved;
+   HFSPlusExtentRecord record;
+} catindex_extent;
+
+int 
+catindex_save(const HFSPlusVolume *const vol, const char *const fileName, 
+      btree *folders, btree *files, btree *extents);
+
+int 
+catindex_load(const HFSPlusVolume *const vol, const char *const fileName, 
+      btree *folders, btree *files, btree *extents);
+
+#endif
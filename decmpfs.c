@@ -0,0 +1,534 @@
+/*
+ *  decmpfs.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <zlib.h>
+#ifdef HAVE_LIBCOMPRESSION
+#include <compression.h>
+#endif
+#include "decmpfs.h"
+#include "io.h"
+
+static u_int32_t 
+decmpfs_type(const attribute *const attr) {
+   return CFSwapInt32LittleToHost(*(u_int32_t*)(attr->data + 4));
+}
+
+u_int64_t 
+decmpfs_size(const attribute *const attr) {
+   return CFSwapInt64LittleToHost(*(u_int64_t*)(attr->data + 8));
+}
+
+/* the decmpfs header of a compressed file, NULL if it isn't compressed */
+const attribute *
+decmpfs_attribute(const file *const f) {
+   const attribute *attr;
+   
+   if ((f->hfsFile->bsdInfo.ownerFlags & DECMPFS_OWNER_FLAG) == 0) {
+      return NULL;
+   }
+   
+   for (attr = f->attributes; attr != NULL; attr = attr->next) {
+      if (strcmp(attr->name, DECMPFS_ATTR_NAME) == 0 
+            && attr->data != NULL && attr->size >= DECMPFS_HEADER_SIZE 
+            && CFSwapInt32LittleToHost(*(u_int32_t*)attr->data) 
+               == DECMPFS_MAGIC) {
+         return attr;
+      }
+   }
+   
+   return NULL;
+}
+
+int 
+decmpfs_supported(const attribute *const attr) {
+   switch (decmpfs_type(attr)) {
+      case DECMPFS_TYPE1_ATTR:
+      case DECMPFS_ZLIB_ATTR:
+      case DECMPFS_ZLIB_RSRC:
+      case DECMPFS_RAW_ATTR:
+      case DECMPFS_RAW_RSRC:
+#ifdef HAVE_LIBCOMPRESSION
+      case DECMPFS_LZVN_ATTR:
+      case DECMPFS_LZVN_RSRC:
+      case DECMPFS_LZFSE_ATTR:
+      case DECMPFS_LZFSE_RSRC:
+#endif
+         return 1;
+   }
+   
+   return 0;
+}
+
+static int 
+decmpfs_stored(const unsigned char *in, u_int32_t inLen, char *out, 
+      u_int32_t outLen) {
+   if (inLen < outLen) {
+      return -1;
+   }
+   
+   memcpy(out, in, outLen);
+   return 0;
+}
+
+/* decodes one chunk. chunks that didn't get smaller are stored behind a 
+ * marker byte instead.
+ */
+static int 
+decmpfs_decode(u_int32_t type, const unsigned char *in, u_int32_t inLen, 
+      char *out, u_int32_t outLen) {
+   uLongf n = outLen;
+   
+   if (inLen == 0) {
+      return outLen == 0 ? 0 : -1;
+   }
+   
+   switch (type) {
+      case DECMPFS_TYPE1_ATTR:
+         return decmpfs_stored(in, inLen, out, outLen);
+      case DECMPFS_RAW_ATTR:
+      case DECMPFS_RAW_RSRC:
+         return inLen == outLen + 1 
+            ? decmpfs_stored(in + 1, inLen - 1, out, outLen) 
+            : decmpfs_stored(in, inLen, out, outLen);
+      case DECMPFS_ZLIB_ATTR:
+      case DECMPFS_ZLIB_RSRC:
+         if ((in[0] & 0x0F) == 0x0F) {
+            return decmpfs_stored(in + 1, inLen - 1, out, outLen);
+         }
+         
+         return uncompress((Bytef*)out, &n, in, inLen) == Z_OK && n == outLen 
+            ? 0 : -1;
+#ifdef HAVE_LIBCOMPRESSION
+      case DECMPFS_LZVN_ATTR:
+      case DECMPFS_LZVN_RSRC:
+         if (in[0] == 0x06) {
+            return decmpfs_stored(in + 1, inLen - 1, out, outLen);
+         }
+         
+         return compression_decode_buffer((uint8_t*)out, outLen, in, inLen, 
+               NULL, COMPRESSION_LZVN) == outLen ? 0 : -1;
+      case DECMPFS_LZFSE_ATTR:
+      case DECMPFS_LZFSE_RSRC:
+         if (inLen == outLen + 1 && memcmp(in, "bvx", 3) != 0) {
+            return decmpfs_stored(in + 1, inLen - 1, out, outLen);
+         }
+         
+         return compression_decode_buffer((uint8_t*)out, outLen, in, inLen, 
+               NULL, COMPRESSION_LZFSE) == outLen ? 0 : -1;
+#endif
+   }
+   
+   return -1;
+}
+
+/* reads len bytes at offset of a fork. returns the buffer to free, data 
+ * points to the requested bytes in it.
+ */
+static char *
+decmpfs_read(HFSPlusVolume *vol, const HFSPlusExtentDescriptor *const exts, 
+      u_int32_t extCount, u_int64_t offset, u_int64_t len, 
+      const char **data) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t first = offset / blockSize;
+   u_int32_t count = (offset + len + blockSize - 1) / blockSize - first;
+   void *buf;
+   
+   if (posix_memalign(&buf, READ_ALIGNMENT, (size_t)count*blockSize) != 0) {
+      perror("posix_memalign");
+      return NULL;
+   }
+   
+   if (readForkBlocks(vol, exts, extCount, first, count, (char*)buf) == -1) {
+      free(buf);
+      return NULL;
+   }
+   
+   *data = (char*)buf + (offset - (u_int64_t)first*blockSize);
+   return (char*)buf;
+}
+
+/* reads the chunk table from the resource fork. zlib compressed files keep 
+ * it in a resource of a resource map, the others at the start of the fork. 
+ * the table must hold one chunk per DECMPFS_CHUNK_SIZE bytes of the file.
+ */
+static decmpfs_chunk *
+decmpfs_readChunks(HFSPlusVolume *vol, u_int32_t type, u_int64_t size, 
+      const HFSPlusForkData *const fork, 
+      const HFSPlusExtentDescriptor *const exts, u_int32_t extCount, 
+      u_int32_t *count) {
+   decmpfs_chunk *chunks = NULL;
+   const char *data;
+   char *buf;
+   u_int64_t tableOffset, tableSize, base;
+   u_int32_t i;
+   
+   if (type == DECMPFS_ZLIB_RSRC) {
+      if (fork->logicalSize < 260 
+            || (buf = decmpfs_read(vol, exts, extCount, 0, 4, &data)) 
+               == NULL) {
+         return NULL;
+      }
+      
+      base = CFSwapInt32BigToHost(*(u_int32_t*)data) + 4;
+      free(buf);
+      
+      if (base + 4 > fork->logicalSize 
+            || (buf = decmpfs_read(vol, exts, extCount, base, 4, &data)) 
+               == NULL) {
+         return NULL;
+      }
+      
+      *count = CFSwapInt32LittleToHost(*(u_int32_t*)data);
+      tableOffset = base + 4;
+      
+      /* a damaged count must not wrap the size of the table */
+      if (*count > (fork->logicalSize - tableOffset) / 8) {
+         free(buf);
+         return NULL;
+      }
+      
+      tableSize = (u_int64_t)*count * 8;
+   } else {
+      if (fork->logicalSize < 4 
+            || (buf = decmpfs_read(vol, exts, extCount, 0, 4, &data)) 
+               == NULL) {
+         return NULL;
+      }
+      
+      base = 0;
+      tableOffset = 0;
+      tableSize = CFSwapInt32LittleToHost(*(u_int32_t*)data);
+      
+      /* the offsets of n chunks are followed by the end of the last one */
+      if (tableSize < 8) {
+         free(buf);
+         return NULL;
+      }
+      
+      *count = tableSize / 4 - 1;
+   }
+   
+   free(buf);
+   
+   if (*count != (size + DECMPFS_CHUNK_SIZE - 1) / DECMPFS_CHUNK_SIZE 
+         || tableOffset + tableSize > fork->logicalSize
+         || (buf = decmpfs_read(vol, exts, extCount, tableOffset, tableSize, 
+               &data)) == NULL) {
+      return NULL;
+   }
+   
+   chunks = (decmpfs_chunk*)malloc(*count * sizeof(decmpfs_chunk));
+   
+   for (i = 0; i < *count; i++) {
+      const u_int32_t *entry = (const u_int32_t*)data;
+      
+      if (type == DECMPFS_ZLIB_RSRC) {
+         chunks[i].offset = base + CFSwapInt32LittleToHost(entry[i*2]);
+         chunks[i].size = CFSwapInt32LittleToHost(entry[i*2+1]);
+      } else {
+         chunks[i].offset = CFSwapInt32LittleToHost(entry[i]);
+         chunks[i].size = CFSwapInt32LittleToHost(entry[i+1]) 
+            - (u_int32_t)chunks[i].offset;
+      }
+      
+      if (chunks[i].offset + chunks[i].size > fork->logicalSize 
+            || chunks[i].size > 2*DECMPFS_CHUNK_SIZE) {
+         fprintf(stderr, "invalid chunk %u in compressed resource fork\n", i);
+         free(chunks);
+         chunks = NULL;
+         break;
+      }
+   }
+   
+   free(buf);
+   return chunks;
+}
+
+/* returns -1 if the chunk is damaged, it is zero-filled then */
+static int 
+decmpfs_decodeChunk(decmpfs_job *job, u_int32_t i) {
+   u_int64_t outOffset = job->outOffset + (u_int64_t)i*DECMPFS_CHUNK_SIZE;
+   u_int32_t outLen = job->size - outOffset < DECMPFS_CHUNK_SIZE 
+      ? (u_int32_t)(job->size - outOffset) : DECMPFS_CHUNK_SIZE;
+   char *out = job->out + (size_t)i*DECMPFS_CHUNK_SIZE;
+   
+   if (decmpfs_decode(job->type, (const unsigned char*)job->in 
+            + (job->chunks[i].offset - job->base), 
+            job->chunks[i].size, out, outLen) == -1) {
+      memset(out, 0, outLen);
+      return -1;
+   }
+   
+   return 0;
+}
+
+/* the workers live as long as the copy of a file and decode the chunks of 
+ * every group handed to them
+ */
+static void *
+decmpfs_worker(void *arg) {
+   decmpfs_job *job = (decmpfs_job*)arg;
+   u_int32_t i;
+   int damaged;
+   
+   pthread_mutex_lock(&job->lock);
+   
+   for (;;) {
+      while (job->next >= job->count && !job->closing) {
+         pthread_cond_wait(&job->ready, &job->lock);
+      }
+      
+      if (job->next >= job->count) {
+         break;
+      }
+      
+      i = job->next++;
+      pthread_mutex_unlock(&job->lock);
+      damaged = decmpfs_decodeChunk(job, i) == -1;
+      pthread_mutex_lock(&job->lock);
+      job->failed += damaged;
+      
+      if (--job->pending == 0) {
+         pthread_cond_signal(&job->done);
+      }
+   }
+   
+   pthread_mutex_unlock(&job->lock);
+   return NULL;
+}
+
+/* decompresses the chunks of a group on the workers, or on the calling 
+ * thread if there are none
+ */
+static void 
+decmpfs_run(decmpfs_job *job, u_int32_t count, int threadCount) {
+   u_int32_t i;
+   
+   if (threadCount == 0) {
+      job->count = count;
+      
+      for (i = 0; i < count; i++) {
+         job->failed += decmpfs_decodeChunk(job, i) == -1;
+      }
+      
+      return;
+   }
+   
+   pthread_mutex_lock(&job->lock);
+   job->count = count;
+   job->next = 0;
+   job->pending = count;
+   pthread_cond_broadcast(&job->ready);
+   
+   while (job->pending > 0) {
+      pthread_cond_wait(&job->done, &job->lock);
+   }
+   
+   pthread_mutex_unlock(&job->lock);
+}
+
+static int 
+decmpfs_isInline(u_int32_t type) {
+   return type != DECMPFS_ZLIB_RSRC && type != DECMPFS_LZVN_RSRC 
+      && type != DECMPFS_LZFSE_RSRC && type != DECMPFS_RAW_RSRC;
+}
+
+static int 
+decmpfs_copyInline(const attribute *const attr, writer *const dst) {
+   u_int64_t size = decmpfs_size(attr);
+   char *out;
+   int failed = 0;
+   
+   if ((out = (char*)malloc(size + 1)) == NULL) {
+      perror("malloc");
+      return -1;
+   }
+   
+   if (decmpfs_decode(decmpfs_type(attr), 
+            (const unsigned char*)attr->data + DECMPFS_HEADER_SIZE, 
+            attr->size - DECMPFS_HEADER_SIZE, out, (u_int32_t)size) == -1) {
+      fprintf(stderr, "damaged compressed data in attribute\n");
+      memset(out, 0, size);
+      failed = 1;
+   }
+   
+   if (writer_write(dst, out, (u_int32_t)size) == -1) {
+      failed = -1;
+   }
+   
+   free(out);
+   return failed;
+}
+
+/* checks that a file can be decompressed before anything of it is written, 
+ * reading the chunk table of data in the resource fork. returns 
+ * DECMPFS_UNUSABLE if it can't, so its compressed resource fork is 
+ * restored instead.
+ */
+int 
+decmpfs_open(HFSPlusVolume *vol, const file *const f, 
+      const attribute *const attr, decmpfs_file *const cf) {
+   const HFSPlusForkData *fork = &f->hfsFile->resourceFork;
+   u_int32_t type = decmpfs_type(attr);
+   u_int64_t size = decmpfs_size(attr);
+   
+   memset(cf, 0, sizeof(decmpfs_file));
+   cf->attr = attr;
+   
+   if (!decmpfs_supported(attr)) {
+      return DECMPFS_UNUSABLE;
+   }
+   
+   if (size == 0) {
+      return 0;
+   }
+   
+   if (decmpfs_isInline(type)) {
+      return size > 0xFFFFFFFF ? DECMPFS_UNUSABLE : 0;
+   }
+   
+   if ((cf->exts = collectForkExtents(fork, f->rsrcExtents, &cf->extCount)) 
+         == NULL) {
+      return DECMPFS_UNUSABLE;
+   }
+   
+   if ((cf->chunks = decmpfs_readChunks(vol, type, size, fork, cf->exts, 
+               cf->extCount, &cf->count)) == NULL) {
+      fprintf(stderr, "unusable chunk table in compressed file: %d\n", 
+            f->fileID);
+      decmpfs_close(cf);
+      return DECMPFS_UNUSABLE;
+   }
+   
+   return 0;
+}
+
+void 
+decmpfs_close(decmpfs_file *const cf) {
+   free(cf->chunks);
+   free(cf->exts);
+   cf->chunks = NULL;
+   cf->exts = NULL;
+}
+
+/* writes the decompressed data of a file opened with decmpfs_open. the 
+ * compressed data of the resource fork is read in groups of chunks, which 
+ * are then decompressed in parallel. returns the number of chunks that were 
+ * damaged and zero-filled, or -1 if writing failed.
+ */
+int 
+decmpfs_copy(HFSPlusVolume *vol, const decmpfs_file *const cf, 
+      writer *const dst) {
+   u_int32_t type = decmpfs_type(cf->attr);
+   u_int64_t size = decmpfs_size(cf->attr), outLen;
+   const HFSPlusExtentDescriptor *exts = cf->exts;
+   const decmpfs_chunk *chunks = cf->chunks;
+   pthread_t threads[DECMPFS_THREADS];
+   decmpfs_job job;
+   u_int32_t extCount = cf->extCount, count = cf->count, i, j, n;
+   char *buf;
+   int t, threadCount, failed = 0;
+   
+   if (size == 0) {
+      return 0;
+   }
+   
+   if (decmpfs_isInline(type)) {
+      return decmpfs_copyInline(cf->attr, dst);
+   }
+   
+   memset(&job, 0, sizeof(job));
+   job.type = type;
+   job.chunks = chunks;
+   job.size = size;
+   job.out = (char*)malloc((size_t)DECMPFS_GROUP_CHUNKS*DECMPFS_CHUNK_SIZE);
+   pthread_mutex_init(&job.lock, NULL);
+   pthread_cond_init(&job.ready, NULL);
+   pthread_cond_init(&job.done, NULL);
+   
+   /* a file of a single chunk is decoded by the calling thread */
+   for (threadCount = 0; count > 1 && threadCount < DECMPFS_THREADS 
+         && threadCount < count; threadCount++) {
+      if (pthread_create(&threads[threadCount], NULL, &decmpfs_worker, 
+               &job) != 0) {
+         perror("pthread_create");
+         break;
+      }
+   }
+   
+   for (i = 0; i < count && failed != -1; i = j) {
+      u_int64_t start = chunks[i].offset, end = start + chunks[i].size;
+      
+      /* a group spans chunks that follow each other in the fork */
+      for (j = i + 1; j < count && j - i < DECMPFS_GROUP_CHUNKS 
+            && chunks[j].offset >= start 
+            && chunks[j].offset + chunks[j].size - start 
+               <= (u_int64_t)DECMPFS_GROUP_CHUNKS*DECMPFS_CHUNK_SIZE; j++) {
+         end = chunks[j].offset + chunks[j].size > end 
+            ? chunks[j].offset + chunks[j].size : end;
+      }
+      
+      /* the workers are idle between groups, the group can be replaced */
+      n = j - i;
+      job.chunks = chunks + i;
+      job.base = start;
+      job.outOffset = (u_int64_t)i*DECMPFS_CHUNK_SIZE;
+      outLen = size - job.outOffset < (u_int64_t)n*DECMPFS_CHUNK_SIZE 
+         ? size - job.outOffset : (u_int64_t)n*DECMPFS_CHUNK_SIZE;
+      
+      if ((buf = decmpfs_read(vol, exts, extCount, start, end - start, 
+                  &job.in)) == NULL) {
+         memset(job.out, 0, outLen);
+         failed += n;
+      } else {
+         job.failed = 0;
+         decmpfs_run(&job, n, threadCount);
+         failed += job.failed;
+         free(buf);
+      }
+      
+      if (writer_write(dst, job.out, (u_int32_t)outLen) == -1) {
+         failed = -1;
+      }
+   }
+   
+   pthread_mutex_lock(&job.lock);
+   job.closing = 1;
+   pthread_cond_broadcast(&job.ready);
+   pthread_mutex_unlock(&job.lock);
+   
+   for (t = 0; t < threadCount; t++) {
+      pthread_join(threads[t], NULL);
+   }
+   
+   pthread_cond_destroy(&job.done);
+   pthread_cond_destroy(&job.ready);
+   pthread_mutex_destroy(&job.lock);
+   free(job.out);
+   return failed;
+}
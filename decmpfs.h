@@ -0,0 +1,117 @@
+/*
+ *  decmpfs.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <pthread.h>
+#include "definitions.h"
+#include "writer.h"
+
+#ifndef __DECMPFS_H_
+#define __DECMPFS_H_
+
+#define DECMPFS_ATTR_NAME "com.apple.decmpfs"
+#define DECMPFS_MAGIC 0x636D7066       /* 'cmpf', stored little endian */
+#define DECMPFS_HEADER_SIZE 16
+#define DECMPFS_OWNER_FLAG 0x20        /* UF_COMPRESSED in bsdInfo.ownerFlags */
+
+/* compression types, the data is either inline in the attribute or in 
+ * chunks in the resource fork
+ */
+#define DECMPFS_TYPE1_ATTR  1
+#define DECMPFS_ZLIB_ATTR   3
+#define DECMPFS_ZLIB_RSRC   4
+#define DECMPFS_LZVN_ATTR   7
+#define DECMPFS_LZVN_RSRC   8
+#define DECMPFS_RAW_ATTR    9
+#define DECMPFS_RAW_RSRC    10
+#define DECMPFS_LZFSE_ATTR  11
+#define DECMPFS_LZFSE_RSRC  12
+
+/* chunks of the resource fork are decompressed in groups by DECMPFS_THREADS
+ * threads, each chunk expands to DECMPFS_CHUNK_SIZE bytes except the last
+ */
+#define DECMPFS_CHUNK_SIZE  65536
+#define DECMPFS_GROUP_CHUNKS 64
+#define DECMPFS_THREADS     8
+
+#define DECMPFS_UNUSABLE    -2
+
+typedef struct {
+   u_int64_t offset;            /* in the resource fork */
+   u_int32_t size;
+} decmpfs_chunk;
+
+typedef struct {
+   u_int32_t type;
+   const char *in;
+   const decmpfs_chunk *chunks;
+   u_int64_t base;              /* fork offset of in */
+   char *out;
+   u_int64_t outOffset;         /* file offset of the first chunk */
+   u_int64_t size;              /* uncompressed size of the file */
+   u_int32_t count;
+   u_int32_t next;
+   u_int32_t pending;           /* chunks of the group not decoded yet */
+   u_int32_t failed;
+   int closing;
+   pthread_mutex_t lock;
+   pthread_cond_t ready;        /* a group was handed out or closing */
+   pthread_cond_t done;         /* the last chunk of the group was decoded */
+} decmpfs_job;
+
+/* a compressed file whose chunk table was read and checked */
+typedef struct {
+   const attribute *attr;
+   HFSPlusExtentDescriptor *exts;
+   u_int32_t extCount;
+   decmpfs_chunk *chunks;
+   u_int32_t count;
+} decmpfs_file;
+
+const attribute *
+decmpfs_attribute(const file *const f);
+
+int 
+decmpfs_supported(const attribute *const attr);
+
+u_int64_t 
+decmpfs_size(const attribute *const attr);
+
+struct _HFSPlusVolume;
+
+int 
+decmpfs_open(struct _HFSPlusVolume *vol, const file *const f, 
+      const attribute *const attr, decmpfs_file *const cf);
+
+int 
+decmpfs_copy(struct _HFSPlusVolume *vol, const decmpfs_file *const cf, 
+      writer *const dst);
+
+void 
+decmpfs_close(decmpfs_file *const cf);
+
+#endif
@@ -43,7 +43,68 @@ typedef struct {
 } folder;
 
 
+/* file flags */
+#define FILE_OVERLAP      0x01  /* shares blocks with another file */
+#define FILE_OUT_OF_RANGE 0x02  /* has extents past the end of the volume */
+#define FILE_UNALLOCATED  0x04  /* has blocks marked free in the bitmap */
+#define FILE_STALE        0x08  /* record found in a free catalog node */
+#define FILE_LINKED       0x20  /* indirect node restored through its links */
+#define FILE_DIRLINK      0x40  /* directory hard link */
+
+/* finder type and creator of hard link records, the link reference is kept 
+ * in bsdInfo.special.iNodeNum and names the iNode<N> file or dir_<N> folder 
+ * in the private metadata folders below the root.
+ */
+#define HARDLINK_FILE_TYPE 0x686C6E6B  /* 'hlnk' */
+#define HARDLINK_CREATOR   0x6866732B  /* 'hfs+' */
+#define DIRLINK_FILE_TYPE  0x66647270  /* 'fdrp' */
+#define DIRLINK_CREATOR    0x4D414353  /* 'MACS' */
+#define PRIVATE_DIR_NAME   ".HFS+ Private Directory Data\r"
+
+/* seconds from 1904, the epoch of hfs+ dates, to 1970 */
+#define HFS_EPOCH_OFFSET 2082844800UL
+
+/* attribute record types */
+#define ATTR_INLINE_DATA  0x10
+#define ATTR_FORK_DATA    0x20
+#define ATTR_EXTENTS      0x30
+
+typedef struct {
+    u_int16_t keyLength;
+    u_int32_t fileID;
+    u_int32_t startBlock;
+    HFSUniStr255 name;
+} attributeKey;
+
 typedef struct {
+    u_int32_t recordType;
+    u_int32_t reserved[2];
+    u_int32_t size;
+    u_int8_t data[2];
+} attributeData;
+
+typedef struct {
+    u_int32_t recordType;
+    u_int32_t reserved;
+    HFSPlusForkData fork;
+} attributeForkData;
+
+typedef struct {
+    u_int32_t recordType;
+    u_int32_t reserved;
+    HFSPlusExtentRecord extents;
+} attributeExtents;
+
+typedef struct _attribute {
+    char *name;
+    u_int32_t size;
+    char *data;                 /* NULL until the value of a fork is read */
+    HFSPlusForkData *fork;      /* values too big to be stored inline */
+    orderedlist *extents;       /* overflow extents of the fork */
+    struct _attribute *next;
+} attribute;
+
+typedef struct _file {
     u_int32_t fileID;
     u_int32_t parentID;
     struct folder *parent;
@@ -52,6 +113,12 @@ typedef struct {
     HFSPlusCatalogFile *hfsFile;
     orderedlist *dataExtents;
     orderedlist *rsrcExtents;
+    int flags;
+    u_int32_t node;             /* catalog node the record was found in */
+    struct _file *versions;     /* other records with the same CNID */
+    struct _file *link;         /* indirect node of a hard link */
+    char *linkPath;             /* where an indirect node was restored */
+    attribute *attributes;      /* from the attributes file */
 } file;
 
 
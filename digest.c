@@ -0,0 +1,324 @@
+/*
+ *  digest.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "digest.h"
+
+#define DIGEST_OK       0
+#define DIGEST_MISSING  1
+#define DIGEST_FAILED   2
+
+typedef struct {
+   hash_digest digest;
+   char *path;
+   int status;
+} digest_entry;
+
+typedef struct {
+   digest_entry *entries;
+   u_int32_t count;
+   u_int32_t next;
+   const char *root;
+   pthread_mutex_t lock;
+} digest_job;
+
+digest_list *
+digest_open(const char *const fileName, const char *const root) {
+   digest_list *d = (digest_list*)calloc(1, sizeof(digest_list));
+   
+   if ((d->out = fopen(fileName, "w")) == NULL) {
+      perror("fopen");
+      free(d);
+      return NULL;
+   }
+   
+   d->root = root;
+   d->rootLen = strlen(root);
+   fprintf(d->out, "# xxh64 sha256 size path\n");
+   return d;
+}
+
+/* paths are stored relative to the recovery path. like sha256sum, a line
+ * whose path contains a newline or backslash starts with a backslash and
+ * has those escaped.
+ */
+void 
+digest_add(digest_list *d, const char *const path, 
+      const hash_digest *const digest) {
+   char hash[HASH_STRING_LEN];
+   const char *rel = path;
+   const char *p;
+   
+   if (strncmp(path, d->root, d->rootLen) == 0 && path[d->rootLen] == '/') {
+      rel = path + d->rootLen + 1;
+   }
+   
+   hash_format(digest, hash);
+   
+   if (strpbrk(rel, "\\\n") == NULL) {
+      fprintf(d->out, "%s %llu %s\n", hash, (unsigned long long)digest->size, 
+            rel);
+   } else {
+      fprintf(d->out, "\\%s %llu ", hash, (unsigned long long)digest->size);
+      
+      for (p = rel; *p != '\0'; p++) {
+         if (*p == '\n') {
+            fputs("\\n", d->out);
+         } else if (*p == '\\') {
+            fputs("\\\\", d->out);
+         } else {
+            fputc(*p, d->out);
+         }
+      }
+      
+      fputc('\n', d->out);
+   }
+   
+   d->files++;
+   d->bytes += digest->size;
+}
+
+void 
+digest_close(digest_list *d) {
+   printf("digests of %llu forks with %llu bytes written\n", 
+         (unsigned long long)d->files, (unsigned long long)d->bytes);
+   
+   if (fclose(d->out) != 0) {
+      perror("fclose");
+   }
+   
+   free(d);
+}
+
+static char *
+digest_unescape(const char *in) {
+   char *out = (char*)malloc(strlen(in) + 1);
+   char *p = out;
+   
+   while (*in != '\0') {
+      if (*in == '\\' && in[1] != '\0') {
+         in++;
+         *p++ = *in == 'n' ? '\n' : *in;
+         in++;
+      } else {
+         *p++ = *in++;
+      }
+   }
+   
+   *p = '\0';
+   return out;
+}
+
+static int 
+digest_parseLine(char *line, digest_entry *const e) {
+   unsigned long long size;
+   int escaped = 0, n, len;
+   
+   len = strlen(line);
+   
+   if (len > 0 && line[len-1] == '\n') {
+      line[--len] = '\0';
+   }
+   
+   if (line[0] == '\\') {
+      escaped = 1;
+      line++;
+   }
+   
+   if ((n = hash_parse(line, &e->digest)) == -1) {
+      return -1;
+   }
+   
+   line += n;
+   
+   if (sscanf(line, " %llu %n", &size, &n) != 1) {
+      return -1;
+   }
+   
+   e->digest.size = size;
+   e->path = escaped ? digest_unescape(line + n) : strdup(line + n);
+   e->status = DIGEST_OK;
+   return 0;
+}
+
+static void 
+digest_check(const char *const root, digest_entry *const e, char *const buf) {
+   char *path = (char*)malloc(strlen(root) + strlen(e->path) + 2);
+   hash_ctx h;
+   hash_digest d;
+   ssize_t n;
+   int fd;
+   
+   sprintf(path, "%s/%s", root, e->path);
+   
+   if ((fd = open(path, O_RDONLY)) == -1) {
+      e->status = DIGEST_MISSING;
+      free(path);
+      return;
+   }
+   
+#ifdef POSIX_FADV_SEQUENTIAL
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+   
+   hash_init(&h, e->digest.flags);
+   
+   while ((n = read(fd, buf, DIGEST_READ_SIZE)) != 0) {
+      if (n == -1) {
+         if (errno == EINTR) {
+            continue;
+         }
+         perror("read");
+         break;
+      }
+      hash_update(&h, buf, n);
+   }
+   
+   hash_final(&h, &d);
+   
+   if (n != 0 || d.size != e->digest.size 
+         || (d.flags & HASH_XXH64) && d.xxh64 != e->digest.xxh64 
+         || (d.flags & HASH_SHA256) 
+         && memcmp(d.sha256, e->digest.sha256, sizeof(d.sha256)) != 0) {
+      e->status = DIGEST_FAILED;
+   }
+   
+   close(fd);
+   free(path);
+}
+
+static void *
+digest_worker(void *arg) {
+   digest_job *job = (digest_job*)arg;
+   char *buf = (char*)malloc(DIGEST_READ_SIZE);
+   u_int32_t i;
+   
+   for (;;) {
+      pthread_mutex_lock(&job->lock);
+      i = job->next++;
+      pthread_mutex_unlock(&job->lock);
+      
+      if (i >= job->count) {
+         break;
+      }
+      
+      digest_check(job->root, &job->entries[i], buf);
+   }
+   
+   free(buf);
+   return NULL;
+}
+
+/* re-hashes every fork listed in the digest file below root, spread over 
+ * several threads, and reports the ones that are missing or differ. returns
+ * the number of failures or -1 if the digest file can't be read.
+ */
+int 
+digest_verify(const char *const fileName, const char *const root) {
+   pthread_t threads[DIGEST_MAX_THREADS];
+   digest_job job;
+   FILE *in;
+   char *line = NULL;
+   size_t lineSize = 0;
+   u_int32_t size = 1024, i;
+   long nThreads;
+   int failed = 0, t;
+   
+   if ((in = fopen(fileName, "r")) == NULL) {
+      perror("fopen");
+      return -1;
+   }
+   
+   memset(&job, 0, sizeof(job));
+   job.root = root;
+   job.entries = (digest_entry*)malloc(size*sizeof(digest_entry));
+   
+   while (getline(&line, &lineSize, in) != -1) {
+      if (line[0] == '#') {
+         continue;
+      }
+      
+      if (job.count == size) {
+         if ((job.entries = (digest_entry*)realloc(job.entries, 
+                     (size *= 2)*sizeof(digest_entry))) == NULL) {
+            perror("realloc");
+            exit(1);
+         }
+      }
+      
+      if (digest_parseLine(line, &job.entries[job.count]) == -1) {
+         fprintf(stderr, "malformed digest line: %s", line);
+         continue;
+      }
+      
+      job.count++;
+   }
+   
+   free(line);
+   fclose(in);
+   
+   nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+   nThreads = nThreads < 1 ? 1 : nThreads;
+   nThreads = nThreads > DIGEST_MAX_THREADS ? DIGEST_MAX_THREADS : nThreads;
+   pthread_mutex_init(&job.lock, NULL);
+   
+   for (t = 0; t < nThreads; t++) {
+      if (pthread_create(&threads[t], NULL, &digest_worker, &job) != 0) {
+         perror("pthread_create");
+         break;
+      }
+   }
+   
+   /* with no thread at all, do the work here */
+   if (t == 0) {
+      digest_worker(&job);
+   }
+   
+   while (t-- > 0) {
+      pthread_join(threads[t], NULL);
+   }
+   
+   pthread_mutex_destroy(&job.lock);
+   
+   for (i = 0; i < job.count; i++) {
+      if (job.entries[i].status == DIGEST_MISSING) {
+         printf("MISSING: %s\n", job.entries[i].path);
+         failed++;
+      } else if (job.entries[i].status == DIGEST_FAILED) {
+         printf("FAILED: %s\n", job.entries[i].path);
+         failed++;
+      }
+      
+      free(job.entries[i].path);
+   }
+   
+   printf("%u forks verified, %d failed\n", job.count, failed);
+   free(job.entries);
+   return failed;
+}
@@ -33,8 +33,6 @@
 #include "io.h"
 #include "util.h"
 
-extern HFSPlusVolume volume;
-
 void 
 dumpForkData(const HFSPlusForkData *const file) {
    int i;
@@ -57,22 +55,22 @@ dumpForkData(const HFSPlusForkData *const file) {
 }
 
 void 
-dumpVolumeHeader() {
+dumpVolumeHeader(const HFSPlusVolume *const vol) {
    printf("Volume header\n");
-   printf(" signature:    %c%c\n", volume.volHeader.signature>>8, 
-         volume.volHeader.signature);
-   printf(" version:      %d\n", volume.volHeader.version);
-   printf(" file count:   %d\n", volume.volHeader.fileCount);
-   printf(" folder count:  %d\n", volume.volHeader.folderCount);
-   printf(" block size:   %d\n", volume.volHeader.blockSize);
-   printf(" total blocks:  %d\n", volume.volHeader.totalBlocks);
-   printf(" free blocks:   %d\n", volume.volHeader.freeBlocks);
+   printf(" signature:    %c%c\n", vol->volHeader.signature>>8, 
+         vol->volHeader.signature);
+   printf(" version:      %d\n", vol->volHeader.version);
+   printf(" file count:   %d\n", vol->volHeader.fileCount);
+   printf(" folder count:  %d\n", vol->volHeader.folderCount);
+   printf(" block size:   %d\n", vol->volHeader.blockSize);
+   printf(" total blocks:  %d\n", vol->volHeader.totalBlocks);
+   printf(" free blocks:   %d\n", vol->volHeader.freeBlocks);
    printf(" Allocation file:\n");
-   dumpForkData(&volume.volHeader.allocationFile);
+   dumpForkData(&vol->volHeader.allocationFile);
    printf(" Extents overflow file:\n");
-   dumpForkData(&volume.volHeader.extentsFile);
+   dumpForkData(&vol->volHeader.extentsFile);
    printf(" Catalog file:\n");
-   dumpForkData(&volume.volHeader.catalogFile);
+   dumpForkData(&vol->volHeader.catalogFile);
 }
 
 void 
@@ -146,9 +144,10 @@ dumpThread(HFSPlusCatalogThread *thread) {
 
 
 void 
-dumpCatalogRecords(char *node, BTNodeDescriptor *desc) {
+dumpCatalogRecords(HFSPlusVolume *vol, char *node, 
+      BTNodeDescriptor *desc) {
    int i = 0;
-   int firstOffset = volume.catalogHeader->nodeSize-2;
+   int firstOffset = vol->catalogHeader->nodeSize-2;
    
    for (i = 0; i < desc->numRecords; i++) {
       u_int16_t offset = CFSwapInt16BigToHost(*(u_int16_t*)(node+firstOffset));
@@ -195,32 +194,34 @@ dumpCatalogRecords(char *node, BTNodeDescriptor *desc) {
 }
 
 void 
-dumpCatalogFile() {
-   u_int32_t blockSize = volume.volHeader.blockSize;
-   u_int32_t startBlock = volume.volHeader.catalogFile.extents[0].startBlock;
+dumpCatalogFile(HFSPlusVolume *vol) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t startBlock = vol->volHeader.catalogFile.extents[0].startBlock;
    u_int32_t descOffset = blockSize *startBlock;
    char *node = (char*)malloc(142);
 
-   readNode(descOffset, node, 142);
+   readNode(vol, descOffset, node, 142);
    
    BTNodeDescriptor *desc = (BTNodeDescriptor*)&node[0];
-   volume.catalogHeader = (BTHeaderRec*)&node[14];
    convertNodeDescriptorToHostByteOrder(desc);
-   convertHeaderRecordToHostByteOrder(volume.catalogHeader);
+   free(vol->catalogHeader);
+   vol->catalogHeader = (BTHeaderRec*)malloc(sizeof(BTHeaderRec));
+   memcpy(vol->catalogHeader, &node[14], sizeof(BTHeaderRec));
+   convertHeaderRecordToHostByteOrder(vol->catalogHeader);
 
    dumpNodeDescriptor(desc);
-   dumpHeaderRecord(volume.catalogHeader);
+   dumpHeaderRecord(vol->catalogHeader);
    
-   node = (char*)malloc(volume.catalogHeader->nodeSize);
+   node = (char*)malloc(vol->catalogHeader->nodeSize);
    
-   u_int32_t nextLeafNode = volume.catalogHeader->firstLeafNode;
+   u_int32_t nextLeafNode = vol->catalogHeader->firstLeafNode;
    
    while (nextLeafNode) {
-      readCatalogNode(nextLeafNode, node);
+      readCatalogNode(vol, nextLeafNode, node);
       desc = (BTNodeDescriptor*)&node[0];
       convertNodeDescriptorToHostByteOrder(desc);
       dumpNodeDescriptor(desc);
-      dumpCatalogRecords(node, desc);
+      dumpCatalogRecords(vol, node, desc);
       nextLeafNode = desc->fLink;
    }
 }
@@ -29,12 +29,13 @@
  *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <CoreServices/CoreServices.h>
+#include "io.h"
 
 void 
 dumpForkData(const HFSPlusForkData *const file);
 
 void 
-dumpVolumeHeader();
+dumpVolumeHeader(const HFSPlusVolume *const vol);
 
 void 
 dumpNodeDescriptor(const BTNodeDescriptor const* desc);
@@ -0,0 +1,191 @@
+/*
+ *  extcheck.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "extcheck.h"
+#include "io.h"
+
+extcheck *
+extcheck_create(u_int32_t totalBlocks, const bitmap *const allocation) {
+   extcheck *ec = (extcheck*)calloc(1, sizeof(extcheck));
+   ec->size = 1024;
+   ec->totalBlocks = totalBlocks;
+   ec->allocation = allocation;
+   ec->extents = (extcheck_extent*)malloc(ec->size*sizeof(extcheck_extent));
+   return ec;
+}
+
+void 
+extcheck_destroy(extcheck *ec) {
+   free(ec->extents);
+   free(ec);
+}
+
+static void 
+extcheck_tag(file *owner, int flag) {
+   if (owner != NULL) {
+      owner->flags |= flag;
+   }
+}
+
+/* adds all extents of a fork. extents reaching past the end of the volume 
+ * tag their file right away and are left out of the overlap check. the 
+ * volume's own special files are added without an owner, so files 
+ * claiming their blocks are caught as well. with the allocation bitmap, 
+ * files with blocks marked as free are tagged and the allocated blocks of 
+ * all files are counted.
+ */
+void 
+extcheck_addFork(extcheck *ec, const HFSPlusForkData *const fork, 
+      const orderedlist *const extList, file *owner, u_int8_t forkType) {
+   HFSPlusExtentDescriptor *exts;
+   u_int32_t count, i, allocated, forkBlock = 0;
+   
+   if ((exts = collectForkExtents(fork, extList, &count)) == NULL) {
+      return;
+   }
+   
+   for (i = 0; i < count; forkBlock += exts[i].blockCount, i++) {
+      if ((u_int64_t)exts[i].startBlock + exts[i].blockCount 
+            > ec->totalBlocks) {
+         extcheck_tag(owner, FILE_OUT_OF_RANGE);
+         continue;
+      }
+      
+      if (ec->allocation != NULL && owner != NULL) {
+         allocated = bitmap_countAllocated(ec->allocation, 
+               exts[i].startBlock, exts[i].blockCount);
+         
+         if (allocated < exts[i].blockCount) {
+            extcheck_tag(owner, FILE_UNALLOCATED);
+         }
+         
+         ec->blocks += exts[i].blockCount;
+         ec->allocatedBlocks += allocated;
+      }
+      
+      if (ec->count == ec->size) {
+         if ((ec->extents = (extcheck_extent*)realloc(ec->extents, 
+                     (ec->size *= 2)*sizeof(extcheck_extent))) == NULL) {
+            perror("realloc");
+            exit(1);
+         }
+      }
+      
+      ec->extents[ec->count].startBlock = exts[i].startBlock;
+      ec->extents[ec->count].blockCount = exts[i].blockCount;
+      ec->extents[ec->count].forkBlock = forkBlock;
+      ec->extents[ec->count].forkType = forkType;
+      ec->extents[ec->count].owner = owner;
+      ec->count++;
+      
+      if (exts[i].blockCount > ec->maxBlockCount) {
+         ec->maxBlockCount = exts[i].blockCount;
+      }
+   }
+   
+   free(exts);
+}
+
+static int 
+extcheck_comparator(const void *e1, const void *e2) {
+   u_int32_t s1 = ((const extcheck_extent*)e1)->startBlock;
+   u_int32_t s2 = ((const extcheck_extent*)e2)->startBlock;
+   return s1 < s2 ? -1 : s1 > s2;
+}
+
+/* sorts the extents by their start and sweeps over them, keeping the end 
+ * of the extent reaching furthest so far. a run of extents each starting 
+ * before that end forms a cluster in which every extent overlaps at least
+ * one other, so all of their files are tagged.
+ */
+void 
+extcheck_run(extcheck *ec) {
+   u_int64_t maxEnd = 0, end;
+   u_int32_t first = 0, i, j;
+   
+   qsort(ec->extents, ec->count, sizeof(extcheck_extent), 
+         &extcheck_comparator);
+   
+   for (i = 0; i <= ec->count; i++) {
+      if (i < ec->count && ec->extents[i].startBlock < maxEnd) {
+         end = (u_int64_t)ec->extents[i].startBlock 
+            + ec->extents[i].blockCount;
+         maxEnd = end > maxEnd ? end : maxEnd;
+         continue;
+      }
+      
+      /* the cluster [first, i) is complete */
+      if (i - first > 1) {
+         for (j = first; j < i; j++) {
+            extcheck_tag(ec->extents[j].owner, FILE_OVERLAP);
+         }
+      }
+      
+      if (i < ec->count) {
+         first = i;
+         maxEnd = (u_int64_t)ec->extents[i].startBlock 
+            + ec->extents[i].blockCount;
+      }
+   }
+}
+
+/* calls the handler for every extent overlapping a run of blocks, once 
+ * extcheck_run has sorted them. the search goes back from the last extent
+ * starting within the run as far as the longest extent reaches.
+ */
+void 
+extcheck_owners(const extcheck *const ec, u_int32_t startBlock, 
+      u_int32_t blockCount, 
+      void(*handler)(const extcheck_extent *const ext, void *retVal), 
+      void *retVal) {
+   u_int64_t end = (u_int64_t)startBlock + blockCount;
+   u_int32_t lo = 0, hi = ec->count, mid;
+   const extcheck_extent *e;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      
+      if (ec->extents[mid].startBlock < end) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+   
+   while (lo-- > 0) {
+      e = &ec->extents[lo];
+      
+      if ((u_int64_t)e->startBlock + ec->maxBlockCount <= startBlock) {
+         break;
+      }
+      
+      if ((u_int64_t)e->startBlock + e->blockCount > startBlock) {
+         (*handler)(e, retVal);
+      }
+   }
+}
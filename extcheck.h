@@ -0,0 +1,74 @@
+/*
+ *  extcheck.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "definitions.h"
+#include "bitmap.h"
+
+#ifndef __EXTCHECK_H_
+#define __EXTCHECK_H_
+
+typedef struct {
+   u_int32_t startBlock;
+   u_int32_t blockCount;
+   /* the position of the extent within its fork, in blocks */
+   u_int32_t forkBlock;
+   u_int8_t forkType;
+   file *owner;
+} extcheck_extent;
+
+typedef struct {
+   extcheck_extent *extents;
+   u_int32_t count;
+   u_int32_t size;
+   u_int32_t totalBlocks;
+   u_int32_t maxBlockCount;
+   const bitmap *allocation;
+   u_int64_t blocks;
+   u_int64_t allocatedBlocks;
+} extcheck;
+
+extcheck *
+extcheck_create(u_int32_t totalBlocks, const bitmap *const allocation);
+
+void 
+extcheck_destroy(extcheck *ec);
+
+void 
+extcheck_addFork(extcheck *ec, const HFSPlusForkData *const fork, 
+      const orderedlist *const extList, file *owner, u_int8_t forkType);
+
+void 
+extcheck_run(extcheck *ec);
+
+void 
+extcheck_owners(const extcheck *const ec, u_int32_t startBlock, 
+      u_int32_t blockCount, 
+      void(*handler)(const extcheck_extent *const ext, void *retVal), 
+      void *retVal);
+
+#endif
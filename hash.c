@@ -0,0 +1,271 @@
+/*
+ *  hash.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "hash.h"
+
+/* xxHash64, see https://github.com/Cyan4973/xxHash */
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define XXH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline u_int64_t 
+xxh64_read64(const unsigned char *p) {
+   u_int64_t v;
+   memcpy(&v, p, sizeof(v));
+   return CFSwapInt64LittleToHost(v);
+}
+
+static inline u_int32_t 
+xxh64_read32(const unsigned char *p) {
+   u_int32_t v;
+   memcpy(&v, p, sizeof(v));
+   return CFSwapInt32LittleToHost(v);
+}
+
+static inline u_int64_t 
+xxh64_round(u_int64_t acc, u_int64_t input) {
+   acc += input * XXH_PRIME64_2;
+   acc = XXH_ROTL(acc, 31);
+   return acc * XXH_PRIME64_1;
+}
+
+static inline u_int64_t 
+xxh64_merge(u_int64_t acc, u_int64_t v) {
+   acc ^= xxh64_round(0, v);
+   return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void 
+xxh64_init(hash_xxh64 *s) {
+   memset(s, 0, sizeof(hash_xxh64));
+   s->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+   s->v[1] = XXH_PRIME64_2;
+   s->v[2] = 0;
+   s->v[3] = -XXH_PRIME64_1;
+}
+
+static void 
+xxh64_update(hash_xxh64 *s, const unsigned char *p, u_int32_t len) {
+   const unsigned char *end = p + len;
+   u_int64_t v0, v1, v2, v3;
+   
+   s->total += len;
+   
+   if (s->memSize + len < 32) {
+      memcpy(s->mem + s->memSize, p, len);
+      s->memSize += len;
+      return;
+   }
+   
+   if (s->memSize > 0) {
+      memcpy(s->mem + s->memSize, p, 32 - s->memSize);
+      p += 32 - s->memSize;
+      s->v[0] = xxh64_round(s->v[0], xxh64_read64(s->mem));
+      s->v[1] = xxh64_round(s->v[1], xxh64_read64(s->mem+8));
+      s->v[2] = xxh64_round(s->v[2], xxh64_read64(s->mem+16));
+      s->v[3] = xxh64_round(s->v[3], xxh64_read64(s->mem+24));
+      s->memSize = 0;
+   }
+   
+   /* the four lanes are independent, keep them in registers */
+   v0 = s->v[0], v1 = s->v[1], v2 = s->v[2], v3 = s->v[3];
+   
+   while (p + 32 <= end) {
+      v0 = xxh64_round(v0, xxh64_read64(p));
+      v1 = xxh64_round(v1, xxh64_read64(p+8));
+      v2 = xxh64_round(v2, xxh64_read64(p+16));
+      v3 = xxh64_round(v3, xxh64_read64(p+24));
+      p += 32;
+   }
+   
+   s->v[0] = v0, s->v[1] = v1, s->v[2] = v2, s->v[3] = v3;
+   
+   if (p < end) {
+      memcpy(s->mem, p, end - p);
+      s->memSize = end - p;
+   }
+}
+
+static u_int64_t 
+xxh64_digest(const hash_xxh64 *s) {
+   const unsigned char *p = s->mem;
+   const unsigned char *end = s->mem + s->memSize;
+   u_int64_t h;
+   
+   if (s->total >= 32) {
+      h = XXH_ROTL(s->v[0], 1) + XXH_ROTL(s->v[1], 7) 
+         + XXH_ROTL(s->v[2], 12) + XXH_ROTL(s->v[3], 18);
+      h = xxh64_merge(h, s->v[0]);
+      h = xxh64_merge(h, s->v[1]);
+      h = xxh64_merge(h, s->v[2]);
+      h = xxh64_merge(h, s->v[3]);
+   } else {
+      h = s->v[2] + XXH_PRIME64_5;
+   }
+   
+   h += s->total;
+   
+   while (p + 8 <= end) {
+      h ^= xxh64_round(0, xxh64_read64(p));
+      h = XXH_ROTL(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+      p += 8;
+   }
+   
+   if (p + 4 <= end) {
+      h ^= (u_int64_t)xxh64_read32(p) * XXH_PRIME64_1;
+      h = XXH_ROTL(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+      p += 4;
+   }
+   
+   while (p < end) {
+      h ^= (*p++) * XXH_PRIME64_5;
+      h = XXH_ROTL(h, 11) * XXH_PRIME64_1;
+   }
+   
+   h ^= h >> 33;
+   h *= XXH_PRIME64_2;
+   h ^= h >> 29;
+   h *= XXH_PRIME64_3;
+   h ^= h >> 32;
+   return h;
+}
+
+void 
+hash_init(hash_ctx *h, int flags) {
+   h->flags = flags;
+   h->size = 0;
+   
+   if (flags & HASH_XXH64) {
+      xxh64_init(&h->xxh64);
+   }
+   
+   /* CommonCrypto uses the SHA extensions of the cpu where present */
+   if (flags & HASH_SHA256) {
+      CC_SHA256_Init(&h->sha256);
+   }
+}
+
+void 
+hash_update(hash_ctx *h, const char *const data, u_int32_t len) {
+   h->size += len;
+   
+   if (h->flags & HASH_XXH64) {
+      xxh64_update(&h->xxh64, (const unsigned char*)data, len);
+   }
+   
+   if (h->flags & HASH_SHA256) {
+      CC_SHA256_Update(&h->sha256, data, len);
+   }
+}
+
+void 
+hash_final(hash_ctx *h, hash_digest *const digest) {
+   memset(digest, 0, sizeof(hash_digest));
+   digest->flags = h->flags;
+   digest->size = h->size;
+   
+   if (h->flags & HASH_XXH64) {
+      digest->xxh64 = xxh64_digest(&h->xxh64);
+   }
+   
+   if (h->flags & HASH_SHA256) {
+      CC_SHA256_Final(digest->sha256, &h->sha256);
+   }
+}
+
+/* formats the digests as "<xxh64> <sha256>", a digest that wasn't 
+ * computed is written as "-"
+ */
+void 
+hash_format(const hash_digest *const digest, char *const out) {
+   char *p = out;
+   int i;
+   
+   if (digest->flags & HASH_XXH64) {
+      p += sprintf(p, "%016llx", (unsigned long long)digest->xxh64);
+   } else {
+      *p++ = '-';
+   }
+   
+   *p++ = ' ';
+   
+   if (digest->flags & HASH_SHA256) {
+      for (i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+         p += sprintf(p, "%02x", digest->sha256[i]);
+      }
+   } else {
+      *p++ = '-';
+   }
+   
+   *p = '\0';
+}
+
+/* parses the output of hash_format. returns the number of characters 
+ * consumed or -1 if the string is malformed.
+ */
+int 
+hash_parse(const char *const in, hash_digest *const digest) {
+   const char *p = in;
+   unsigned int byte;
+   int i;
+   
+   memset(digest, 0, sizeof(hash_digest));
+   
+   if (*p == '-') {
+      p++;
+   } else {
+      if (sscanf(p, "%16llx", (unsigned long long*)&digest->xxh64) != 1 
+            || strspn(p, "0123456789abcdef") != 16) {
+         return -1;
+      }
+      digest->flags |= HASH_XXH64;
+      p += 16;
+   }
+   
+   if (*p++ != ' ') {
+      return -1;
+   }
+   
+   if (*p == '-') {
+      p++;
+   } else {
+      for (i = 0; i < CC_SHA256_DIGEST_LENGTH; i++, p += 2) {
+         if (sscanf(p, "%2x", &byte) != 1) {
+            return -1;
+         }
+         digest->sha256[i] = byte;
+      }
+      digest->flags |= HASH_SHA256;
+   }
+   
+   return p - in;
+}
@@ -0,0 +1,76 @@
+/*
+ *  hash.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <CommonCrypto/CommonDigest.h>
+
+#ifndef __HASH_H_
+#define __HASH_H_
+
+#define HASH_XXH64  0x01
+#define HASH_SHA256 0x02
+
+typedef struct {
+   u_int64_t v[4];
+   u_int64_t total;
+   unsigned char mem[32];
+   u_int32_t memSize;
+} hash_xxh64;
+
+typedef struct {
+   int flags;
+   u_int64_t size;
+   hash_xxh64 xxh64;
+   CC_SHA256_CTX sha256;
+} hash_ctx;
+
+typedef struct {
+   int flags;
+   u_int64_t size;
+   u_int64_t xxh64;
+   unsigned char sha256[CC_SHA256_DIGEST_LENGTH];
+} hash_digest;
+
+/* enough for both digests as hex, separated by a blank */
+#define HASH_STRING_LEN (16 + 1 + 2*CC_SHA256_DIGEST_LENGTH + 1)
+
+void 
+hash_init(hash_ctx *h, int flags);
+
+void 
+hash_update(hash_ctx *h, const char *const data, u_int32_t len);
+
+void 
+hash_final(hash_ctx *h, hash_digest *const digest);
+
+void 
+hash_format(const hash_digest *const digest, char *const out);
+
+int 
+hash_parse(const char *const in, hash_digest *const digest);
+
+#endif
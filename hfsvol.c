@@ -0,0 +1,468 @@
+/*
+ *  hfsvol.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "hfsvol.h"
+#include "io.h"
+#include "util.h"
+#include "rec_filter.h"
+
+static int 
+hfsvol_cnidComparator(void *key1, void *key2) {
+   u_int32_t k1 = *(u_int32_t*)key1;
+   u_int32_t k2 = *(u_int32_t*)key2;
+   
+   if( k1 < k2 ) return -1;
+   if( k1 > k2 ) return  1;
+   return 0;
+}
+
+static int 
+hfsvol_extentKeyComparator(void *key1, void *key2) {
+   extentKey *k1 = (extentKey*)key1;
+   extentKey *k2 = (extentKey*)key2;
+   
+   if( k1->fileID < k2->fileID ) return -1;
+   if( k1->fileID > k2->fileID ) return  1;
+   if( k1->forkType < k2->forkType ) return -1;
+   if( k1->forkType > k2->forkType ) return  1;
+   return 0;
+}
+
+/* strcasecmp folds ASCII only, the rest of a name must match exactly */
+static int 
+hfsvol_compareNames(const hfsvol_name *k1, const hfsvol_name *k2, 
+      int caseFolding) {
+   if( k1->parentID < k2->parentID ) return -1;
+   if( k1->parentID > k2->parentID ) return  1;
+   return caseFolding ? strcasecmp(k1->name, k2->name) 
+         : strcmp(k1->name, k2->name);
+}
+
+/* the records of a name from used nodes sort before those from free ones */
+static int 
+hfsvol_nameComparator(const void *n1, const void *n2) {
+   const hfsvol_name *k1 = (const hfsvol_name*)n1;
+   const hfsvol_name *k2 = (const hfsvol_name*)n2;
+   int c = hfsvol_compareNames(k1, k2, 0);
+   
+   return c != 0 ? c : k1->stale - k2->stale;
+}
+
+static int 
+hfsvol_caseFoldingNameComparator(const void *n1, const void *n2) {
+   const hfsvol_name *k1 = (const hfsvol_name*)n1;
+   const hfsvol_name *k2 = (const hfsvol_name*)n2;
+   int c = hfsvol_compareNames(k1, k2, 1);
+   
+   return c != 0 ? c : k1->stale - k2->stale;
+}
+
+static void 
+hfsvol_addName(hfsvol *v, u_int32_t parentID, u_int32_t cnid, 
+      char *name) {
+   if (v->nameCount == v->nameSize) {
+      v->nameSize = v->nameSize == 0 ? 1024 : v->nameSize*2;
+      
+      if ((v->names = (hfsvol_name*)realloc(v->names, 
+                  v->nameSize*sizeof(hfsvol_name))) == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   v->names[v->nameCount].parentID = parentID;
+   v->names[v->nameCount].cnid = cnid;
+   v->names[v->nameCount].name = name;
+   v->names[v->nameCount].stale = v->vol->scanNodeFree;
+   v->nameCount++;
+}
+
+/* the first record of a CNID is kept, that's the one from a used node */
+static void 
+hfsvol_addRecord(HFSPlusCatalogKey *key, sint16 recType, void *record, 
+      void *retVal) {
+   hfsvol *v = (hfsvol*)retVal;
+   folder *fldr;
+   file *f;
+   
+   if (recType == kHFSPlusFileRecord) {
+      if (btree_find(v->files, 
+               &((HFSPlusCatalogFile*)record)->fileID) != NULL) {
+         return;
+      }
+      
+      f = (file*)calloc(1, sizeof(file));
+      f->parentID = key->parentID;
+      f->fileID = ((HFSPlusCatalogFile*)record)->fileID;
+      f->name = HFSUniStr255ToCString(&key->nodeName);
+      f->hfsFile = (HFSPlusCatalogFile*)malloc(sizeof(HFSPlusCatalogFile));
+      memcpy(f->hfsFile, record, sizeof(HFSPlusCatalogFile));
+      f->node = v->vol->scanNode;
+      btree_insert(v->files, &f->fileID, f);
+      hfsvol_addName(v, f->parentID, f->fileID, f->name);
+   } else {
+      if (btree_find(v->folders, 
+               &((HFSPlusCatalogFolder*)record)->folderID) != NULL) {
+         return;
+      }
+      
+      fldr = (folder*)calloc(1, sizeof(folder));
+      fldr->parentID = key->parentID;
+      fldr->folderID = ((HFSPlusCatalogFolder*)record)->folderID;
+      fldr->name = HFSUniStr255ToCString(&key->nodeName);
+      btree_insert(v->folders, &fldr->folderID, fldr);
+      hfsvol_addName(v, fldr->parentID, fldr->folderID, fldr->name);
+   }
+}
+
+static void 
+hfsvol_addExtentRecord(HFSPlusExtentKey *key, HFSPlusExtentRecord *record, 
+      void *retVal) {
+   hfsvol *v = (hfsvol*)retVal;
+   extentKey treeKey = { key->fileID, key->forkType };
+   btree_node *node = btree_find(v->extents, &treeKey);
+   orderedlist *list;
+   u_int32_t *listKey;
+   extentKey *k;
+   HFSPlusExtentRecord *r;
+   
+   if (node == NULL) {
+      k = (extentKey*)malloc(sizeof(extentKey));
+      *k = treeKey;
+      list = ol_create(&hfsvol_cnidComparator);
+      btree_insert(v->extents, k, list);
+   } else {
+      list = (orderedlist*)node->value;
+      
+      if (ol_find(list, &key->startBlock) != NULL) {
+         return;
+      }
+   }
+   
+   listKey = (u_int32_t*)malloc(sizeof(u_int32_t));
+   *listKey = key->startBlock;
+   r = (HFSPlusExtentRecord*)malloc(sizeof(HFSPlusExtentRecord));
+   memcpy(r, record, sizeof(HFSPlusExtentRecord));
+   ol_insert(list, listKey, r);
+}
+
+/* the CNID of a name in a folder, 0 if there is none. the first of the 
+ * records of the name is taken, a live one if there is any.
+ */
+static u_int32_t 
+hfsvol_child(hfsvol *v, u_int32_t parentID, const char *const name) {
+   hfsvol_name key = { parentID, 0, (char*)name, 0 };
+   u_int32_t low = 0, high = v->nameCount, mid;
+   
+   while (low < high) {
+      mid = low + (high - low)/2;
+      
+      if (hfsvol_compareNames(&v->names[mid], &key, v->caseFolding) < 0) {
+         low = mid + 1;
+      } else {
+         high = mid;
+      }
+   }
+   
+   if (low < v->nameCount 
+         && hfsvol_compareNames(&v->names[low], &key, v->caseFolding) == 0) {
+      return v->names[low].cnid;
+   }
+   
+   return 0;
+}
+
+/* opens the volume and reads its catalog and extents overflow file. 
+ * returns NULL if the device has no usable volume header or catalog.
+ */
+hfsvol *
+hfsvol_open(const char *const dev, u_int64_t offset, 
+      const HFSPlusRecoveryOptions *const options) {
+   HFSPlusRecoveryOptions volOptions = *options;
+   HFSPlusVolume *vol;
+   badmap *badRanges;
+   hfsvol *v;
+   
+   /* the reads go to the buffers of the caller, which need not be aligned */
+   volOptions.readFlags &= ~READ_DIRECT;
+   
+   if ((badRanges = badmap_load(NULL)) == NULL) {
+      return NULL;
+   }
+   
+   if ((vol = openVolume(dev, offset, &volOptions, badRanges)) == NULL) {
+      return NULL;
+   }
+   
+   v = (hfsvol*)calloc(1, sizeof(hfsvol));
+   v->vol = vol;
+   v->folders = btree_create(&hfsvol_cnidComparator);
+   v->files = btree_create(&hfsvol_cnidComparator);
+   v->extents = btree_create(&hfsvol_extentKeyComparator);
+   v->blockSize = vol->volHeader.blockSize;
+   
+   if (sequentiallyReadCatalog(vol, &folderAndFileRecordFilter, 
+            &hfsvol_addRecord, v) == -1) {
+      hfsvol_close(v);
+      return NULL;
+   }
+   
+   sequentiallyReadExtents(vol, &hfsvol_addExtentRecord, v);
+   
+   /* HFS+ always folds case, only HFSX can compare names as binary */
+   v->caseFolding = vol->catalogHeader->keyCompareType != kHFSBinaryCompare;
+   
+   qsort(v->names, v->nameCount, sizeof(hfsvol_name), v->caseFolding 
+         ? &hfsvol_caseFoldingNameComparator : &hfsvol_nameComparator);
+   
+   /* the indirect nodes of file hard links, the name starts with NULs */
+   v->privateFilesID = hfsvol_child(v, kHFSRootFolderID, "");
+   return v;
+}
+
+static void 
+hfsvol_freeFolder(btree_node *node) {
+   folder *fldr = (folder*)node->value;
+   free(fldr->name);
+   free(fldr);
+}
+
+static void 
+hfsvol_freeFile(btree_node *node) {
+   file *f = (file*)node->value;
+   free(f->name);
+   free(f->hfsFile);
+   free(f);
+}
+
+static void 
+hfsvol_freeExtents(btree_node *node) {
+   orderedlist *list = (orderedlist*)node->value;
+   ol_node *n, *next;
+   
+   for (n = list->head; n != NULL; n = next) {
+      next = n->next;
+      free(n->key);
+      free(n->value);
+      ol_destroy_node(n);
+   }
+   
+   free(list);
+   free(node->key);
+}
+
+void 
+hfsvol_close(hfsvol *v) {
+   btree_inorderTraverse(v->folders, &hfsvol_freeFolder);
+   btree_inorderTraverse(v->files, &hfsvol_freeFile);
+   btree_inorderTraverse(v->extents, &hfsvol_freeExtents);
+   btree_destroy(v->folders);
+   btree_destroy(v->files);
+   btree_destroy(v->extents);
+   free(v->names);
+   closeVolume(v->vol);
+   free(v);
+}
+
+/* a hard link is looked up as the indirect node holding its data */
+static file *
+hfsvol_resolve(hfsvol *v, file *f) {
+   HFSPlusCatalogFile *hfsFile;
+   char name[32];
+   
+   if (f == NULL || v->privateFilesID == 0) {
+      return f;
+   }
+   
+   hfsFile = f->hfsFile;
+   
+   if (hfsFile->userInfo.fdType != HARDLINK_FILE_TYPE 
+         || hfsFile->userInfo.fdCreator != HARDLINK_CREATOR) {
+      return f;
+   }
+   
+   snprintf(name, sizeof(name), "iNode%u", hfsFile->bsdInfo.special.iNodeNum);
+   return hfsvol_lookupID(v, hfsvol_child(v, v->privateFilesID, name));
+}
+
+file *
+hfsvol_lookupID(hfsvol *v, u_int32_t cnid) {
+   btree_node *node = btree_find(v->files, &cnid);
+   return hfsvol_resolve(v, node != NULL ? (file*)node->value : NULL);
+}
+
+/* the path starts at the root folder, not at the volume name. returns NULL 
+ * for folders and names that don't exist.
+ */
+file *
+hfsvol_lookupPath(hfsvol *v, const char *const path) {
+   u_int32_t cnid = kHFSRootFolderID;
+   char *copy = strdup(path);
+   char *name, *rest = copy;
+   
+   while (cnid != 0 && (name = strsep(&rest, "/")) != NULL) {
+      if (*name != '\0') {
+         cnid = hfsvol_child(v, cnid, name);
+      }
+   }
+   
+   free(copy);
+   return cnid != 0 ? hfsvol_lookupID(v, cnid) : NULL;
+}
+
+/* maps the blocks of a fork to the volume. returns NULL if its extents 
+ * don't cover its size.
+ */
+hfsvol_fork *
+hfsvol_openFork(hfsvol *v, const file *const f, u_int8_t forkType) {
+   const HFSPlusForkData *data = forkType == 0x00 
+      ? &f->hfsFile->dataFork : &f->hfsFile->resourceFork;
+   extentKey key = { f->fileID, forkType };
+   btree_node *node = btree_find(v->extents, &key);
+   HFSPlusExtentDescriptor *exts;
+   hfsvol_fork *fork;
+   u_int32_t count, forkBlock = 0, i;
+   
+   if (data->logicalSize > (u_int64_t)data->totalBlocks*v->blockSize 
+         || (exts = collectForkExtents(data, node != NULL 
+               ? (orderedlist*)node->value : NULL, &count)) == NULL) {
+      return NULL;
+   }
+   
+   fork = (hfsvol_fork*)calloc(1, sizeof(hfsvol_fork));
+   fork->vol = v->vol;
+   fork->fileID = f->fileID;
+   fork->forkType = forkType;
+   fork->size = data->logicalSize;
+   fork->blockSize = v->blockSize;
+   fork->count = count;
+   fork->runs = (hfsvol_run*)malloc((count > 0 ? count : 1)
+         *sizeof(hfsvol_run));
+   fork->block = (char*)malloc(v->blockSize);
+   
+   for (i = 0; i < count; i++) {
+      fork->runs[i].forkBlock = forkBlock;
+      fork->runs[i].startBlock = exts[i].startBlock;
+      fork->runs[i].blockCount = exts[i].blockCount;
+      forkBlock += exts[i].blockCount;
+   }
+   
+   free(exts);
+   return fork;
+}
+
+/* the run holding a block of the fork */
+static const hfsvol_run *
+hfsvol_findRun(const hfsvol_fork *const fork, u_int32_t forkBlock) {
+   u_int32_t lo = 0, hi = fork->count, mid;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo)/2;
+      
+      if (forkBlock < fork->runs[mid].forkBlock) {
+         hi = mid;
+      } else if (forkBlock >= fork->runs[mid].forkBlock 
+            + fork->runs[mid].blockCount) {
+         lo = mid + 1;
+      } else {
+         return &fork->runs[mid];
+      }
+   }
+   
+   return NULL;
+}
+
+/* reads like pread(2), up to the end of the fork. whole blocks are read 
+ * straight into buf. unreadable ranges of the device are zero-filled.
+ */
+ssize_t 
+hfsvol_pread(hfsvol_fork *fork, void *buf, size_t len, u_int64_t offset) {
+   u_int32_t blockSize = fork->blockSize;
+   const hfsvol_run *run;
+   u_int32_t forkBlock, within, n;
+   u_int64_t pos;
+   size_t done = 0, piece;
+   char *out = (char*)buf;
+   
+   if (offset >= fork->size) {
+      return 0;
+   }
+   
+   if (len > fork->size - offset) {
+      len = fork->size - offset;
+   }
+   
+   while (done < len) {
+      pos = offset + done;
+      forkBlock = pos / blockSize;
+      within = pos % blockSize;
+      
+      if ((run = hfsvol_findRun(fork, forkBlock)) == NULL) {
+         break;
+      }
+      
+      if (within == 0 && len - done >= blockSize) {
+         n = (len - done) / blockSize;
+         n = n < run->forkBlock + run->blockCount - forkBlock 
+            ? n : run->forkBlock + run->blockCount - forkBlock;
+         
+         if (readBlocks(fork->vol, 
+                  run->startBlock + (forkBlock - run->forkBlock), n, 
+                  out + done) == -1) {
+            break;
+         }
+         
+         done += (size_t)n*blockSize;
+      } else {
+         if (readBlocks(fork->vol, 
+                  run->startBlock + (forkBlock - run->forkBlock), 1, 
+                  fork->block) == -1) {
+            break;
+         }
+         
+         piece = blockSize - within < len - done 
+            ? blockSize - within : len - done;
+         memcpy(out + done, fork->block + within, piece);
+         done += piece;
+      }
+   }
+   
+   if (done == 0 && len > 0) {
+      errno = EIO;
+      return -1;
+   }
+   
+   return done;
+}
+
+void 
+hfsvol_closeFork(hfsvol_fork *fork) {
+   free(fork->runs);
+   free(fork->block);
+   free(fork);
+}
@@ -0,0 +1,102 @@
+/*
+ *  hfsvol.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "definitions.h"
+#include "btree.h"
+#include "io.h"
+
+#ifndef __HFSVOL_H_
+#define __HFSVOL_H_
+
+/* a run of blocks of a fork, the inline and overflow extents flattened 
+ * into one array ordered by forkBlock
+ */
+typedef struct {
+   u_int32_t forkBlock;
+   u_int32_t startBlock;
+   u_int32_t blockCount;
+} hfsvol_run;
+
+/* a folder or file by the name it has in its parent folder */
+typedef struct {
+   u_int32_t parentID;
+   u_int32_t cnid;
+   char *name;
+   int stale;                  /* record found in a free catalog node */
+} hfsvol_name;
+
+/* the catalog of a volume opened for reading single files without 
+ * restoring them
+ */
+typedef struct {
+   HFSPlusVolume *vol;
+   btree *folders;
+   btree *files;
+   btree *extents;
+   hfsvol_name *names;
+   u_int32_t nameCount;
+   u_int32_t nameSize;
+   u_int32_t blockSize;
+   u_int32_t privateFilesID;
+   int caseFolding;            /* names compare like on an HFS+ volume */
+} hfsvol;
+
+typedef struct {
+   HFSPlusVolume *vol;
+   u_int32_t fileID;
+   u_int8_t forkType;
+   u_int64_t size;
+   hfsvol_run *runs;
+   u_int32_t count;
+   u_int32_t blockSize;
+   char *block;                /* the blocks a read starts or ends in */
+} hfsvol_fork;
+
+hfsvol *
+hfsvol_open(const char *const dev, u_int64_t offset, 
+      const HFSPlusRecoveryOptions *const options);
+
+void 
+hfsvol_close(hfsvol *v);
+
+file *
+hfsvol_lookupID(hfsvol *v, u_int32_t cnid);
+
+file *
+hfsvol_lookupPath(hfsvol *v, const char *const path);
+
+hfsvol_fork *
+hfsvol_openFork(hfsvol *v, const file *const f, u_int8_t forkType);
+
+ssize_t 
+hfsvol_pread(hfsvol_fork *fork, void *buf, size_t len, u_int64_t offset);
+
+void 
+hfsvol_closeFork(hfsvol_fork *fork);
+
+#endif
@@ -29,141 +29,592 @@
  *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#ifdef __APPLE__
+#include <sys/disk.h>
+#endif
 #include "io.h"
+#include "batch.h"
+#include "digest.h"
+#include "carve.h"
+#include "watchdog.h"
+#include "decmpfs.h"
+#include "sink.h"
 
-HFSPlusVolume volume;
 
+/* the size of the device or image in bytes, 0 if unknown */
+static u_int64_t 
+deviceSize(int fd) {
+   off_t end;
+   
+#ifdef DKIOCGETBLOCKCOUNT
+   u_int64_t blockCount;
+   u_int32_t blockSize;
+   
+   if (ioctl(fd, DKIOCGETBLOCKCOUNT, &blockCount) == 0 
+         && ioctl(fd, DKIOCGETBLOCKSIZE, &blockSize) == 0) {
+      return blockCount * blockSize;
+   }
+#endif
 
-void 
-openVolume(const char *const dev, u_int64_t volOffset) {
-   if ((volume.device = fopen(dev, "r")) == NULL) {
-      perror("fopen");
-      exit(1);
+   if ((end = lseek(fd, 0, SEEK_END)) == -1) {
+      return 0;
    }
    
-   volume.volOffset = volOffset;
+   return (u_int64_t)end;
+}
+
+static int 
+isValidVolumeHeader(const HFSPlusVolume *const vol) {
+   return vol->volHeader.signature == kHFSPlusSigWord 
+      && vol->volHeader.version == kHFSPlusVersion 
+      && vol->volHeader.blockSize >= 512 
+      && (vol->volHeader.blockSize & (vol->volHeader.blockSize - 1)) == 0;
+}
+
+/* a volume header for carving, without any special files */
+static void 
+synthesizeVolumeHeader(HFSPlusVolume *vol, u_int64_t size) {
+   memset(&vol->volHeader, 0, sizeof(HFSPlusVolumeHeader));
+   vol->volHeader.signature = kHFSPlusSigWord;
+   vol->volHeader.version = kHFSPlusVersion;
+   vol->volHeader.blockSize = vol->options.carveBlockSize;
+   vol->volHeader.totalBlocks = (size - vol->volOffset) 
+      / vol->options.carveBlockSize;
+}
+
+static int 
+openDataPath(HFSPlusVolume *vol, const char *const dev) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   void *buf;
+   
+   /* file data is read through its own descriptor, so it can bypass the 
+    * page cache while the catalog is still read through stdio
+    */
+   vol->dataFd = -1;
    
-   readVolumeHeader();
+   /* direct reads need aligned offsets and lengths, which whole blocks of 
+    * an aligned volume have
+    */
+   vol->directReads = (vol->options.readFlags & READ_DIRECT) 
+      && vol->volOffset % READ_ALIGNMENT == 0 
+      && blockSize % READ_ALIGNMENT == 0;
    
-   if (volume.volHeader.signature != kHFSPlusSigWord 
-         || volume.volHeader.version != kHFSPlusVersion) {
-      fprintf(stderr, "invalid volume header");
+#ifdef O_DIRECT
+   if (vol->directReads) {
+      vol->dataFd = open(dev, O_RDONLY | O_DIRECT);
+      vol->directReads = vol->dataFd != -1;
+   }
+#endif
+
+   if (vol->dataFd == -1 && (vol->dataFd = open(dev, O_RDONLY)) == -1) {
+      perror("open");
+      return -1;
+   }
+   
+#ifdef F_NOCACHE
+   if (vol->directReads) {
+      fcntl(vol->dataFd, F_NOCACHE, 1);
+   }
+#endif
+
+   vol->dataBufSize = READ_CHUNK_SIZE - READ_CHUNK_SIZE % blockSize;
+   vol->dataBufSize = vol->dataBufSize < blockSize 
+      ? blockSize : vol->dataBufSize;
+   
+   if (posix_memalign(&buf, READ_ALIGNMENT, vol->dataBufSize) != 0) {
+      perror("posix_memalign");
       exit(1);
    }
+   
+   vol->dataBuf = (char*)buf;
+   return 0;
+}
+
+/* opens a volume with its own descriptors and buffers. the bad ranges 
+ * belong to the volume from now on. returns NULL if the device can't be 
+ * opened or has no usable volume header.
+ */
+HFSPlusVolume *
+openVolume(const char *const dev, u_int64_t volOffset, 
+      const HFSPlusRecoveryOptions *const options, badmap *badRanges) {
+   HFSPlusVolume *vol = (HFSPlusVolume*)calloc(1, sizeof(HFSPlusVolume));
+   u_int64_t size;
+   int primary;
+   
+   vol->options = *options;
+   vol->badRanges = badRanges;
+   vol->dataFd = -1;
+   vol->watchdog = watchdog_create(options->readTimeout, WATCHDOG_MAX_HUNG);
+   
+   if ((vol->device = fopen(dev, "r")) == NULL) {
+      perror("fopen");
+      closeVolume(vol);
+      return NULL;
+   }
+   
+   vol->volOffset = volOffset;
+   size = deviceSize(fileno(vol->device));
+   
+   primary = readVolumeHeader(vol, volOffset + VOL_HEADER_OFFSET) == 0 
+      && isValidVolumeHeader(vol);
+   
+   /* the alternate volume header is 1024 bytes before the end of the 
+    * volume, which is the end of the device for whole-disk images
+    */
+   if (!primary && size > volOffset + 2*VOL_HEADER_OFFSET) {
+      fprintf(stderr, "invalid volume header, trying the alternate one\n");
+      
+      /* the header at the end of the device belongs to this volume only if 
+       * the volume ends there, save for a partial block
+       */
+      if (readVolumeHeader(vol, size - VOL_HEADER_OFFSET) == 0 
+            && isValidVolumeHeader(vol) 
+            && (volOffset + (u_int64_t)vol->volHeader.totalBlocks 
+               * vol->volHeader.blockSize > size 
+               || size - volOffset - (u_int64_t)vol->volHeader.totalBlocks 
+               * vol->volHeader.blockSize >= vol->volHeader.blockSize)) {
+         fprintf(stderr, "the alternate volume header doesn't match the "
+               "volume's end\n");
+         memset(&vol->volHeader, 0, sizeof(HFSPlusVolumeHeader));
+      }
+   }
+   
+   if (!isValidVolumeHeader(vol)) {
+      if (!(vol->options.scanFlags & SCAN_CARVE) || size <= volOffset) {
+         fprintf(stderr, "invalid volume header\n");
+         closeVolume(vol);
+         return NULL;
+      }
+      
+      fprintf(stderr, "invalid volume header, assuming %u byte blocks\n", 
+            vol->options.carveBlockSize);
+      synthesizeVolumeHeader(vol, size);
+   }
+   
+   /* transactions that were not written to their place yet are laid over 
+    * the metadata read, including the volume header itself
+    */
+   if (primary && (vol->volHeader.attributes & JOURNAL_VOLUME_MASK) 
+         && !(vol->options.readFlags & READ_NO_JOURNAL) 
+         && (vol->journal = journal_load(vol->watchdog, 
+               fileno(vol->device), volOffset, vol->volHeader.blockSize, 
+               vol->volHeader.journalInfoBlock)) != NULL) {
+      printf("using %u blocks of %u transactions from the journal\n", 
+            vol->journal->count, vol->journal->transactions);
+      readVolumeHeader(vol, volOffset + VOL_HEADER_OFFSET);
+   }
+   
+   if (openDataPath(vol, dev) == -1) {
+      closeVolume(vol);
+      return NULL;
+   }
+   
+   return vol;
 }
 
+/* closes the descriptors and frees the buffers, the bitmap and the bad 
+ * ranges. the sink and digests are closed by their owner.
+ */
 void 
-readVolumeHeader() {
-   if (fseek(volume.device, 
-            volume.volOffset + VOL_HEADER_OFFSET, SEEK_SET) == -1) {
+closeVolume(HFSPlusVolume *vol) {
+   if (vol->device != NULL) {
+      fclose(vol->device);
+   }
+   
+   if (vol->dataFd != -1) {
+      close(vol->dataFd);
+   }
+   
+   if (vol->allocation != NULL) {
+      bitmap_destroy(vol->allocation);
+   }
+   
+   if (vol->badRanges != NULL) {
+      badmap_destroy(vol->badRanges);
+   }
+   
+   journal_destroy(vol->journal);
+   watchdog_destroy(vol->watchdog);
+   free(vol->catalogHeader);
+   free(vol->extentsHeader);
+   free(vol->attributesHeader);
+   free(vol->dataBuf);
+   free(vol->cacheBuf);
+   free(vol);
+}
+
+/* returns -1 if the header can't be read */
+int 
+readVolumeHeader(HFSPlusVolume *vol, u_int64_t offset) {
+   if (fseek(vol->device, offset, SEEK_SET) == -1) {
       perror("unable to seek for volume header");
-      exit(1);
+      return -1;
    }
 
-   if (fread(&volume.volHeader, sizeof(HFSPlusVolumeHeader), 1, 
-            volume.device) != 1) {
+   if (fread(&vol->volHeader, sizeof(HFSPlusVolumeHeader), 1, 
+            vol->device) != 1) {
       perror("unable to read volume header");
-      exit(1);
+      memset(&vol->volHeader, 0, sizeof(HFSPlusVolumeHeader));
+      return -1;
    }
    
-   volume.volHeader.signature = 
-      CFSwapInt16BigToHost(volume.volHeader.signature);
-   volume.volHeader.version = 
-      CFSwapInt16BigToHost(volume.volHeader.version);
-   volume.volHeader.fileCount =
-      CFSwapInt32BigToHost(volume.volHeader.fileCount);
-   volume.volHeader.folderCount = 
-      CFSwapInt32BigToHost(volume.volHeader.folderCount);
-   volume.volHeader.blockSize = 
-      CFSwapInt32BigToHost(volume.volHeader.blockSize);
-   volume.volHeader.totalBlocks =
-      CFSwapInt32BigToHost(volume.volHeader.totalBlocks);
-   volume.volHeader.freeBlocks = 
-      CFSwapInt32BigToHost(volume.volHeader.freeBlocks);
+   journal_apply(vol->journal, offset, (char*)&vol->volHeader, 
+         sizeof(HFSPlusVolumeHeader));
+   vol->volHeader.signature = 
+      CFSwapInt16BigToHost(vol->volHeader.signature);
+   vol->volHeader.version = 
+      CFSwapInt16BigToHost(vol->volHeader.version);
+   vol->volHeader.attributes = 
+      CFSwapInt32BigToHost(vol->volHeader.attributes);
+   vol->volHeader.journalInfoBlock = 
+      CFSwapInt32BigToHost(vol->volHeader.journalInfoBlock);
+   vol->volHeader.fileCount =
+      CFSwapInt32BigToHost(vol->volHeader.fileCount);
+   vol->volHeader.folderCount = 
+      CFSwapInt32BigToHost(vol->volHeader.folderCount);
+   vol->volHeader.blockSize = 
+      CFSwapInt32BigToHost(vol->volHeader.blockSize);
+   vol->volHeader.totalBlocks =
+      CFSwapInt32BigToHost(vol->volHeader.totalBlocks);
+   vol->volHeader.freeBlocks = 
+      CFSwapInt32BigToHost(vol->volHeader.freeBlocks);
    
-   convertFileToHostByteOrder(&volume.volHeader.allocationFile);
-   convertFileToHostByteOrder(&volume.volHeader.extentsFile);
-   convertFileToHostByteOrder(&volume.volHeader.catalogFile);
+   convertFileToHostByteOrder(&vol->volHeader.allocationFile);
+   convertFileToHostByteOrder(&vol->volHeader.extentsFile);
+   convertFileToHostByteOrder(&vol->volHeader.catalogFile);
+   convertFileToHostByteOrder(&vol->volHeader.attributesFile);
+   convertFileToHostByteOrder(&vol->volHeader.startupFile);
+   return 0;
 }
 
 void 
-readNodeDescriptor(const u_int32_t offset, BTNodeDescriptor *const desc) {
-   if (fseek(volume.device, volume.volOffset+offset, SEEK_SET) == -1) {
+readNodeDescriptor(HFSPlusVolume *vol, const u_int32_t offset, 
+      BTNodeDescriptor *const desc) {
+   if (fseek(vol->device, vol->volOffset+offset, SEEK_SET) == -1) {
       perror("unable to seek for node descriptor");
       exit(1);
    }
    
-   if (fread(desc, sizeof(BTNodeDescriptor), 1, volume.device) != 1) {
+   if (fread(desc, sizeof(BTNodeDescriptor), 1, vol->device) != 1) {
       perror("unable to read  node descriptor");
       exit(1);
    }
    
+   journal_apply(vol->journal, vol->volOffset+offset, (char*)desc, 
+         sizeof(BTNodeDescriptor));
    desc->fLink = CFSwapInt32BigToHost(desc->fLink);
    desc->bLink = CFSwapInt32BigToHost(desc->bLink);
    desc->numRecords = CFSwapInt16BigToHost(desc->numRecords);
 }
 
 void 
-readHeaderRecord(const u_int32_t offset, BTHeaderRec *const headerRec) {
-   if (fseek(volume.device, volume.volOffset+offset, SEEK_SET) == -1) {
+readHeaderRecord(HFSPlusVolume *vol, const u_int32_t offset, 
+      BTHeaderRec *const headerRec) {
+   if (fseek(vol->device, vol->volOffset+offset, SEEK_SET) == -1) {
       perror("unable to seek for header record");
       exit(1);
    }
 
-   if (fread(headerRec, sizeof(BTHeaderRec), 1, volume.device) != 1) {
+   if (fread(headerRec, sizeof(BTHeaderRec), 1, vol->device) != 1) {
       perror("unable to read header record");
       exit(1);
    }
+   
+   journal_apply(vol->journal, vol->volOffset+offset, (char*)headerRec, 
+         sizeof(BTHeaderRec));
 }
 
-void 
-readNode(const u_int64_t offset, char *const node, u_int32_t nodeSize) {
-   u_int64_t off = offset + volume.volOffset;
+/* an unreadable node is zero-filled and recorded as a bad range, so the 
+ * b-tree code sees an empty node. returns -1 in that case.
+ */
+int 
+readNode(HFSPlusVolume *vol, const u_int64_t offset, char *const node, 
+      u_int32_t nodeSize) {
+   u_int64_t off = offset + vol->volOffset;
+   int fd = fileno(vol->device);
+   u_int32_t done = 0;
+   ssize_t n;
    
-   if (fsetpos(volume.device, (fpos_t*)&off) == -1) {
-      perror("unable to seek for node");
-      exit(1);
+   while (done < nodeSize) {
+      if ((n = watchdog_pread(vol->watchdog, fd, node + done, 
+                  nodeSize - done, off + done)) == -1 && errno == EINTR) {
+         continue;
+      }
+      
+      if (n <= 0) {
+         fprintf(stderr, "unable to read node at %llu\n", 
+               (unsigned long long)off);
+         memset(node, 0, nodeSize);
+         badmap_mark(vol->badRanges, off, nodeSize, BADMAP_SKIPPED);
+         return -1;
+      }
+      
+      done += n;
    }
    
-   if (fread(node, nodeSize, 1, volume.device) != 1) {
-      perror("unable to read node");
-      exit(1);
-   }
+   journal_apply(vol->journal, off, node, nodeSize);
+   return 0;
 }
 
+/* the offset of a b-tree node within the volume, only the extents in the 
+ * fork itself are searched. returns -1 if the node lies beyond them.
+ */
 u_int64_t 
-calculateCatalogOffset(const u_int32_t nodeNum) {
-   u_int32_t nodeOffset = nodeNum * volume.catalogHeader->nodeSize;
-   u_int32_t block = nodeOffset / volume.volHeader.blockSize;
-   u_int32_t offsetInBlock = nodeOffset % volume.volHeader.blockSize;
-   int i = 0, b = block;
-   
-   while (volume.volHeader.catalogFile.extents[i].blockCount != 0) {
-      if (b <= volume.volHeader.catalogFile.extents[i].blockCount) {
-         u_int64_t offset = 
-            (u_int64_t)(volume.volHeader.catalogFile.extents[i].startBlock+b) 
-            * volume.volHeader.blockSize + offsetInBlock;
-         return offset;
-      }
-      b -= volume.volHeader.catalogFile.extents[i].blockCount;
+calculateNodeOffset(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      u_int32_t nodeSize, const u_int32_t nodeNum) {
+   u_int64_t nodeOffset = (u_int64_t)nodeNum * nodeSize;
+   u_int64_t b = nodeOffset / vol->volHeader.blockSize;
+   u_int32_t offsetInBlock = nodeOffset % vol->volHeader.blockSize;
+   int i = 0;
+   
+   while (i < 8 && fork->extents[i].blockCount != 0) {
+      if (b < fork->extents[i].blockCount) {
+         return (fork->extents[i].startBlock + b) 
+            * vol->volHeader.blockSize + offsetInBlock;
+      }
+      b -= fork->extents[i].blockCount;
       i++;
    }
    
-   printf("block not found. searching in overflow not yet supported\n");
-   exit(1);
+   return (u_int64_t)-1;
+}
+
+u_int64_t 
+calculateCatalogOffset(HFSPlusVolume *vol, const u_int32_t nodeNum) {
+   u_int64_t offset = calculateNodeOffset(vol, &vol->volHeader.catalogFile, 
+         vol->catalogHeader->nodeSize, nodeNum);
+   
+   if (offset == (u_int64_t)-1) {
+      printf("block not found. searching in overflow not yet supported\n");
+      exit(1);
+   }
+   
+   return offset;
+}
+
+/* reads the node allocation map of a b-tree: the map record of the header
+ * node followed by the records of the map nodes chained to it. bit n, most
+ * significant bit first, is set if node n is in use. returns NULL if the 
+ * map can't be read. nodes not covered by the map count as used.
+ */
+u_int8_t *
+readNodeMap(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const BTHeaderRec *const header) {
+   u_int32_t nodeSize = header->nodeSize;
+   u_int32_t mapSize = (header->totalNodes + 7) / 8;
+   u_int8_t *map = (u_int8_t*)malloc(mapSize + 1);
+   char *node = (char*)malloc(nodeSize);
+   BTNodeDescriptor *desc = (BTNodeDescriptor*)node;
+   u_int32_t nodeNum = 0, done = 0, hops = 0, len;
+   u_int16_t start, end, limit;
+   u_int64_t offset;
+   int rec;
+   
+   do {
+      if ((offset = calculateNodeOffset(vol, fork, nodeSize, nodeNum)) 
+            == (u_int64_t)-1) {
+         break;
+      }
+      
+      readNode(vol, offset, node, nodeSize);
+      convertNodeDescriptorToHostByteOrder(desc);
+      rec = nodeNum == 0 ? 2 : 0;
+      
+      if (desc->kind != (nodeNum == 0 ? kBTHeaderNode : kBTMapNode) 
+            || desc->numRecords <= rec 
+            || 2*(desc->numRecords + 1) >= nodeSize) {
+         fprintf(stderr, "invalid map node %u in b-tree\n", nodeNum);
+         break;
+      }
+      
+      start = CFSwapInt16BigToHost(*(u_int16_t*)(node+nodeSize-2-2*rec));
+      end = CFSwapInt16BigToHost(*(u_int16_t*)(node+nodeSize-4-2*rec));
+      limit = nodeSize - 2*(desc->numRecords + 1);
+      
+      if (start >= end || end > limit) {
+         fprintf(stderr, "invalid map record in node %u of b-tree\n", 
+               nodeNum);
+         break;
+      }
+      
+      len = end - start < mapSize - done ? end - start : mapSize - done;
+      memcpy(map + done, node + start, len);
+      done += len;
+      nodeNum = desc->fLink;
+   } while (done < mapSize && nodeNum != 0 && ++hops < header->totalNodes);
+   
+   free(node);
+   
+   if (done == 0) {
+      free(map);
+      return NULL;
+   }
+   
+   memset(map + done, 0xFF, mapSize - done);
+   return map;
+}
+
+static int 
+isNodeInUse(const u_int8_t *const map, u_int32_t nodeNum) {
+   return map == NULL || (map[nodeNum / 8] & (0x80 >> (nodeNum % 8)));
 }
 
 void 
-readCatalogNode(const u_int32_t nodeNum, char *const node) {
-   u_int64_t offset = calculateCatalogOffset(nodeNum);
-   readNode(offset, node, volume.catalogHeader->nodeSize);
+readCatalogNode(HFSPlusVolume *vol, const u_int32_t nodeNum, 
+      char *const node) {
+   u_int64_t offset = calculateCatalogOffset(vol, nodeNum);
+   readNode(vol, offset, node, vol->catalogHeader->nodeSize);
+}
+
+/* sets the extended attributes of a file on the open descriptor. the 
+ * decmpfs header isn't restored since the data is written decompressed, 
+ * and attributes of the protected com.apple.system namespace, like the 
+ * ACL, are rejected when set from user space.
+ */
+int 
+isRestorableAttribute(const attribute *const attr) {
+   return strcmp(attr->name, DECMPFS_ATTR_NAME) != 0 
+      && strncmp(attr->name, PROTECTED_ATTR_PREFIX, 
+            PROTECTED_ATTR_PREFIX_LEN) != 0;
 }
 
 void 
-copyFile(const file *const f, const char *const dstFileName) {
+restoreAttributes(const file *const f, int fd, const char *const dstFileName) {
+   const attribute *attr;
+   
+   for (attr = f->attributes; attr != NULL; attr = attr->next) {
+      if (!isRestorableAttribute(attr)) {
+         continue;
+      }
+      
+      if (attr->data == NULL) {
+         fprintf(stderr, "value of attribute %s not read: %s\n", attr->name, 
+               dstFileName);
+      } else if (fsetxattr(fd, attr->name, attr->data, attr->size, 0, 0) 
+            != 0) {
+         fprintf(stderr, "couldn't set attribute %s (errno=%d): %s\n", 
+               attr->name, errno, dstFileName);
+      }
+   }
+}
+
+static char *
+resourceForkPath(const char *const dstFileName) {
+   int fLen = strlen(dstFileName);
+   char *rsrcFileName = (char*)calloc(RSRC_FORK_NAME_LEN+fLen+1, 1);
+   memcpy(rsrcFileName, dstFileName, fLen);
+   memcpy(rsrcFileName+fLen, RSRC_FORK_NAME, RSRC_FORK_NAME_LEN);
+   return rsrcFileName;
+}
+
+/* the data of a compressed file replaces its empty data fork, its 
+ * resource fork only holds the compressed chunks
+ */
+static int 
+restoreDataFork(HFSPlusVolume *vol, const file *const f, 
+      const char *const dstFileName, const decmpfs_file *const compressed) {
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   sink_fork fork = { dstFileName, f, 0, compressed != NULL 
+      ? decmpfs_size(compressed->attr) : hfsFile->dataFork.logicalSize };
+   u_int64_t holes = vol->holeBytes;
+   hash_digest digest;
+   writer *dst;
+   int damaged = 0, failed = 0;
+   
+   /* open the file in any case. either there is a data fork
+    * or an empty file must be present to write its resource fork
+    */
+   if ((dst = vol->output->createFork(vol->output, &fork)) == NULL) {
+      fprintf(stderr, "failed to restore: %s\n", dstFileName);
+      return -1;
+   }
+   
+   if (compressed != NULL) {
+      if ((damaged = decmpfs_copy(vol, compressed, dst)) == -1) {
+         failed = 1;
+      } else if (damaged > 0) {
+         fprintf(stderr, "%d damaged compressed chunks zero-filled in: %s\n", 
+               damaged, dstFileName);
+      }
+   }
+   
+   if (compressed == NULL && hfsFile->dataFork.totalBlocks > 0 
+         && copyFork(vol, &hfsFile->dataFork, f->dataExtents, dst) == -1) {
+      failed = 1;
+   }
+   
+   writer_digest(dst, &digest);
+   
+   if (vol->output->closeFork(vol->output, dst, &fork) == -1 || failed) {
+      fprintf(stderr, "failed to restore: %s\n", dstFileName);
+      return -1;
+   }
+   
+   /* the digest of a fork with holes would be outdated by a retry pass */
+   if (vol->holeBytes != holes) {
+      fprintf(stderr, "%llu unreadable bytes zero-filled in: %s\n", 
+            (unsigned long long)(vol->holeBytes - holes), dstFileName);
+   } else if (vol->digests != NULL && damaged == 0) {
+      digest_add(vol->digests, dstFileName, &digest);
+   }
+   
+   return 0;
+}
+
+static int 
+restoreResourceFork(HFSPlusVolume *vol, const file *const f, 
+      const char *const dstFileName) {
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   sink_fork fork = { dstFileName, f, 0xFF, 
+      hfsFile->resourceFork.logicalSize };
+   char *rsrcFileName = resourceForkPath(dstFileName);
+   u_int64_t holes = vol->holeBytes;
+   hash_digest digest;
+   writer *dst;
+   int failed;
+   
+   if ((dst = vol->output->createFork(vol->output, &fork)) == NULL) {
+      fprintf(stderr, "failed to restore resource fork of: %s\n", 
+            dstFileName);
+      free(rsrcFileName);
+      return -1;
+   }
+   
+   if ((failed = copyFork(vol, &hfsFile->resourceFork, f->rsrcExtents, dst) 
+            == -1)) {
+      fprintf(stderr, "failed to restore: %s\n", dstFileName);
+   }
+   
+   writer_digest(dst, &digest);
+   
+   if (vol->output->closeFork(vol->output, dst, &fork) == -1) {
+      fprintf(stderr, "failed to restore resource fork of: %s\n", 
+            dstFileName);
+      failed = 1;
+   } else if (!failed && vol->holeBytes != holes) {
+      fprintf(stderr, "%llu unreadable bytes zero-filled in: %s\n", 
+            (unsigned long long)(vol->holeBytes - holes), rsrcFileName);
+   } else if (!failed && vol->digests != NULL) {
+      digest_add(vol->digests, rsrcFileName, &digest);
+   }
+   
+   free(rsrcFileName);
+   return failed ? -1 : 0;
+}
+
+/* returns -1 if the file couldn't be restored */
+int 
+copyFile(HFSPlusVolume *vol, const file *const f, 
+      const char *const dstFileName) {
    HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
-   FILE *dstData, *dstRsrc;
-   int dataBlocks = 0, rsrcBlocks = 0, e;
+   const attribute *attr = decmpfs_attribute(f);
+   int rsrcFirst = vol->output->flags & SINK_RSRC_FIRST;
+   int dataBlocks = 0, rsrcBlocks = 0, rsrc, failed, e;
+   decmpfs_file cf, *compressed = NULL;
    
    for (e = 0; e < 8; e++) {
       dataBlocks += hfsFile->dataFork.extents[e].blockCount;
@@ -178,159 +629,476 @@ copyFile(const file *const f, const char *const dstFileName) {
          || rsrcBlocks != hfsFile->resourceFork.totalBlocks 
          && f->rsrcExtents == NULL) {
       fprintf(stderr, "inconsistency in file extents: %s\n", dstFileName);
-      return;
+      return -1;
    }
    
    printf("restoring file: %d - %s\n", f->fileID, dstFileName);
    
-   /* open the file in any case. either there is a data fork
-    * or an empty file must be present to write its resource fork
+   /* the chunk table is checked before either fork is written, so a file 
+    * that can't be decompressed gets its resource fork back in any sink
     */
-   if ((dstData = fopen(dstFileName, "w") ) == NULL) {
-      perror("fopen");
-      fprintf(stderr, "failed to restore: %s\n", dstFileName);
-      return;
+   if (attr != NULL && !decmpfs_supported(attr)) {
+      fprintf(stderr, "unsupported compression, restoring the compressed "
+            "resource fork of: %s\n", dstFileName);
+   } else if (attr != NULL 
+         && decmpfs_open(vol, f, attr, &cf) == DECMPFS_UNUSABLE) {
+      fprintf(stderr, "unable to decompress, restoring the compressed "
+            "resource fork of: %s\n", dstFileName);
+   } else if (attr != NULL) {
+      compressed = &cf;
    }
    
-   if (hfsFile->dataFork.totalBlocks > 0) {
-      if (copyFork(&hfsFile->dataFork, f->dataExtents, dstData) == -1) {
-         fprintf(stderr, "failed to restore: %s\n", dstFileName);
-         fclose(dstData);
-         return;
-      }
-   }
+   rsrc = compressed == NULL && hfsFile->resourceFork.totalBlocks > 0;
    
-   fclose(dstData);
+   failed = rsrcFirst && rsrc 
+         && restoreResourceFork(vol, f, dstFileName) == -1 
+      || restoreDataFork(vol, f, dstFileName, compressed) == -1 
+      || !rsrcFirst && rsrc 
+         && restoreResourceFork(vol, f, dstFileName) == -1;
    
-   if (hfsFile->resourceFork.totalBlocks > 0) {
-      int fLen = strlen(dstFileName);
-      char *rsrcFileName = (char*)calloc(RSRC_FORK_NAME_LEN+fLen+1, 1);
-      memcpy(rsrcFileName, dstFileName, fLen);
-      memcpy(rsrcFileName+fLen, RSRC_FORK_NAME, RSRC_FORK_NAME_LEN);
+   if (compressed != NULL) {
+      decmpfs_close(compressed);
+   }
    
-      if ((dstRsrc = fopen(rsrcFileName, "w") ) == NULL) {
-         perror("fopen");
-         fprintf(stderr, "failed to restore resource fork of: %s\n", 
-               dstFileName);
-         return;
-      }
+   if (failed) {
+      return -1;
+   }
+   
+   vol->output->setMetadata(vol->output, f, dstFileName);
+   return 0;
+}
 
-      if (copyFork(&hfsFile->resourceFork, f->rsrcExtents, dstRsrc) == -1) {
-         fprintf(stderr, "failed to restore: %s\n", dstFileName);
-         fclose(dstRsrc);
-         free(rsrcFileName);
-         return;
+HFSPlusExtentDescriptor *
+collectForkExtents(const HFSPlusForkData *const fork, 
+      const orderedlist *const extList, u_int32_t *const count) {
+   u_int32_t remainingBlocks = fork->totalBlocks;
+   u_int32_t size = 8;
+   ol_node *extents = extList != NULL ? extList->head : NULL;
+   const HFSPlusExtentDescriptor *rec = fork->extents;
+   HFSPlusExtentDescriptor *exts = 
+      (HFSPlusExtentDescriptor*)malloc(size*sizeof(HFSPlusExtentDescriptor));
+   int i;
+   
+   *count = 0;
+   
+   /* the inline extents first, then the records from the overflow file */
+   while (rec != NULL && remainingBlocks > 0) {
+      for (i = 0; i < 8 && remainingBlocks > 0; i++) {
+         if (rec[i].blockCount == 0) {
+            break;
+         }
+         
+         if (rec[i].blockCount > remainingBlocks) {
+            fprintf(stderr, "%s:%d something's wrong here: we expect %d blocks,"
+                  " the extent apparently contains %d blocks\n", 
+                  __FILE__, __LINE__, remainingBlocks, rec[i].blockCount);
+            free(exts);
+            return NULL;
+         }
+         
+         if (*count == size) {
+            if ((exts = (HFSPlusExtentDescriptor*)realloc(exts, 
+                        (size *= 2)*sizeof(HFSPlusExtentDescriptor))) == NULL) {
+               perror("realloc");
+               exit(1);
+            }
+         }
+         
+         exts[(*count)++] = rec[i];
+         remainingBlocks -= rec[i].blockCount;
       }
       
-      fclose(dstRsrc);
-      free(rsrcFileName);
+      if (extents != NULL) {
+         rec = (HFSPlusExtentDescriptor*)extents->value;
+         extents = extents->next;
+      } else {
+         rec = NULL;
+      }
    }
    
-   setFinderInfo(dstFileName, hfsFile);
-   HFSPlusBSDInfo bsdInfo = hfsFile->bsdInfo;
-   chmod(dstFileName, bsdInfo.fileMode);
+   if (remainingBlocks > 0) {
+      fprintf(stderr, "%s:%d %d blocks of the fork are not covered by "
+            "its extents\n", __FILE__, __LINE__, remainingBlocks);
+      free(exts);
+      return NULL;
+   }
+   
+   return exts;
 }
 
 int 
-copyExtent(char *const buf, const HFSPlusExtentDescriptor *const desc, 
-      FILE *const dst, int isLastExtent, u_int64_t partialBlockSize) {
-   u_int32_t blockSize = volume.volHeader.blockSize;
-   u_int32_t block = desc->startBlock;
-   u_int32_t count = desc->blockCount;
-   u_int64_t offset = (u_int64_t)block*blockSize + volume.volOffset;
+countForkExtents(const HFSPlusForkData *const fork, 
+      const orderedlist *const extList) {
+   HFSPlusExtentDescriptor *exts;
+   u_int32_t count;
+   
+   if ((exts = collectForkExtents(fork, extList, &count)) == NULL) {
+      return -1;
+   }
+   
+   free(exts);
+   return count;
+}
+
+void 
+adviseRead(HFSPlusVolume *vol, u_int64_t offset, u_int64_t len, int advice) {
+   if (vol->directReads) {
+      return;
+   }
+   
+   if (advice == ADVISE_WILLNEED) {
+#if defined(POSIX_FADV_WILLNEED)
+      posix_fadvise(vol->dataFd, offset, len, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+      struct radvisory ra;
+      ra.ra_offset = offset;
+      ra.ra_count = len;
+      fcntl(vol->dataFd, F_RDADVISE, &ra);
+#endif
+   } else {
+#if defined(POSIX_FADV_DONTNEED)
+      posix_fadvise(vol->dataFd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+   }
+}
+
+void 
+readAhead(HFSPlusVolume *vol, readaheadWindow *const ra, u_int64_t consumed) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int64_t len, n;
+   
+   ra->pending = consumed < ra->pending ? ra->pending - consumed : 0;
+   
+   if (ra->pending > ra->window / 2) {
+      return;
+   }
+   
+   /* the fork is read sequentially, so every refill doubles the window */
+   len = ra->window - ra->pending;
+   ra->window = ra->window*2 < READAHEAD_MAX ? ra->window*2 : READAHEAD_MAX;
+   
+   while (len > 0 && ra->ext < ra->count) {
+      const HFSPlusExtentDescriptor *desc = &ra->extents[ra->ext];
+      n = (u_int64_t)(desc->blockCount - ra->block) * blockSize;
+      n = n < len ? n : len;
+      adviseRead(vol, (u_int64_t)(desc->startBlock + ra->block) * blockSize 
+            + vol->volOffset, n, ADVISE_WILLNEED);
+      ra->pending += n;
+      len -= n;
+      ra->block += (n + blockSize - 1) / blockSize;
       
-   while (count-- > 0) {
-      if (fsetpos(volume.device, (fpos_t*)&offset) == -1) {
-         fprintf(stderr, "%s:%d unable to seek for file\n", __FILE__, __LINE__);
-         return -1;
+      if (ra->block >= desc->blockCount) {
+         ra->ext++;
+         ra->block = 0;
       }
-         
-      if (fread(buf, blockSize, 1, volume.device) != 1) {
-         fprintf(stderr, "%s:%d unable to read file\n", __FILE__, __LINE__);
-         int err = ferror(volume.device);
-
-         if (err) {
-            fprintf(stderr, "%s:%d error=%d\n", __FILE__, __LINE__, err);
-            clearerr(volume.device);
-         } else if (feof(volume.device)) {
-            fprintf(stderr, "%s:%d premature end-of-file\n", __FILE__, 
-                  __LINE__);
-         }
+   }
+}
 
+/* reads a range of the device for file data. ranges known to be bad are 
+ * not read again, and a read error doesn't retry the rest of the request 
+ * but records it as skipped, which spares a failing drive until the retry
+ * passes. the parts not read are zero-filled and counted in 
+ * vol->holeBytes. returns -1 at the end of the device, or if strict is 
+ * set, at the first bad range instead of recording it.
+ */
+static int 
+readTolerant(HFSPlusVolume *vol, u_int64_t offset, char *const buf, 
+      size_t len, int strict) {
+   u_int64_t pos = offset, end = offset + len, stop;
+   badmap_range bad;
+   ssize_t n;
+   int found, fd = vol->dataFd;
+   
+   while (pos < end) {
+      found = badmap_next(vol->badRanges, pos, end, &bad);
+      
+      if (strict && found) {
          return -1;
       }
-         
-      fwrite(buf, count == 0 && isLastExtent ? partialBlockSize : blockSize, 1, dst);
-      block++;
-      offset += blockSize;
+      
+      if (found && bad.offset <= pos) {
+         stop = bad.offset + bad.length < end ? bad.offset + bad.length : end;
+         memset(buf + (pos - offset), 0, stop - pos);
+         vol->holeBytes += stop - pos;
+         pos = stop;
+         continue;
+      }
+      
+      stop = found ? bad.offset : end;
+      
+      if ((n = watchdog_pread(vol->watchdog, fd, 
+                  buf + (pos - offset), stop - pos, pos)) > 0) {
+         pos += n;
+      } else if (n == 0) {
+         fprintf(stderr, "%s:%d premature end-of-file\n", __FILE__, __LINE__);
+         return -1;
+      } else if (errno == EINVAL && vol->directReads && fd == vol->dataFd) {
+         /* a bad range left a piece direct i/o can't read, the rest of 
+          * the request goes through the page cache
+          */
+         fd = fileno(vol->device);
+      } else if (errno != EINTR && strict) {
+         return -1;
+      } else if (errno == ETIMEDOUT) {
+         fprintf(stderr, "%s:%d read of %llu bytes at %llu timed out, "
+               "skipping them\n", __FILE__, __LINE__, 
+               (unsigned long long)(stop - pos), (unsigned long long)pos);
+         badmap_mark(vol->badRanges, pos, stop - pos, BADMAP_SKIPPED);
+      } else if (errno != EINTR) {
+         fprintf(stderr, "%s:%d unable to read %llu bytes at %llu (errno=%d), "
+               "skipping them\n", __FILE__, __LINE__, 
+               (unsigned long long)(stop - pos), (unsigned long long)pos, 
+               errno);
+         badmap_mark(vol->badRanges, pos, stop - pos, BADMAP_SKIPPED);
+      }
    }
    
+   /* the bitmap and other metadata may have newer copies in the journal */
+   journal_apply(vol->journal, offset, buf, len);
    return 0;
 }
 
 int 
-copyFork(const HFSPlusForkData *const fork, const orderedlist *extList, 
-      FILE *const dst) {
-   u_int32_t blockSize = volume.volHeader.blockSize;
-   u_int64_t partialBlockSize = fork->logicalSize % blockSize;
-   u_int32_t remainingBlocks = fork->totalBlocks;
-   ol_node *extents = extList != NULL ? extList->head : NULL;
-   int isLastExtent;
-   int i;
-   char *buf = (char*)malloc(blockSize);
+cacheBlocks(HFSPlusVolume *vol, u_int32_t startBlock, u_int32_t count) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   void *buf;
    
-   for (i = 0; i < 8; i++) {
-      if (fork->extents[i].blockCount == 0) {
-         break;
+   if (vol->cacheBuf == NULL) {
+      if (posix_memalign(&buf, READ_ALIGNMENT, BATCH_SPAN_SIZE) != 0) {
+         perror("posix_memalign");
+         exit(1);
       }
+      
+      vol->cacheBuf = (char*)buf;
+   }
+   
+   vol->cacheCount = 0;
+   
+   /* a span with unreadable blocks is not read, each of its files is then 
+    * read on its own, so only their own blocks are recorded as bad
+    */
+   if ((u_int64_t)count*blockSize > BATCH_SPAN_SIZE 
+         || readTolerant(vol, (u_int64_t)startBlock*blockSize + vol->volOffset, 
+            vol->cacheBuf, (size_t)count*blockSize, 1) == -1) {
+      return -1;
+   }
+   
+   vol->cacheStart = startBlock;
+   vol->cacheCount = count;
+   return 0;
+}
 
-      isLastExtent = (i == 7 && extents == NULL 
-            || fork->extents[i+1].blockCount == 0);
+void 
+dropBlockCache(HFSPlusVolume *vol) {
+   vol->cacheCount = 0;
+}
 
-      if (copyExtent(buf, (HFSPlusExtentDescriptor*)(&fork->extents[i]), dst, 
-               isLastExtent, partialBlockSize) == -1) {
-         fprintf(stderr, "%s:%d copyExtent failed\n", __FILE__, __LINE__);
-         free(buf);
+int 
+readBlocks(HFSPlusVolume *vol, u_int32_t startBlock, u_int32_t count, 
+      char *const buf) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int64_t offset = (u_int64_t)startBlock*blockSize + vol->volOffset;
+   size_t len = (size_t)count*blockSize;
+   
+   if (vol->cacheCount > 0 && startBlock >= vol->cacheStart 
+         && startBlock + count <= vol->cacheStart + vol->cacheCount) {
+      memcpy(buf, vol->cacheBuf 
+            + (size_t)(startBlock - vol->cacheStart)*blockSize, len);
+      return 0;
+   }
+   
+   return readTolerant(vol, offset, buf, len, 0);
+}
+
+/* reads count blocks of a fork, starting at its block firstBlock. returns 
+ * -1 if they are not all covered by the extents.
+ */
+int 
+readForkBlocks(HFSPlusVolume *vol, 
+      const HFSPlusExtentDescriptor *const extents, u_int32_t extCount, 
+      u_int32_t firstBlock, u_int32_t count, char *const buf) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t pos = 0, skip, n, e;
+   char *out = buf;
+   
+   for (e = 0; e < extCount && count > 0; e++) {
+      if (firstBlock >= pos + extents[e].blockCount) {
+         pos += extents[e].blockCount;
+         continue;
+      }
+      
+      skip = firstBlock - pos;
+      n = extents[e].blockCount - skip < count 
+         ? extents[e].blockCount - skip : count;
+      
+      if (readBlocks(vol, extents[e].startBlock + skip, n, out) == -1) {
          return -1;
       }
       
-      remainingBlocks -= fork->extents[i].blockCount;
+      out += (size_t)n*blockSize;
+      firstBlock += n;
+      count -= n;
+      pos += extents[e].blockCount;
    }
    
-   while (extents != NULL) {
-      HFSPlusExtentRecord *rec = extents->value;
-      for( i = 0; i < 8; i++ ) {
-         if( rec[i]->blockCount == 0 || remainingBlocks == 0 ) {
-            break;
-         }
+   return count == 0 ? 0 : -1;
+}
+
+/* reads a whole fork into memory. returns NULL if its extents are 
+ * inconsistent.
+ */
+char *
+readForkData(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const orderedlist *const extList) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   HFSPlusExtentDescriptor *exts;
+   u_int32_t count;
+   void *buf;
+   
+   if ((exts = collectForkExtents(fork, extList, &count)) == NULL) {
+      return NULL;
+   }
+   
+   if (fork->logicalSize > (u_int64_t)fork->totalBlocks*blockSize 
+         || posix_memalign(&buf, READ_ALIGNMENT, 
+            (size_t)fork->totalBlocks*blockSize + 1) != 0) {
+      free(exts);
+      return NULL;
+   }
+   
+   if (readForkBlocks(vol, exts, count, 0, fork->totalBlocks, (char*)buf) 
+         == -1) {
+      free(buf);
+      buf = NULL;
+   }
+   
+   free(exts);
+   return (char*)buf;
+}
 
-         isLastExtent = i == 7 && extents->next == NULL 
-            || rec[i+1]->blockCount == 0 
-            || remainingBlocks - rec[i]->blockCount == 0;
+/* retries the skipped ranges in pieces of one size, passing each piece 
+ * read to the handler. pieces still unreadable in the last pass are 
+ * marked bad, unless they timed out. returns the number of bytes 
+ * recovered.
+ */
+u_int64_t 
+retryBadRanges(HFSPlusVolume *vol, u_int32_t pass, 
+      void(*handler)(u_int64_t offset, const char *data, u_int32_t len, 
+         void *retVal), 
+      void *retVal) {
+   static const u_int32_t sizes[RETRY_PASSES] = RETRY_SIZES;
+   u_int32_t size = sizes[pass], count, i;
+   badmap_range *ranges = badmap_copy(vol->badRanges, BADMAP_SKIPPED, 
+         &count);
+   char *buf = (char*)malloc(size);
+   int fd = fileno(vol->device);
+   u_int64_t pos, end, stop, recovered = 0;
+   ssize_t n;
+   
+   for (i = 0; i < count; i++) {
+      end = ranges[i].offset + ranges[i].length;
+      
+      for (pos = ranges[i].offset; pos < end; pos = stop) {
+         stop = (pos / size + 1) * size;
+         stop = stop < end ? stop : end;
          
-         if (((HFSPlusExtentDescriptor*)(rec[i]))->blockCount > remainingBlocks) {
-            fprintf(stderr, "%s:%d something's wrong here: we expect %d blocks,"
-                  " the extent apparently contains %d blocks\n", 
-                  __FILE__, __LINE__, remainingBlocks, 
-                  ((HFSPlusExtentDescriptor*)(rec[i]))->blockCount);
-            free(buf);
-            return -1;
-         }
+         while ((n = watchdog_pread(vol->watchdog, fd, buf, stop - pos, 
+                     pos)) == -1 && errno == EINTR);
          
-         if (copyExtent(buf, (HFSPlusExtentDescriptor*)(rec[i]), dst, 
-                  isLastExtent, partialBlockSize) == -1) {
-            fprintf(stderr, "%s:%d copyExtent failed\n", __FILE__, __LINE__);
-            free(buf);
-            return -1;
+         if (n == (ssize_t)(stop - pos)) {
+            badmap_mark(vol->badRanges, pos, stop - pos, BADMAP_GOOD);
+            (*handler)(pos, buf, stop - pos, retVal);
+            recovered += stop - pos;
+         } else if (pass == RETRY_PASSES - 1 
+               && (n != -1 || errno != ETIMEDOUT)) {
+            /* a read that timed out may have been cut short by the 
+             * watchdog, it stays skipped for a later run
+             */
+            badmap_mark(vol->badRanges, pos, stop - pos, BADMAP_BAD);
          }
+      }
+   }
+   
+   free(buf);
+   free(ranges);
+   return recovered;
+}
 
-         remainingBlocks -=  rec[i]->blockCount;
+int 
+copyExtent(HFSPlusVolume *vol, char *const buf, 
+      const HFSPlusExtentDescriptor *const desc, writer *const dst, 
+      u_int64_t *const remaining, readaheadWindow *const ra) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t chunkBlocks = vol->dataBufSize / blockSize;
+   u_int32_t block = desc->startBlock;
+   u_int32_t count = desc->blockCount;
+   u_int64_t needed = (*remaining + blockSize - 1) / blockSize;
+   u_int64_t len;
+   u_int32_t n;
+   
+   /* blocks past the logical size are allocated but never read */
+   count = count < needed ? count : (u_int32_t)needed;
+      
+   while (count > 0) {
+      n = count < chunkBlocks ? count : chunkBlocks;
+      readAhead(vol, ra, (u_int64_t)n*blockSize);
+      
+      if (readBlocks(vol, block, n, buf) == -1) {
+         return -1;
+      }
+      
+      len = (u_int64_t)n*blockSize;
+      len = len < *remaining ? len : *remaining;
+         
+      if (writer_write(dst, buf, len) == -1) {
+         fprintf(stderr, "%s:%d unable to write file\n", __FILE__, __LINE__);
+         return -1;
       }
 
-      extents = extents->next;
+      /* image data is read exactly once, don't let it evict the catalog */
+      adviseRead(vol, (u_int64_t)block*blockSize + vol->volOffset, 
+            (u_int64_t)n*blockSize, ADVISE_DONTNEED);
+      *remaining -= len;
+      block += n;
+      count -= n;
+   }
+   
+   return 0;
+}
+
+int 
+copyFork(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const orderedlist *extList, writer *const dst) {
+   u_int64_t remaining = fork->logicalSize;
+   HFSPlusExtentDescriptor *exts;
+   readaheadWindow ra;
+   u_int32_t count, i;
+   
+   if ((exts = collectForkExtents(fork, extList, &count)) == NULL) {
+      return -1;
+   }
+   
+   memset(&ra, 0, sizeof(readaheadWindow));
+   ra.extents = exts;
+   ra.count = count;
+   ra.window = READ_CHUNK_SIZE;
+   
+   for (i = 0; i < count && remaining > 0; i++) {
+      if (copyExtent(vol, vol->dataBuf, &exts[i], dst, &remaining, &ra) == -1) {
+         fprintf(stderr, "%s:%d copyExtent failed\n", __FILE__, __LINE__);
+         free(exts);
+         return -1;
+      }
+   }
+   
+   free(exts);
+   
+   if (remaining > 0) {
+      fprintf(stderr, "%s:%d extents end %llu bytes before the logical size\n",
+            __FILE__, __LINE__, remaining);
+      return -1;
    }
    
-   free(buf);
    return 0;
 }
 
@@ -346,9 +1114,14 @@ setFinderInfo(const char *const fileName, const FndrFileInfo *const info) {
       perror("getattrlist");
       fprintf(stderr, "couldn't get attributes of: %s\n", fileName);
    } else {
-      memcpy(&attrBuf.finderInfo[0], &info->fdType, 4);
-      memcpy(&attrBuf.finderInfo[4], &info->fdCreator, 4);
-      memcpy(&attrBuf.finderInfo[8], &info->fdFlags, 2);
+      /* the record was converted to host byte order when it was read */
+      u_int32_t fdType = CFSwapInt32HostToBig(info->fdType);
+      u_int32_t fdCreator = CFSwapInt32HostToBig(info->fdCreator);
+      u_int16_t fdFlags = CFSwapInt16HostToBig(info->fdFlags);
+      
+      memcpy(&attrBuf.finderInfo[0], &fdType, 4);
+      memcpy(&attrBuf.finderInfo[4], &fdCreator, 4);
+      memcpy(&attrBuf.finderInfo[8], &fdFlags, 2);
       
       attrList->commonattr = ATTR_CMN_FNDRINFO;
       
@@ -362,123 +1135,465 @@ setFinderInfo(const char *const fileName, const FndrFileInfo *const info) {
    free(attrList);
 }
 
-void 
-sequentiallyReadCatalog(int(*filter)(HFSPlusCatalogKey*, sint16), 
-                   void(*handler)(HFSPlusCatalogKey*, sint16, void*)) {
-   u_int32_t blockSize = volume.volHeader.blockSize;
-   u_int32_t startBlock = volume.volHeader.catalogFile.extents[0].startBlock;
-   u_int32_t descOffset = blockSize * startBlock;
-
-   char *headerNode = (char*)malloc(142);
-   readNode(descOffset, headerNode, 142);
+/* reads node i of the window. the device is read through its own 
+ * descriptor with pread, so the workers don't share a file position.
+ */
+static void 
+nodeScanRead(nodeScan *scan, u_int32_t i) {
+   HFSPlusVolume *vol = scan->vol;
+   char *node = scan->buf + (size_t)i*scan->nodeSize;
+   u_int64_t offset;
+   ssize_t n, done = 0;
    
-   BTNodeDescriptor *desc = (BTNodeDescriptor*)&headerNode[0];
-   volume.catalogHeader = (BTHeaderRec*)&headerNode[14];
-   convertNodeDescriptorToHostByteOrder(desc);
-   convertHeaderRecordToHostByteOrder(volume.catalogHeader);
+   offset = calculateNodeOffset(vol, scan->fork, scan->nodeSize, 
+         scan->nodes[i]);
    
-   u_int32_t nodeBlockRatio = volume.catalogHeader->nodeSize / blockSize;
+   while (offset != (u_int64_t)-1 && done < scan->nodeSize) {
+      n = watchdog_pread(vol->watchdog, scan->fd, node + done, 
+            scan->nodeSize - done, vol->volOffset + offset + done);
+      
+      if (n == -1 && errno == EINTR) {
+         continue;
+      }
+      
+      if (n <= 0) {
+         break;
+      }
+      
+      done += n;
+   }
    
-   char *node = (char*)malloc(volume.catalogHeader->nodeSize);
-   BTNodeDescriptor *nodeDesc;
-   int i;
+   /* an unreadable node is passed on as an empty index node */
+   if (done == scan->nodeSize) {
+      journal_apply(vol->journal, vol->volOffset + offset, node, 
+            scan->nodeSize);
+   } else {
+      memset(node, 0, sizeof(BTNodeDescriptor));
+      
+      if (offset != (u_int64_t)-1) {
+         badmap_mark(vol->badRanges, vol->volOffset + offset + done, 
+               scan->nodeSize - done, BADMAP_SKIPPED);
+      }
+   }
+}
+
+/* the workers live as long as the scan and read the nodes of every window 
+ * handed to them, so their threads and watchdog readers are created once 
+ * per scan instead of once per window
+ */
+static void *
+nodeScanWorker(void *arg) {
+   nodeScan *scan = (nodeScan*)arg;
+   u_int32_t i;
+   
+   pthread_mutex_lock(&scan->lock);
    
-   for (i = 0; i < 8; i++) {
-      u_int32_t blockCount = volume.volHeader.catalogFile.extents[i].blockCount;
-      u_int32_t block = volume.volHeader.catalogFile.extents[i].startBlock;
+   for (;;) {
+      while (scan->next >= scan->count && !scan->closing) {
+         pthread_cond_wait(&scan->ready, &scan->lock);
+      }
+      
+      if (scan->next >= scan->count) {
+         break;
+      }
       
-      while (blockCount > 0) {
-         u_int64_t offset = (u_int64_t)block*blockSize + volume.volOffset;
+      i = scan->next++;
+      pthread_mutex_unlock(&scan->lock);
+      nodeScanRead(scan, i);
+      pthread_mutex_lock(&scan->lock);
+      
+      if (--scan->pending == 0) {
+         pthread_cond_signal(&scan->done);
+      }
+   }
+   
+   pthread_mutex_unlock(&scan->lock);
+   return NULL;
+}
+
+/* reads all used nodes of a b-tree, or all free ones, in windows of 
+ * SCAN_WINDOW_NODES nodes read by SCAN_THREADS threads, and passes the 
+ * leaf nodes to the handler in node order. vol->scanNode tells the 
+ * handler where its records come from. returns the number of nodes that 
+ * were not read.
+ */
+static u_int32_t 
+scanBTree(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const BTHeaderRec *const header, const u_int8_t *const nodeMap, 
+      int freeNodes, 
+      void(*handler)(char *node, BTNodeDescriptor *desc, void *retVal), 
+      void *retVal) {
+   pthread_t threads[SCAN_THREADS];
+   nodeScan scan;
+   BTNodeDescriptor *desc;
+   u_int32_t total, nodeNum = 0, skipped = 0, count, i;
+   int t, threadCount;
+   
+   memset(&scan, 0, sizeof(scan));
+   scan.vol = vol;
+   scan.fork = fork;
+   scan.nodeSize = header->nodeSize;
+   scan.fd = fileno(vol->device);
+   scan.nodes = (u_int32_t*)malloc(SCAN_WINDOW_NODES*sizeof(u_int32_t));
+   scan.buf = (char*)malloc((size_t)SCAN_WINDOW_NODES*scan.nodeSize);
+   pthread_mutex_init(&scan.lock, NULL);
+   pthread_cond_init(&scan.ready, NULL);
+   pthread_cond_init(&scan.done, NULL);
+   
+   /* nodes outside of the extents in the volume header can't be located */
+   total = (u_int64_t)fork->totalBlocks * vol->volHeader.blockSize 
+      / scan.nodeSize;
+   total = header->totalNodes < total ? header->totalNodes : total;
+   
+   for (threadCount = 0; threadCount < SCAN_THREADS; threadCount++) {
+      if (pthread_create(&threads[threadCount], NULL, &nodeScanWorker, 
+               &scan) != 0) {
+         perror("pthread_create");
+         break;
+      }
+   }
+   
+   while (nodeNum < total) {
+      /* the workers are idle until the window is handed to them */
+      for (count = 0; nodeNum < total && count < SCAN_WINDOW_NODES; 
+            nodeNum++) {
+         int inUse = isNodeInUse(nodeMap, nodeNum) != 0;
          
-         if (fsetpos(volume.device, (fpos_t*)&offset) == -1) {
-            perror("unable to seek");
-            exit(1);
+         if (freeNodes ? !inUse : inUse) {
+            scan.nodes[count++] = nodeNum;
+         } else {
+            skipped++;
          }
+      }
+      
+      if (threadCount == 0) {
+         for (i = 0; i < count; i++) {
+            nodeScanRead(&scan, i);
+         }
+      } else {
+         pthread_mutex_lock(&scan.lock);
+         scan.count = count;
+         scan.next = 0;
+         scan.pending = count;
+         pthread_cond_broadcast(&scan.ready);
          
-         if (fread(node, nodeBlockRatio*blockSize, 1, volume.device) != 1) {
-            perror("unable to read");
-            exit(1);
+         while (scan.pending > 0) {
+            pthread_cond_wait(&scan.done, &scan.lock);
          }
          
-         nodeDesc = (BTNodeDescriptor*)&node[0];
-         convertNodeDescriptorToHostByteOrder(nodeDesc);
+         pthread_mutex_unlock(&scan.lock);
+      }
+      
+      for (i = 0; i < count; i++) {
+         char *node = scan.buf + (size_t)i*scan.nodeSize;
+         desc = (BTNodeDescriptor*)node;
+         convertNodeDescriptorToHostByteOrder(desc);
          
-         if (nodeDesc->kind == kBTLeafNode) {
-            iterateOverCatalogRecords(node, nodeDesc, filter, handler);
+         if (desc->kind == kBTLeafNode) {
+            vol->scanNode = scan.nodes[i];
+            vol->scanNodeFree = freeNodes;
+            (*handler)(node, desc, retVal);
          }
-         
-         blockCount -= nodeBlockRatio;
-         block += nodeBlockRatio;
       }
    }
+   
+   pthread_mutex_lock(&scan.lock);
+   scan.closing = 1;
+   pthread_cond_broadcast(&scan.ready);
+   pthread_mutex_unlock(&scan.lock);
+   
+   for (t = 0; t < threadCount; t++) {
+      pthread_join(threads[t], NULL);
+   }
+   
+   pthread_cond_destroy(&scan.ready);
+   pthread_cond_destroy(&scan.done);
+   pthread_mutex_destroy(&scan.lock);
+   free(scan.nodes);
+   free(scan.buf);
+   return skipped;
 }
 
-void 
-readHeaderNode(u_int32_t offset, BTHeaderRec **header) {
-   char *headerNode = (char*)malloc(142);
-   readNode(offset, headerNode, 142);
+typedef struct {
+   int(*filter)(HFSPlusCatalogKey*, sint16);
+   void(*catalogHandler)(HFSPlusCatalogKey*, sint16, void*, void*);
+   void(*extentsHandler)(HFSPlusExtentKey*, HFSPlusExtentRecord*, void*);
+   void(*attributesHandler)(attributeKey*, void*, void*);
+   HFSPlusVolume *vol;
+   void *retVal;
+} recordScan;
+
+static void 
+scanCatalogNode(char *node, BTNodeDescriptor *desc, void *retVal) {
+   recordScan *rs = (recordScan*)retVal;
+   iterateOverCatalogRecords(rs->vol, node, desc, rs->filter, 
+         rs->catalogHandler, rs->retVal);
+}
+
+static void 
+scanExtentsNode(char *node, BTNodeDescriptor *desc, void *retVal) {
+   recordScan *rs = (recordScan*)retVal;
+   iterateOverExtentsRecords(rs->vol, node, desc, rs->extentsHandler, 
+         rs->retVal);
+}
+
+int 
+sequentiallyReadCatalog(HFSPlusVolume *vol, 
+      int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*handler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void *retVal) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t startBlock = vol->volHeader.catalogFile.extents[0].startBlock;
+   u_int32_t descOffset = blockSize * startBlock;
+   recordScan rs = { filter, handler, NULL, NULL, vol, retVal };
+   u_int8_t *nodeMap;
+   u_int32_t skipped;
+   
+   if (readHeaderNode(vol, descOffset, &vol->catalogHeader) == -1) {
+      fprintf(stderr, "unable to read the catalog header node, its nodes "
+            "can still be carved with -C\n");
+      return -1;
+   }
+   
+   if ((nodeMap = readNodeMap(vol, &vol->volHeader.catalogFile, 
+               vol->catalogHeader)) == NULL) {
+      fprintf(stderr, "unable to read the catalog node map, scanning all "
+            "nodes\n");
+   }
+   
+   /* the used nodes first, so their records are seen before any stale 
+    * copies. free nodes are only read in deep recovery.
+    */
+   skipped = scanBTree(vol, &vol->volHeader.catalogFile, vol->catalogHeader, 
+         nodeMap, 0, &scanCatalogNode, &rs);
    
-   BTNodeDescriptor *desc = (BTNodeDescriptor*)&headerNode[0];
-   *header = (BTHeaderRec*)&headerNode[14];
-   convertNodeDescriptorToHostByteOrder(desc);
+   if (nodeMap != NULL && (vol->options.scanFlags & SCAN_FREE_NODES)) {
+      printf("scanning %u free catalog nodes\n", skipped);
+      scanBTree(vol, &vol->volHeader.catalogFile, vol->catalogHeader, 
+            nodeMap, 1, &scanCatalogNode, &rs);
+   } else if (nodeMap != NULL) {
+      printf("skipped %u free catalog nodes\n", skipped);
+   }
+   
+   free(nodeMap);
+   return 0;
+}
+
+/* reads the header record of a b-tree into a copy of its own, replacing 
+ * the previous one. returns -1 if the header node couldn't be read.
+ */
+int 
+readHeaderNode(HFSPlusVolume *vol, u_int32_t offset, BTHeaderRec **header) {
+   char headerNode[142];
+   
+   if (readNode(vol, offset, headerNode, 142) == -1) {
+      return -1;
+   }
+   
+   convertNodeDescriptorToHostByteOrder((BTNodeDescriptor*)headerNode);
+   free(*header);
+   *header = (BTHeaderRec*)malloc(sizeof(BTHeaderRec));
+   memcpy(*header, &headerNode[14], sizeof(BTHeaderRec));
    convertHeaderRecordToHostByteOrder(*header);
+   return 0;
 }
 
-void 
-sequentiallyReadExtents(
-      void(*handler)(HFSPlusExtentKey*, HFSPlusExtentRecord*)) {
-   u_int32_t blockSize = volume.volHeader.blockSize;
-   u_int32_t startBlock = volume.volHeader.extentsFile.extents[0].startBlock;
+int 
+sequentiallyReadExtents(HFSPlusVolume *vol, 
+      void(*handler)(HFSPlusExtentKey*, HFSPlusExtentRecord*, void *retVal), 
+      void *retVal) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t startBlock = vol->volHeader.extentsFile.extents[0].startBlock;
    u_int32_t descOffset = blockSize * startBlock;
+   recordScan rs = { NULL, NULL, handler, NULL, vol, retVal };
+   u_int8_t *nodeMap;
+   u_int32_t skipped;
 
-   readHeaderNode(descOffset, &volume.extentsHeader);
+   if (readHeaderNode(vol, descOffset, &vol->extentsHeader) == -1) {
+      fprintf(stderr, "unable to read the extents header node, its nodes "
+            "can still be carved with -C\n");
+      return -1;
+   }
    
-   u_int32_t nodeBlockRatio = volume.extentsHeader->nodeSize / blockSize;
+   if ((nodeMap = readNodeMap(vol, &vol->volHeader.extentsFile, 
+               vol->extentsHeader)) == NULL) {
+      fprintf(stderr, "unable to read the extents node map, scanning all "
+            "nodes\n");
+   }
    
-   char *node = (char*)malloc(volume.extentsHeader->nodeSize);
-   BTNodeDescriptor *nodeDesc;
-   int i;
+   skipped = scanBTree(vol, &vol->volHeader.extentsFile, vol->extentsHeader, 
+         nodeMap, 0, &scanExtentsNode, &rs);
    
-   for (i = 0; i < 8; i++) {
-      u_int32_t blockCount = volume.volHeader.extentsFile.extents[i].blockCount;
-      u_int32_t block = volume.volHeader.extentsFile.extents[i].startBlock;
-      
-      while (blockCount > 0) {
-         u_int64_t offset = (u_int64_t)block*blockSize + volume.volOffset;
-         
-         if (fsetpos(volume.device, (fpos_t*)&offset) == -1) {
-            perror("unable to seek");
-            exit(1);
-         }
-         
-         if (fread(node, nodeBlockRatio*blockSize, 1, volume.device) != 1) {
-            perror("unable to read");
-            exit(1);
-         }
-         
-         nodeDesc = (BTNodeDescriptor*)&node[0];
-         convertNodeDescriptorToHostByteOrder(nodeDesc);
-         
-         if (nodeDesc->kind == kBTLeafNode) {
-            iterateOverExtentsRecords(node, nodeDesc, handler);
-         }
-         
-         blockCount -= nodeBlockRatio;
-         block += nodeBlockRatio;
+   if (nodeMap != NULL && (vol->options.scanFlags & SCAN_FREE_NODES)) {
+      printf("scanning %u free extents nodes\n", skipped);
+      scanBTree(vol, &vol->volHeader.extentsFile, vol->extentsHeader, 
+            nodeMap, 1, &scanExtentsNode, &rs);
+   } else if (nodeMap != NULL) {
+      printf("skipped %u free extents nodes\n", skipped);
+   }
+   
+   free(nodeMap);
+   return 0;
+}
+
+static void 
+scanAttributesNode(char *node, BTNodeDescriptor *desc, void *retVal) {
+   recordScan *rs = (recordScan*)retVal;
+   iterateOverAttributeRecords(rs->vol, node, desc, rs->attributesHandler, 
+         rs->retVal);
+}
+
+/* unlike the catalog, a volume is usable without its attributes, so a 
+ * missing or unreadable attributes file only returns -1.
+ */
+int 
+sequentiallyReadAttributes(HFSPlusVolume *vol, 
+      void(*handler)(attributeKey*, void*, void *retVal), void *retVal) {
+   const HFSPlusForkData *fork = &vol->volHeader.attributesFile;
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   recordScan rs = { NULL, NULL, NULL, handler, vol, retVal };
+   u_int8_t *nodeMap;
+   u_int32_t skipped;
+   
+   if (fork->totalBlocks == 0 || fork->extents[0].blockCount == 0) {
+      return -1;
+   }
+   
+   if (readHeaderNode(vol, (u_int64_t)blockSize * fork->extents[0].startBlock,
+            &vol->attributesHeader) == -1) {
+      fprintf(stderr, "unable to read the attributes header node\n");
+      return -1;
+   }
+   
+   if (vol->attributesHeader->nodeSize < 512 
+         || (vol->attributesHeader->nodeSize 
+            & (vol->attributesHeader->nodeSize - 1)) != 0) {
+      fprintf(stderr, "invalid node size in attributes header: %d\n", 
+            vol->attributesHeader->nodeSize);
+      return -1;
+   }
+   
+   if ((nodeMap = readNodeMap(vol, fork, vol->attributesHeader)) == NULL) {
+      fprintf(stderr, "unable to read the attributes node map, scanning all "
+            "nodes\n");
+   }
+   
+   skipped = scanBTree(vol, fork, vol->attributesHeader, nodeMap, 0, 
+         &scanAttributesNode, &rs);
+   
+   if (nodeMap != NULL) {
+      printf("skipped %u free attributes nodes\n", skipped);
+   }
+   
+   free(nodeMap);
+   return 0;
+}
+
+
+/* a b-tree header for carved nodes, whose real header may be lost */
+static BTHeaderRec *
+carvedHeader(u_int32_t nodeSize, u_int16_t maxKeyLength) {
+   BTHeaderRec *header = (BTHeaderRec*)calloc(1, sizeof(BTHeaderRec));
+   header->nodeSize = nodeSize;
+   header->maxKeyLength = maxKeyLength;
+   return header;
+}
+
+/* passes the carved leaf nodes of one type to the handler. nodes of 
+ * another size than the b-tree's are skipped, their size was misjudged 
+ * or they belong to another volume. returns the number of nodes passed.
+ */
+static u_int64_t 
+carvedNodes(HFSPlusVolume *vol, const carve_result *const r, u_int32_t type, 
+      u_int32_t nodeSize, 
+      void(*handler)(char *node, BTNodeDescriptor *desc, void *retVal), 
+      void *retVal) {
+   char *node = (char*)malloc(nodeSize);
+   int fd = fileno(vol->device);
+   BTNodeDescriptor *desc;
+   u_int64_t i, found = 0;
+   
+   for (i = 0; i < r->count; i++) {
+      if (r->nodes[i].type != type || r->nodes[i].nodeSize != nodeSize 
+            || watchdog_pread(vol->watchdog, fd, node, nodeSize, 
+               r->nodes[i].offset) != (ssize_t)nodeSize) {
+         continue;
       }
+      
+      desc = (BTNodeDescriptor*)node;
+      convertNodeDescriptorToHostByteOrder(desc);
+      vol->scanNode = (r->nodes[i].offset - vol->volOffset) / nodeSize;
+      vol->scanNodeFree = 0;
+      (*handler)(node, desc, retVal);
+      found++;
    }
    
+   free(node);
+   return found;
+}
+
+/* finds catalog and extents leaf nodes anywhere on the volume, without 
+ * relying on the volume header or the b-tree headers, and parses them. 
+ * nodes are parsed in the order they are found on the device.
+ */
+int 
+carveBTrees(HFSPlusVolume *vol, int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*catalogHandler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void(*extentsHandler)(HFSPlusExtentKey*, HFSPlusExtentRecord*, 
+         void *retVal), 
+      void *retVal) {
+   u_int64_t start = vol->volOffset;
+   u_int64_t end = start + (u_int64_t)vol->volHeader.totalBlocks 
+      * vol->volHeader.blockSize;
+   recordScan rs = { filter, catalogHandler, extentsHandler, NULL, vol, 
+      retVal };
+   carve_result *r;
+   u_int32_t catalogNodeSize, extentsNodeSize;
+   u_int64_t found;
+   
+   r = carve_scan(vol->watchdog, fileno(vol->device), start, end);
+   catalogNodeSize = carve_nodeSize(r, CARVE_CATALOG);
+   extentsNodeSize = carve_nodeSize(r, CARVE_EXTENTS);
+   printf("carved %llu leaf nodes\n", (unsigned long long)r->count);
+   
+   if (catalogNodeSize == 0) {
+      fprintf(stderr, "no catalog leaf nodes found\n");
+      carve_destroy(r);
+      return -1;
+   }
+   
+   /* the extents b-tree is empty on most volumes */
+   extentsNodeSize = extentsNodeSize == 0 ? catalogNodeSize : extentsNodeSize;
+   free(vol->catalogHeader);
+   free(vol->extentsHeader);
+   vol->catalogHeader = carvedHeader(catalogNodeSize, 
+         kHFSPlusCatalogKeyMaximumLength);
+   vol->extentsHeader = carvedHeader(extentsNodeSize, 
+         kHFSPlusExtentKeyMaximumLength);
+   
+   found = carvedNodes(vol, r, CARVE_CATALOG, catalogNodeSize, 
+         &scanCatalogNode, &rs);
+   printf("parsed %llu catalog nodes of %u bytes\n", 
+         (unsigned long long)found, catalogNodeSize);
+   found = carvedNodes(vol, r, CARVE_EXTENTS, extentsNodeSize, 
+         &scanExtentsNode, &rs);
+   printf("parsed %llu extents nodes of %u bytes\n", 
+         (unsigned long long)found, extentsNodeSize);
+   
+   carve_destroy(r);
+   return 0;
 }
 
 
 #pragma mark === iterators ===
 
 void 
-iterateOverCatalogRecords(char *node, BTNodeDescriptor *desc, 
-      int(*filter)(HFSPlusCatalogKey*, sint16), 
-      void(*handler)(HFSPlusCatalogKey*, sint16, void*) ) {
+iterateOverCatalogRecords(HFSPlusVolume *vol, char *node, 
+      BTNodeDescriptor *desc, int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*handler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void *retVal) {
    int i = 0;
-   int firstOffset = volume.catalogHeader->nodeSize-2;
+   int firstOffset = vol->catalogHeader->nodeSize-2;
    
    for (i = 0; i < desc->numRecords; i++) {
       u_int16_t keyOffset = CFSwapInt16BigToHost(*(u_int16_t*)(node+firstOffset));
@@ -494,7 +1609,7 @@ iterateOverCatalogRecords(char *node, BTNodeDescriptor *desc,
       key.parentID = CFSwapInt32BigToHost(*(u_int32_t*)(node+keyOffset+2));
       key.nodeName.length = CFSwapInt16BigToHost(*(u_int16_t*)(node+keyOffset+6));
       
-      if (key.keyLength > volume.catalogHeader->maxKeyLength) {
+      if (key.keyLength > vol->catalogHeader->maxKeyLength) {
          fprintf(stderr, "invalid key length in catalog record: %d\n", 
                key.keyLength);
          continue;
@@ -538,7 +1653,7 @@ iterateOverCatalogRecords(char *node, BTNodeDescriptor *desc,
             default:
                fprintf(stderr, "unknown record type\n");
          }
-         (*handler)(&key, recType, record);
+         (*handler)(&key, recType, record, retVal);
       }
       
       firstOffset-=2;
@@ -546,42 +1661,44 @@ iterateOverCatalogRecords(char *node, BTNodeDescriptor *desc,
 }
 
 void 
-iterateOverCatalog(int(*filter)(HFSPlusCatalogKey*, sint16), 
-      void(*handler)(HFSPlusCatalogKey*, sint16, void*)) {
-   u_int32_t blockSize = volume.volHeader.blockSize;
-   u_int32_t startBlock = volume.volHeader.catalogFile.extents[0].startBlock;
+iterateOverCatalog(HFSPlusVolume *vol, 
+      int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*handler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void *retVal) {
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int32_t startBlock = vol->volHeader.catalogFile.extents[0].startBlock;
    u_int32_t descOffset = blockSize * startBlock;
 
-   char *headerNode = (char*)malloc(142);
-   readNode(descOffset, headerNode, 142);
+   BTNodeDescriptor *desc;
    
-   BTNodeDescriptor *desc = (BTNodeDescriptor*)&headerNode[0];
-   volume.catalogHeader = (BTHeaderRec*)&headerNode[14];
-   convertNodeDescriptorToHostByteOrder(desc);
-   convertHeaderRecordToHostByteOrder(volume.catalogHeader);
+   if (readHeaderNode(vol, descOffset, &vol->catalogHeader) == -1) {
+      fprintf(stderr, "unable to read the catalog header node\n");
+      return;
+   }
    
-   char *node = (char*)malloc(volume.catalogHeader->nodeSize);
+   char *node = (char*)malloc(vol->catalogHeader->nodeSize);
    
-   u_int32_t nextLeafNode = volume.catalogHeader->firstLeafNode;
+   u_int32_t nextLeafNode = vol->catalogHeader->firstLeafNode;
    
    while (nextLeafNode) {
-      readCatalogNode(nextLeafNode, node);
+      readCatalogNode(vol, nextLeafNode, node);
       desc = (BTNodeDescriptor*)&node[0];
       convertNodeDescriptorToHostByteOrder(desc);
-      iterateOverCatalogRecords(node, desc, filter, handler);
+      iterateOverCatalogRecords(vol, node, desc, filter, handler, retVal);
       nextLeafNode = desc->fLink;
    }
    
-   free(headerNode);
    free(node);
 }
 
 
 void 
-iterateOverExtentsRecords(char *node, BTNodeDescriptor *desc, 
-      void(*handler)(HFSPlusExtentKey*, HFSPlusExtentRecord*)) {
+iterateOverExtentsRecords(HFSPlusVolume *vol, char *node, 
+      BTNodeDescriptor *desc, 
+      void(*handler)(HFSPlusExtentKey*, HFSPlusExtentRecord*, void *retVal), 
+      void *retVal) {
    int i = 0;
-   int firstOffset = volume.extentsHeader->nodeSize-2;
+   int firstOffset = vol->extentsHeader->nodeSize-2;
    
    for (i = 0; i < desc->numRecords; i++) {
       u_int16_t keyOffset = 
@@ -606,9 +1723,98 @@ iterateOverExtentsRecords(char *node, BTNodeDescriptor *desc,
          u_int16_t recOffset = keyOffset+key.keyLength+2;
          HFSPlusExtentRecord *record = (HFSPlusExtentRecord*)(node+recOffset);
          convertHFSPlusExtentRecordToHostByteOrder(record);
-         (*handler)(&key, record);
+         (*handler)(&key, record, retVal);
       }
       
       firstOffset -= 2;
    }
 }
+
+/* passes the records of an attributes leaf node to the handler, converted 
+ * to host byte order.
+ */
+void 
+iterateOverAttributeRecords(HFSPlusVolume *vol, char *node, 
+      BTNodeDescriptor *desc, 
+      void(*handler)(attributeKey*, void*, void *retVal), void *retVal) {
+   u_int32_t nodeSize = vol->attributesHeader->nodeSize;
+   int firstOffset = nodeSize-2;
+   int i;
+   
+   for (i = 0; i < desc->numRecords; i++) {
+      u_int16_t keyOffset = 
+         CFSwapInt16BigToHost(*(u_int16_t*)(node+firstOffset));
+      u_int16_t endOffset = 
+         CFSwapInt16BigToHost(*(u_int16_t*)(node+firstOffset-2));
+      
+      if (i == 0 && keyOffset != FIRST_KEY_OFFSET) {
+         fprintf(stderr, "invalid offset to first record in attributes "
+               "node: expected 14, found %d\n", keyOffset);
+         return;
+      }
+      
+      firstOffset -= 2;
+      
+      if (endOffset > nodeSize || keyOffset + 14 > endOffset) {
+         fprintf(stderr, "invalid record offsets in attributes node: %d, "
+               "%d\n", keyOffset, endOffset);
+         continue;
+      }
+      
+      attributeKey key;
+      key.keyLength = CFSwapInt16BigToHost(*(u_int16_t*)(node+keyOffset));
+      key.fileID = CFSwapInt32BigToHost(*(u_int32_t*)(node+keyOffset+4));
+      key.startBlock = CFSwapInt32BigToHost(*(u_int32_t*)(node+keyOffset+8));
+      key.name.length = CFSwapInt16BigToHost(*(u_int16_t*)(node+keyOffset+12));
+      
+      if (key.name.length > 127 || key.name.length * 2 + 12 != key.keyLength
+            || keyOffset + key.keyLength + 2 + 4 > endOffset) {
+         fprintf(stderr, "invalid key in attributes record of file: %d\n", 
+               key.fileID);
+         continue;
+      }
+      
+      memcpy(key.name.unicode, node+keyOffset+14, key.name.length*2);
+      u_int16_t recOffset = keyOffset+key.keyLength+2;
+      void *record = node+recOffset;
+      
+      switch (CFSwapInt32BigToHost(*(u_int32_t*)record)) {
+         case ATTR_INLINE_DATA:
+            if (recOffset + 16 > endOffset) {
+               continue;
+            }
+            
+            convertAttributeDataToHostByteOrder((attributeData*)record);
+            
+            if (((attributeData*)record)->size > endOffset - recOffset - 16) {
+               fprintf(stderr, "invalid size of inline attribute of file: "
+                     "%d\n", key.fileID);
+               continue;
+            }
+            break;
+         case ATTR_FORK_DATA:
+            if (recOffset + sizeof(attributeForkData) > endOffset) {
+               continue;
+            }
+            
+            ((attributeForkData*)record)->recordType = ATTR_FORK_DATA;
+            convertFileToHostByteOrder(&((attributeForkData*)record)->fork);
+            break;
+         case ATTR_EXTENTS:
+            if (recOffset + sizeof(attributeExtents) > endOffset) {
+               continue;
+            }
+            
+            ((attributeExtents*)record)->recordType = ATTR_EXTENTS;
+            convertHFSPlusExtentRecordToHostByteOrder(
+                  &((attributeExtents*)record)->extents);
+            break;
+         default:
+            fprintf(stderr, "unknown attribute record type of file: %d\n", 
+                  key.fileID);
+            continue;
+      }
+      
+      (*handler)(&key, record, retVal);
+   }
+}
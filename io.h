@@ -31,21 +31,115 @@
 
 #include <CoreServices/CoreServices.h>
 #include <sys/attr.h>
+#include <pthread.h>
 #include "definitions.h"
+#include "writer.h"
+#include "bitmap.h"
+#include "badmap.h"
+#include "journal.h"
+#include "sink.h"
+#include "digest.h"
+#include "watchdog.h"
+
+#ifndef __IO_H_
+#define __IO_H_
 
 #define VOL_HEADER_OFFSET 1024L
 #define RSRC_FORK_NAME "/..namedfork/rsrc"
 #define RSRC_FORK_NAME_LEN 17
 #define FIRST_KEY_OFFSET 14
 
+#define READ_DIRECT 0x01
+/* don't lay the blocks of the journal over the metadata read */
+#define READ_NO_JOURNAL 0x02
+
+#define PROTECTED_ATTR_PREFIX "com.apple.system."
+#define PROTECTED_ATTR_PREFIX_LEN 17
+/* values of attributes stored in forks larger than this are not read */
+#define ATTR_MAX_FORK_SIZE (64*1024*1024)
+
+/* also parse b-tree nodes marked as free in the node map */
+#define SCAN_FREE_NODES 0x01
+/* find leaf nodes by scanning the whole device instead of the b-trees */
+#define SCAN_CARVE 0x02
+#define DEFAULT_CARVE_BLOCK_SIZE 4096
+#define SCAN_WINDOW_NODES 1024
+#define SCAN_THREADS 8
+#define READ_CHUNK_SIZE (4*1024*1024)
+#define READ_ALIGNMENT 4096
+#define READAHEAD_MAX (64*1024*1024)
+
+/* bad ranges are retried in pieces of these sizes, one pass each */
+#define RETRY_PASSES 3
+#define RETRY_SIZES { 64*1024, 4096, 512 }
+
+#define ADVISE_WILLNEED 0
+#define ADVISE_DONTNEED 1
+
 typedef struct {
+    int writerFlags;
+    int readFlags;
+    u_int32_t scanFlags;
+    u_int32_t carveBlockSize;
+    u_int32_t retryPasses;
+    u_int64_t smallFileSize;
+    u_int32_t readTimeout;      /* in milliseconds, 0 for none */
+} HFSPlusRecoveryOptions;
+
+/* everything known about one open volume. all reads go through it, so 
+ * several volumes can be recovered at the same time.
+ */
+typedef struct _HFSPlusVolume {
+    HFSPlusRecoveryOptions options;
     u_int64_t volOffset;
     FILE *device;
     HFSPlusVolumeHeader volHeader;
     BTHeaderRec *catalogHeader;
     BTHeaderRec *extentsHeader;
+    BTHeaderRec *attributesHeader;
+    int dataFd;
+    int directReads;
+    char *dataBuf;
+    u_int32_t dataBufSize;
+    char *cacheBuf;
+    u_int32_t cacheStart;
+    u_int32_t cacheCount;
+    bitmap *allocation;
+    u_int32_t scanNode;
+    int scanNodeFree;
+    badmap *badRanges;
+    u_int64_t holeBytes;
+    journal *journal;
+    sink *output;
+    digest_list *digests;
+    watchdog *watchdog;
 } HFSPlusVolume;
 
+typedef struct {
+    const HFSPlusExtentDescriptor *extents;
+    u_int32_t count;
+    u_int32_t ext;
+    u_int32_t block;
+    u_int64_t pending;
+    u_int64_t window;
+} readaheadWindow;
+
+typedef struct {
+    HFSPlusVolume *vol;
+    const HFSPlusForkData *fork;
+    u_int32_t nodeSize;
+    int fd;
+    u_int32_t *nodes;
+    u_int32_t count;
+    u_int32_t next;
+    u_int32_t pending;          /* nodes of the window not read yet */
+    int closing;
+    char *buf;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       /* a window was handed out or closing */
+    pthread_cond_t done;        /* the last node of the window was read */
+} nodeScan;
+
 typedef struct {
     unsigned long length;
     fsobj_type_t objType;
@@ -55,56 +149,149 @@ typedef struct {
 typedef struct attrlist attrlist_t;
 
 u_int64_t 
-calculateCatalogOffset(const u_int32_t nodeNum);
+calculateNodeOffset(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      u_int32_t nodeSize, const u_int32_t nodeNum);
+
+u_int64_t 
+calculateCatalogOffset(HFSPlusVolume *vol, const u_int32_t nodeNum);
+
+u_int8_t *
+readNodeMap(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const BTHeaderRec *const header);
+
+HFSPlusVolume *
+openVolume(const char *const dev, u_int64_t volOffset, 
+      const HFSPlusRecoveryOptions *const options, badmap *badRanges);
 
 void 
-openVolume(const char *const dev, u_int64_t volOffset);
+closeVolume(HFSPlusVolume *vol);
+
+int 
+readVolumeHeader(HFSPlusVolume *vol, u_int64_t offset);
 
 void 
-readVolumeHeader();
+readNodeDescriptor(HFSPlusVolume *vol, const u_int32_t offset, 
+      BTNodeDescriptor *const desc);
 
 void 
-readNodeDescriptor(const u_int32_t offset, BTNodeDescriptor *const desc);
+readHeaderRecord(HFSPlusVolume *vol, const u_int32_t offset, 
+      BTHeaderRec *const headerRec);
+
+int 
+readHeaderNode(HFSPlusVolume *vol, u_int32_t offset, BTHeaderRec **header);
+
+int 
+readNode(HFSPlusVolume *vol, const u_int64_t offset, char *const node, 
+      u_int32_t nodeSize);
 
 void 
-readHeaderRecord(const u_int32_t offset, BTHeaderRec *const headerRec);
+readCatalogNode(HFSPlusVolume *vol, const u_int32_t nodeNum, 
+      char *const node);
+
+int 
+isRestorableAttribute(const attribute *const attr);
 
 void 
-readHeaderNode(u_int32_t offset, BTHeaderRec **header);
+restoreAttributes(const file *const f, int fd, const char *const dstFileName);
+
+int 
+copyFile(HFSPlusVolume *vol, const file *const f, 
+      const char *const dstFileName);
+
+HFSPlusExtentDescriptor *
+collectForkExtents(const HFSPlusForkData *const fork, 
+      const orderedlist *const extList, u_int32_t *const count);
+
+int 
+countForkExtents(const HFSPlusForkData *const fork, 
+      const orderedlist *const extList);
 
 void 
-readNode(const u_int64_t offset, char *const node, u_int32_t nodeSize);
+adviseRead(HFSPlusVolume *vol, u_int64_t offset, u_int64_t len, int advice);
 
 void 
-readCatalogNode(const u_int32_t nodeNum, char *const node);
+readAhead(HFSPlusVolume *vol, readaheadWindow *const ra, u_int64_t consumed);
+
+int 
+cacheBlocks(HFSPlusVolume *vol, u_int32_t startBlock, u_int32_t count);
 
 void 
-copyFile(const file *const f, const char *const dstFileName);
+dropBlockCache(HFSPlusVolume *vol);
 
 int 
-copyFork(const HFSPlusForkData *const fork, const orderedlist *const extents, 
-      FILE *const dst);
+readBlocks(HFSPlusVolume *vol, u_int32_t startBlock, u_int32_t count, 
+      char *const buf);
+
+char *
+readForkData(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const orderedlist *const extList);
 
 int 
-copyExtent(char *const buf, const HFSPlusExtentDescriptor *const desc, 
-      FILE *const dst, int isLastExtent, u_int64_t partialBlockSize);
+readForkBlocks(HFSPlusVolume *vol, 
+      const HFSPlusExtentDescriptor *const extents, u_int32_t extCount, 
+      u_int32_t firstBlock, u_int32_t count, char *const buf);
+
+u_int64_t 
+retryBadRanges(HFSPlusVolume *vol, u_int32_t pass, 
+      void(*handler)(u_int64_t offset, const char *data, u_int32_t len, 
+         void *retVal), 
+      void *retVal);
+
+int 
+copyFork(HFSPlusVolume *vol, const HFSPlusForkData *const fork, 
+      const orderedlist *const extents, writer *const dst);
+
+int 
+copyExtent(HFSPlusVolume *vol, char *const buf, 
+      const HFSPlusExtentDescriptor *const desc, writer *const dst, 
+      u_int64_t *const remaining, readaheadWindow *const ra);
 
 void 
 setFinderInfo(const char *const fileName, const FndrFileInfo *const info);
 
-void 
-sequentiallyReadCatalog(int(*filter)(HFSPlusCatalogKey*, sint16), 
-      void(*handler)(HFSPlusCatalogKey*, sint16, void*));
+int 
+sequentiallyReadCatalog(HFSPlusVolume *vol, 
+      int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*handler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void *retVal);
+
+int 
+sequentiallyReadExtents(HFSPlusVolume *vol, 
+      void(*handler)(HFSPlusExtentKey*, HFSPlusExtentRecord*, void *retVal), 
+      void *retVal);
+
+int 
+sequentiallyReadAttributes(HFSPlusVolume *vol, 
+      void(*handler)(attributeKey*, void*, void *retVal), void *retVal);
+
+int 
+carveBTrees(HFSPlusVolume *vol, int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*catalogHandler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void(*extentsHandler)(HFSPlusExtentKey*, HFSPlusExtentRecord*, 
+         void *retVal), 
+      void *retVal);
 
 void 
-iterateOverCatalogRecords(char *node, BTNodeDescriptor *desc, 
-      int(*filter)(HFSPlusCatalogKey*, sint16), 
-      void(*handler)(HFSPlusCatalogKey*, sint16, void*) );
+iterateOverCatalogRecords(HFSPlusVolume *vol, char *node, 
+      BTNodeDescriptor *desc, int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*handler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void *retVal);
     
 void 
-iterateOverCatalog( int(*filter)(HFSPlusCatalogKey*, sint16), 
-      void(*handler)(HFSPlusCatalogKey*, sint16, void*) );
+iterateOverCatalog(HFSPlusVolume *vol, 
+      int(*filter)(HFSPlusCatalogKey*, sint16), 
+      void(*handler)(HFSPlusCatalogKey*, sint16, void*, void *retVal), 
+      void *retVal);
     
 void 
-iterateOverExtentsRecords(char *node, BTNodeDescriptor *desc, 
-      void(*handler)(HFSPlusExtentKey*, HFSPlusExtentRecord*));
+iterateOverExtentsRecords(HFSPlusVolume *vol, char *node, 
+      BTNodeDescriptor *desc, 
+      void(*handler)(HFSPlusExtentKey*, HFSPlusExtentRecord*, void *retVal), 
+      void *retVal);
+
+void 
+iterateOverAttributeRecords(HFSPlusVolume *vol, char *node, 
+      BTNodeDescriptor *desc, 
+      void(*handler)(attributeKey*, void*, void *retVal), void *retVal);
+
+#endif
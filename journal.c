@@ -0,0 +1,376 @@
+/*
+ *  journal.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "journal.h"
+#include "watchdog.h"
+
+/* the journal is written in the byte order of the machine that mounted the
+ * volume, the info block in big endian
+ */
+static u_int16_t 
+journal_u16(const journal *const j, const char *const p) {
+   u_int16_t v = *(u_int16_t*)p;
+   return j->swap ? CFSwapInt16(v) : v;
+}
+
+static u_int32_t 
+journal_u32(const journal *const j, const char *const p) {
+   u_int32_t v = *(u_int32_t*)p;
+   return j->swap ? CFSwapInt32(v) : v;
+}
+
+static u_int64_t 
+journal_u64(const journal *const j, const char *const p) {
+   u_int64_t v = *(u_int64_t*)p;
+   return j->swap ? CFSwapInt64(v) : v;
+}
+
+static int 
+journal_checksum(const char *p, int len) {
+   int i, sum = 0;
+   
+   for (i = 0; i < len; i++, p++) {
+      sum = (sum << 8) ^ (sum + *(unsigned char*)p);
+   }
+   
+   return ~sum;
+}
+
+static int 
+journal_pread(watchdog *wd, int fd, char *const buf, size_t len, 
+      u_int64_t offset) {
+   size_t done = 0;
+   ssize_t n;
+   
+   while (done < len) {
+      if ((n = watchdog_pread(wd, fd, buf + done, len - done, 
+                  offset + done)) == -1 && errno == EINTR) {
+         continue;
+      }
+      
+      if (n <= 0) {
+         return -1;
+      }
+      
+      done += n;
+   }
+   
+   return 0;
+}
+
+/* reads from the circular buffer after the journal header */
+static int 
+journal_read(const journal *const j, u_int64_t pos, char *buf, u_int64_t len) {
+   u_int64_t n;
+   
+   while (len > 0) {
+      n = j->length - pos < len ? j->length - pos : len;
+      
+      if (journal_pread(j->watchdog, j->fd, buf, n, j->start + pos) == -1) {
+         return -1;
+      }
+      
+      buf += n;
+      len -= n;
+      pos = j->headerSize;
+   }
+   
+   return 0;
+}
+
+static u_int64_t 
+journal_advance(const journal *const j, u_int64_t pos, u_int64_t n) {
+   pos += n;
+   
+   while (pos >= j->length) {
+      pos -= j->length - j->headerSize;
+   }
+   
+   return pos;
+}
+
+static void 
+journal_add(journal *j, u_int64_t offset, u_int32_t length, char *data) {
+   if (j->count == j->size) {
+      j->size = j->size == 0 ? 256 : j->size*2;
+      
+      if ((j->blocks = (journal_block*)realloc(j->blocks, 
+                  j->size*sizeof(journal_block))) == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   j->blocks[j->count].offset = offset;
+   j->blocks[j->count].length = length;
+   j->blocks[j->count].seq = j->count;
+   j->blocks[j->count].data = data;
+   j->count++;
+   j->maxLength = length > j->maxLength ? length : j->maxLength;
+}
+
+static int 
+journal_blockComparator(const void *b1, const void *b2) {
+   const journal_block *a = (const journal_block*)b1;
+   const journal_block *b = (const journal_block*)b2;
+   
+   if (a->offset != b->offset) {
+      return a->offset < b->offset ? -1 : 1;
+   }
+   
+   return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/* sorts the blocks and keeps only the newest copy of each */
+static void 
+journal_sort(journal *j) {
+   u_int32_t i, n = 0;
+   
+   qsort(j->blocks, j->count, sizeof(journal_block), &journal_blockComparator);
+   
+   for (i = 0; i < j->count; i++) {
+      if (i + 1 < j->count && j->blocks[i+1].offset == j->blocks[i].offset 
+            && j->blocks[i+1].length == j->blocks[i].length) {
+         free(j->blocks[i].data);
+         continue;
+      }
+      
+      j->blocks[n++] = j->blocks[i];
+   }
+   
+   j->count = n;
+}
+
+/* reads the block lists from the start to the end of the journal. a block 
+ * list with a bad checksum ends the replay, like it does for the kernel.
+ */
+static void 
+journal_replay(journal *j, u_int64_t volOffset, u_int64_t pos, u_int64_t end,
+      u_int32_t blhdrSize) {
+   char *blhdr = (char*)malloc(blhdrSize);
+   char sumBuf[JOURNAL_BLHDR_CHECKSUM_SIZE];
+   u_int32_t numBlocks, bytesUsed, checksum, size, i;
+   u_int64_t bnum, dataPos;
+   char *data;
+   
+   while (pos != end) {
+      if (journal_read(j, pos, blhdr, blhdrSize) == -1) {
+         fprintf(stderr, "unable to read journal block list at %llu\n", 
+               (unsigned long long)pos);
+         break;
+      }
+      
+      numBlocks = journal_u16(j, blhdr + 2);
+      bytesUsed = journal_u32(j, blhdr + 4);
+      checksum = journal_u32(j, blhdr + 8);
+      
+      /* the checksum is over the header as written, with the field zeroed */
+      memcpy(sumBuf, blhdr, JOURNAL_BLHDR_CHECKSUM_SIZE);
+      memset(sumBuf + 8, 0, 4);
+      
+      if ((u_int32_t)journal_checksum(sumBuf, JOURNAL_BLHDR_CHECKSUM_SIZE) 
+               != checksum 
+            || bytesUsed < blhdrSize || bytesUsed > j->length 
+            || JOURNAL_BLHDR_SIZE + numBlocks*JOURNAL_BINFO_SIZE > blhdrSize) {
+         fprintf(stderr, "invalid journal block list at %llu, ignoring the "
+               "rest of the journal\n", (unsigned long long)pos);
+         break;
+      }
+      
+      dataPos = journal_advance(j, pos, blhdrSize);
+      
+      /* the first block info only links the block lists of a transaction */
+      for (i = 1; i < numBlocks; i++) {
+         const char *binfo = blhdr + JOURNAL_BLHDR_SIZE + i*JOURNAL_BINFO_SIZE;
+         bnum = journal_u64(j, binfo);
+         size = journal_u32(j, binfo + 8);
+         
+         if (size > bytesUsed) {
+            break;
+         }
+         
+         if (bnum != JOURNAL_KILLED_BLOCK) {
+            data = (char*)malloc(size);
+            
+            if (journal_read(j, dataPos, data, size) == -1) {
+               free(data);
+            } else {
+               journal_add(j, volOffset + bnum*j->headerSize, size, data);
+            }
+         }
+         
+         dataPos = journal_advance(j, dataPos, size);
+      }
+      
+      if (journal_u32(j, blhdr + JOURNAL_BLHDR_SIZE + 12) == 0) {
+         j->transactions++;
+      }
+      
+      pos = journal_advance(j, pos, bytesUsed);
+   }
+   
+   free(blhdr);
+}
+
+/* reads the transactions of the journal of a volume which were not written
+ * to their place yet. returns NULL if there are none or the journal can't 
+ * be read.
+ */
+journal *
+journal_load(watchdog *wd, int fd, u_int64_t volOffset, u_int32_t blockSize, 
+      u_int32_t infoBlock) {
+   journal *j = (journal*)calloc(1, sizeof(journal));
+   char info[512], header[512];
+   u_int32_t flags, magic, blhdrSize;
+   u_int64_t start, end;
+   
+   j->watchdog = wd;
+   j->fd = fd;
+   
+   if (journal_pread(wd, fd, info, sizeof(info), 
+            volOffset + (u_int64_t)infoBlock*blockSize) == -1) {
+      fprintf(stderr, "unable to read the journal info block\n");
+      free(j);
+      return NULL;
+   }
+   
+   flags = CFSwapInt32BigToHost(*(u_int32_t*)info);
+   j->start = volOffset + CFSwapInt64BigToHost(*(u_int64_t*)(info + 36));
+   j->length = CFSwapInt64BigToHost(*(u_int64_t*)(info + 44));
+   
+   if (flags & JOURNAL_OTHER_DEV || !(flags & JOURNAL_IN_FS) 
+         || flags & JOURNAL_NEED_INIT) {
+      fprintf(stderr, "journal is not on the volume or not initialized\n");
+      free(j);
+      return NULL;
+   }
+   
+   if (journal_pread(wd, fd, header, sizeof(header), j->start) == -1) {
+      fprintf(stderr, "unable to read the journal header\n");
+      free(j);
+      return NULL;
+   }
+   
+   magic = *(u_int32_t*)header;
+   j->swap = magic != JOURNAL_MAGIC;
+   
+   if (journal_u32(j, header) != JOURNAL_MAGIC 
+         || journal_u32(j, header + 4) != JOURNAL_ENDIAN) {
+      fprintf(stderr, "invalid journal header\n");
+      free(j);
+      return NULL;
+   }
+   
+   start = journal_u64(j, header + 8);
+   end = journal_u64(j, header + 16);
+   blhdrSize = journal_u32(j, header + 32);
+   j->headerSize = journal_u32(j, header + 40);
+   
+   if (journal_u64(j, header + 24) < j->length) {
+      j->length = journal_u64(j, header + 24);
+   }
+   
+   if (j->headerSize < 512 || (j->headerSize & (j->headerSize - 1)) != 0
+         || start < j->headerSize || start >= j->length 
+         || end < j->headerSize || end >= j->length 
+         || blhdrSize < JOURNAL_BLHDR_CHECKSUM_SIZE || blhdrSize > j->length) {
+      fprintf(stderr, "invalid journal header\n");
+      free(j);
+      return NULL;
+   }
+   
+   if (start == end) {
+      free(j);
+      return NULL;
+   }
+   
+   journal_replay(j, volOffset, start, end, blhdrSize);
+   journal_sort(j);
+   
+   if (j->count == 0) {
+      journal_destroy(j);
+      return NULL;
+   }
+   
+   return j;
+}
+
+/* copies the journaled blocks overlapping a range read from the device 
+ * over the data read
+ */
+void 
+journal_apply(const journal *const j, u_int64_t offset, char *const buf, 
+      size_t len) {
+   u_int64_t from, start, end;
+   u_int32_t lo, hi, mid, i;
+   
+   if (j == NULL || len == 0) {
+      return;
+   }
+   
+   from = offset > j->maxLength ? offset - j->maxLength : 0;
+   lo = 0;
+   hi = j->count;
+   
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      
+      if (j->blocks[mid].offset < from) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+   
+   for (i = lo; i < j->count && j->blocks[i].offset < offset + len; i++) {
+      start = j->blocks[i].offset > offset ? j->blocks[i].offset : offset;
+      end = j->blocks[i].offset + j->blocks[i].length;
+      end = end < offset + len ? end : offset + len;
+      
+      if (start < end) {
+         memcpy(buf + (start - offset), 
+               j->blocks[i].data + (start - j->blocks[i].offset), end - start);
+      }
+   }
+}
+
+void 
+journal_destroy(journal *j) {
+   u_int32_t i;
+   
+   if (j == NULL) {
+      return;
+   }
+   
+   for (i = 0; i < j->count; i++) {
+      free(j->blocks[i].data);
+   }
+   
+   free(j->blocks);
+   free(j);
+}
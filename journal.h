@@ -0,0 +1,86 @@
+/*
+ *  journal.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "watchdog.h"
+
+#ifndef __JOURNAL_H_
+#define __JOURNAL_H_
+
+/* bit 13 of the volume attributes */
+#define JOURNAL_VOLUME_MASK 0x2000
+
+/* journal info block flags */
+#define JOURNAL_IN_FS       0x01
+#define JOURNAL_OTHER_DEV   0x02
+#define JOURNAL_NEED_INIT   0x04
+
+#define JOURNAL_MAGIC       0x4A4E4C78   /* 'JNLx' */
+#define JOURNAL_ENDIAN      0x12345678
+#define JOURNAL_HEADER_SIZE 44
+#define JOURNAL_BLHDR_SIZE  16
+#define JOURNAL_BINFO_SIZE  16
+#define JOURNAL_BLHDR_CHECKSUM_SIZE 32
+#define JOURNAL_KILLED_BLOCK 0xFFFFFFFFFFFFFFFFULL
+
+/* a block written by a transaction, at its offset on the device */
+typedef struct {
+   u_int64_t offset;
+   u_int32_t length;
+   u_int32_t seq;
+   char *data;
+} journal_block;
+
+/* the newest version of every block of the transactions that were not yet
+ * written to their place, sorted by offset
+ */
+typedef struct {
+   watchdog *watchdog;
+   int fd;
+   int swap;
+   u_int64_t start;             /* of the journal on the device */
+   u_int64_t length;
+   u_int32_t headerSize;        /* also the unit of block numbers */
+   journal_block *blocks;
+   u_int32_t count;
+   u_int32_t size;
+   u_int32_t maxLength;
+   u_int32_t transactions;
+} journal;
+
+journal *
+journal_load(watchdog *wd, int fd, u_int64_t volOffset, u_int32_t blockSize, 
+      u_int32_t infoBlock);
+
+void 
+journal_apply(const journal *const j, u_int64_t offset, char *const buf, 
+      size_t len);
+
+void 
+journal_destroy(journal *j);
+
+#endif
@@ -38,19 +38,95 @@
 #include "btree.h"
 #include "orderedlist.h"
 #include "definitions.h"
+#include "batch.h"
+#include "manifest.h"
+#include "catindex.h"
+#include "search.h"
+#include "digest.h"
+#include "extcheck.h"
+#include "sigcarve.h"
+#include "watchdog.h"
+#include "decmpfs.h"
 #include "memory.h"
+#include "hfsvol.h"
+#include "dump.h"
+#include "pool.h"
 
-extern HFSPlusVolume volume;
+#define DEFAULT_SMALL_FILE_SIZE (64*1024)
+#define DEFAULT_JOBS 2
+
+static HFSPlusRecoveryOptions options;
 
-static char *recoveryPath;
-static int recoveryPathLen;
 static const char *const lostPath = "/lost+found";
 static const int lostPathLen = 11;
 static const short maxCnidLen = 10;
 
-static btree *folders;
-static btree *files;
-static btree *extents;
+static char *planPath;
+static int planFormat = MANIFEST_JSON;
+
+static char *indexPath;
+
+static char *query;
+
+static char *digestPath;
+static char *verifyPath;
+static char *catPath;
+
+static int skipOverlapping;
+
+static int carveFiles;
+static int carveAllBlocks;
+
+static char *archivePath;
+static int archiveLevel;
+static int discardOutput;
+
+static char *badRangesPath;
+
+static char *batchPath;
+static int concurrentJobs = DEFAULT_JOBS;
+
+/* what is parsed from a volume and restored from it. the handlers and 
+ * traversals get it as their retVal, so volumes of the batch mode can be 
+ * restored side by side.
+ */
+typedef struct {
+   HFSPlusVolume *vol;
+   char *recoveryPath;
+   
+   btree *folders;
+   btree *files;
+   btree *extents;
+   batch *smallFiles;
+   long orphanFolders;
+   int indexed;                 /* the records live in the index mapping */
+   
+   manifest *plan;
+   search_index *names;
+   extcheck *blockOwners;
+   
+   btree *indirectFiles;
+   btree *indirectFolders;
+   u_int32_t privateFilesID;
+   u_int32_t privateDirsID;
+   u_int64_t hardLinks;
+   u_int64_t dirLinks;
+   
+   u_int64_t attributeCount;
+   u_int64_t attributeForks;
+   attribute **forkAttributes;
+   
+   u_int64_t overlappingFiles;
+   u_int64_t outOfRangeFiles;
+   u_int64_t unallocatedFiles;
+} recoveryState;
+
+typedef struct {
+   recoveryState *r;
+   u_int64_t offset;
+   const char *data;
+   u_int32_t len;
+} rescuedPiece;
 
 
 int 
@@ -60,14 +136,26 @@ folderThreadKeyComparator(void *key1, void *key2) {
 
 int 
 CNIDComparator(void *key1, void *key2) {
-   long k1 = *(long*)key1;
-   long k2 = *(long*)key2;
+   u_int32_t k1 = *(u_int32_t*)key1;
+   u_int32_t k2 = *(u_int32_t*)key2;
 
    if( k1 < k2 ) return -1;
    if( k1 > k2 ) return  1;
    return 0;
 }
 
+int 
+extentKeyComparator(void *key1, void *key2) {
+   extentKey *k1 = (extentKey*)key1;
+   extentKey *k2 = (extentKey*)key2;
+   
+   if( k1->fileID < k2->fileID ) return -1;
+   if( k1->fileID > k2->fileID ) return  1;
+   if( k1->forkType < k2->forkType ) return -1;
+   if( k1->forkType > k2->forkType ) return  1;
+   return 0;
+}
+
 int 
 startBlockComparator(void *key1, void *key2) {
    u_int32_t k1 = *(u_int32_t*)key1;
@@ -78,37 +166,266 @@ startBlockComparator(void *key1, void *key2) {
    return 0;
 }
 
+int 
+hasValidForks(const HFSPlusVolume *const vol, const file *const f) {
+   const HFSPlusForkData *forks[2];
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int64_t blocks;
+   int i, e;
+   
+   forks[0] = &f->hfsFile->dataFork;
+   forks[1] = &f->hfsFile->resourceFork;
+   
+   for (i = 0; i < 2; i++) {
+      if (forks[i]->logicalSize > (u_int64_t)forks[i]->totalBlocks*blockSize 
+            || forks[i]->totalBlocks > vol->volHeader.totalBlocks) {
+         return 0;
+      }
+      
+      for (e = 0, blocks = 0; e < 8; e++) {
+         if ((u_int64_t)forks[i]->extents[e].startBlock 
+               + forks[i]->extents[e].blockCount 
+               > vol->volHeader.totalBlocks) {
+            return 0;
+         }
+         blocks += forks[i]->extents[e].blockCount;
+      }
+      
+      if (blocks > forks[i]->totalBlocks) {
+         return 0;
+      }
+   }
+   
+   return 1;
+}
+
+/* decides which of two records of the same CNID is restored: one whose 
+ * forks fit the volume, then the newer content, then the one from a used 
+ * node, then the one from the lower node number. the order of the scan 
+ * doesn't matter.
+ */
+int 
+preferVersion(const HFSPlusVolume *const vol, const file *const a, 
+      const file *const b) {
+   int validA = hasValidForks(vol, a), validB = hasValidForks(vol, b);
+   
+   if (validA != validB) {
+      return validA;
+   }
+   
+   if (a->hfsFile->contentModDate != b->hfsFile->contentModDate) {
+      return a->hfsFile->contentModDate > b->hfsFile->contentModDate;
+   }
+   
+   if ((a->flags & FILE_STALE) != (b->flags & FILE_STALE)) {
+      return !(a->flags & FILE_STALE);
+   }
+   
+   return a->node < b->node;
+}
+
+/* keeps one record per CNID in the tree, all others become its versions */
 void 
-addFileRecord(HFSPlusCatalogKey *key, sint16 recType, void *fileRec) {
+addFileVersion(recoveryState *r, file *f) {
+   btree_node *node = btree_find(r->files, &f->fileID);
+   file *current;
+   
+   if (node == NULL) {
+      btree_insert(r->files, &f->fileID, f);
+      return;
+   }
+   
+   current = (file*)node->value;
+   
+   if (preferVersion(r->vol, f, current)) {
+      f->versions = current;
+      node->key = &f->fileID;
+      node->value = f;
+   } else {
+      f->versions = current->versions;
+      current->versions = f;
+   }
+}
+
+void 
+addFileRecord(HFSPlusCatalogKey *key, sint16 recType, void *fileRec, 
+      void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
    file *f = (file*)calloc(1, sizeof(file));
    f->parentID = key->parentID;
    f->fileID = ((HFSPlusCatalogFile*)fileRec)->fileID;
    f->name = HFSUniStr255ToCString(&key->nodeName);
    f->hfsFile = (HFSPlusCatalogFile*)malloc(sizeof(HFSPlusCatalogFile));
    memcpy(f->hfsFile, fileRec, sizeof(HFSPlusCatalogFile));
-   btree_insert(files, &f->fileID, f);
+   f->node = r->vol->scanNode;
+   f->flags = r->vol->scanNodeFree ? FILE_STALE : 0;
+   addFileVersion(r, f);
 }
 
 void 
-addFolderRecord(HFSPlusCatalogKey *key, sint16 recType, void *folderRec) {
-   folder *fldr = (folder*)calloc(1, sizeof(folder));
+addFolderRecord(HFSPlusCatalogKey *key, sint16 recType, void *folderRec, 
+      void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   folder *fldr;
+   u_int32_t folderID = ((HFSPlusCatalogFolder*)folderRec)->folderID;
+   
+   /* used nodes are scanned first, stale copies of a folder are dropped */
+   if (btree_find(r->folders, &folderID) != NULL) {
+      return;
+   }
+   
+   fldr = (folder*)calloc(1, sizeof(folder));
    fldr->parentID = key->parentID;
-   fldr->folderID = ((HFSPlusCatalogFolder*)folderRec)->folderID;
+   fldr->folderID = folderID;
    fldr->name = HFSUniStr255ToCString(&key->nodeName);
-   btree_insert(folders, &fldr->folderID, fldr);
+   btree_insert(r->folders, &fldr->folderID, fldr);
 }
 
 void 
-addFolderAndFileRecord(HFSPlusCatalogKey *key, sint16 recType, void *fileRec) {
+addFolderAndFileRecord(HFSPlusCatalogKey *key, sint16 recType, void *fileRec, 
+      void *retVal) {
    if (recType == kHFSPlusFileRecord) {
-      addFileRecord(key, recType, fileRec);
+      addFileRecord(key, recType, fileRec, retVal);
    } else {
-      addFolderRecord(key, recType, fileRec);
+      addFolderRecord(key, recType, fileRec, retVal);
+   }
+}
+
+/* the attribute of a file with the given name, a new one is added if 
+ * there is none
+ */
+attribute *
+fileAttribute(recoveryState *r, file *f, const HFSUniStr255 *const uniName) {
+   char *name = HFSUniStr255ToCString(uniName);
+   attribute *attr;
+   
+   for (attr = f->attributes; attr != NULL; attr = attr->next) {
+      if (strcmp(attr->name, name) == 0) {
+         free(name);
+         return attr;
+      }
+   }
+   
+   attr = (attribute*)calloc(1, sizeof(attribute));
+   attr->name = name;
+   attr->next = f->attributes;
+   f->attributes = attr;
+   r->attributeCount++;
+   return attr;
+}
+
+void 
+addAttributeRecord(attributeKey *key, void *record, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   btree_node *fileNode = btree_find(r->files, &key->fileID);
+   attribute *attr;
+   u_int32_t *listKey;
+   HFSPlusExtentRecord *rec;
+   
+   if (fileNode == NULL) {
+      return;
+   }
+   
+   attr = fileAttribute(r, (file*)fileNode->value, &key->name);
+   
+   switch (*(u_int32_t*)record) {
+      case ATTR_INLINE_DATA:
+         if (attr->data == NULL && attr->fork == NULL) {
+            attr->size = ((attributeData*)record)->size;
+            attr->data = (char*)malloc(attr->size + 1);
+            memcpy(attr->data, ((attributeData*)record)->data, attr->size);
+         }
+         break;
+      case ATTR_FORK_DATA:
+         if (attr->data == NULL && attr->fork == NULL) {
+            attr->fork = (HFSPlusForkData*)malloc(sizeof(HFSPlusForkData));
+            memcpy(attr->fork, &((attributeForkData*)record)->fork, 
+                  sizeof(HFSPlusForkData));
+            r->attributeForks++;
+         }
+         break;
+      case ATTR_EXTENTS:
+         /* overflow extents may be seen before the fork they belong to */
+         if (attr->extents == NULL) {
+            attr->extents = ol_create(&startBlockComparator);
+         }
+         
+         listKey = (u_int32_t*)malloc(sizeof(u_int32_t));
+         *listKey = key->startBlock;
+         
+         if (ol_find(attr->extents, listKey) != NULL) {
+            free(listKey);
+            break;
+         }
+         
+         rec = (HFSPlusExtentRecord*)malloc(sizeof(HFSPlusExtentRecord));
+         memcpy(rec, &((attributeExtents*)record)->extents, 
+               sizeof(HFSPlusExtentRecord));
+         ol_insert(attr->extents, listKey, rec);
+         break;
+   }
+}
+
+void 
+collectAttributeForks(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   attribute *attr;
+   
+   for (attr = ((file*)node->value)->attributes; attr != NULL; 
+         attr = attr->next) {
+      if (attr->fork != NULL) {
+         r->forkAttributes[r->attributeForks++] = attr;
+      }
+   }
+}
+
+int 
+attributeForkComparator(const void *a1, const void *a2) {
+   u_int32_t s1 = (*(attribute**)a1)->fork->extents[0].startBlock;
+   u_int32_t s2 = (*(attribute**)a2)->fork->extents[0].startBlock;
+   return s1 < s2 ? -1 : s1 > s2;
+}
+
+/* the values of attributes stored in forks are read in one pass ordered 
+ * by their position, instead of seeking to each one while restoring
+ */
+void 
+loadAttributeForks(recoveryState *r) {
+   attribute *attr;
+   u_int64_t i;
+   
+   if (r->attributeForks == 0) {
+      return;
+   }
+   
+   r->forkAttributes = 
+      (attribute**)malloc(r->attributeForks*sizeof(attribute*));
+   r->attributeForks = 0;
+   btree_inorderTraverseWithReturn(r->files, &collectAttributeForks, r);
+   qsort(r->forkAttributes, r->attributeForks, sizeof(attribute*), 
+         &attributeForkComparator);
+   
+   for (i = 0; i < r->attributeForks; i++) {
+      attr = r->forkAttributes[i];
+      
+      if (attr->fork->logicalSize > ATTR_MAX_FORK_SIZE) {
+         fprintf(stderr, "skipping attribute %s of %llu bytes\n", attr->name, 
+               (unsigned long long)attr->fork->logicalSize);
+      } else if ((attr->data = readForkData(r->vol, attr->fork, attr->extents)) 
+            == NULL) {
+         fprintf(stderr, "unable to read attribute %s\n", attr->name);
+      } else {
+         attr->size = (u_int32_t)attr->fork->logicalSize;
+      }
    }
+   
+   free(r->forkAttributes);
+   r->forkAttributes = NULL;
 }
 
 void 
-dumpExtentRecord(HFSPlusExtentKey *key, HFSPlusExtentRecord *record) {
+dumpExtentRecord(HFSPlusExtentKey *key, HFSPlusExtentRecord *record, 
+      void *retVal) {
    int i;
    HFSPlusExtentDescriptor *desc = (HFSPlusExtentDescriptor*)record;
    
@@ -128,39 +445,50 @@ dumpExtentRecord(HFSPlusExtentKey *key, HFSPlusExtentRecord *record) {
 }
 
 void 
-addExtentRecord(HFSPlusExtentKey *key, HFSPlusExtentRecord *record) {
+addExtentRecord(HFSPlusExtentKey *key, HFSPlusExtentRecord *record, 
+      void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
    u_int32_t *listKey = (u_int32_t*)malloc(sizeof(u_int32_t));
    extentKey *treeKey = (extentKey*)malloc(sizeof(extentKey));
-   HFSPlusExtentRecord *r = 
+   HFSPlusExtentRecord *rec = 
       (HFSPlusExtentRecord*)malloc(sizeof(HFSPlusExtentRecord));
    orderedlist *list;
    
    *listKey = key->startBlock;
    treeKey->fileID = key->fileID;
    treeKey->forkType = key->forkType;
-   memcpy(r, record, sizeof(HFSPlusExtentRecord));   
-   btree_node *listNode = (btree_node*)btree_find(extents, treeKey);
+   memcpy(rec, record, sizeof(HFSPlusExtentRecord));   
+   btree_node *listNode = (btree_node*)btree_find(r->extents, treeKey);
 
    if (listNode == NULL) {
       list = ol_create(&startBlockComparator);
-      btree_insert(extents, treeKey, list);
+      btree_insert(r->extents, treeKey, list);
    } else {
       list = (orderedlist*)listNode->value;
+      
+      /* carved or stale nodes may hold copies of a record already seen */
+      if (ol_find(list, listKey) != NULL) {
+         free(listKey);
+         free(treeKey);
+         free(rec);
+         return;
+      }
    }
    
-   ol_insert(list, listKey, r);
+   ol_insert(list, listKey, rec);
 }
 
 void 
 dumpFolderNode(btree_node *node) {
    folder *fldr = (folder*)node->value;
-   printf("%d > %d: %s\n", fldr->parentID, *(long*)node->key, fldr->name);
+   printf("%d > %d: %s\n", fldr->parentID, *(u_int32_t*)node->key, 
+         fldr->name);
 }
 
 void 
 dumpFileNode(btree_node *node) {
    file *f = (file*)node->value;
-   printf("%d > %d: %s/%s\n", f->parentID, *(long*)node->key, 
+   printf("%d > %d: %s/%s\n", f->parentID, *(u_int32_t*)node->key, 
          f->path != NULL ? f->path : "", f->name);
 }
 
@@ -173,13 +501,15 @@ dumpFolderThreadNode(btree_node *node) {
 }
 
 void 
-linkFolderToParent(btree_node *node) {
-   long key = ((folder*)node->value)->parentID;
-   btree_node *parentNode = btree_find(folders, &key);
+linkFolderToParent(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   u_int32_t key = ((folder*)node->value)->parentID;
+   btree_node *parentNode = btree_find(r->folders, &key);
 
    if (parentNode != NULL) {
       ((folder*)(node->value))->parent = parentNode->value;
    } else if (((folder*)node->value)->parentID != kHFSRootParentID) {
+      r->orphanFolders++;
       fprintf(stderr, 
             "orphan folder found: Parent-CNID=%d / CNID=%d / Name=%s\n", 
             ((folder*)node->value)->parentID, ((folder*)node->value)->folderID, 
@@ -189,9 +519,10 @@ linkFolderToParent(btree_node *node) {
 
 
 void 
-linkFilesToParent(btree_node *node) {
-   long key = ((file*)node->value)->parentID;
-   btree_node *parentNode = btree_find(folders, &key);
+linkFilesToParent(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   u_int32_t key = ((file*)node->value)->parentID;
+   btree_node *parentNode = btree_find(r->folders, &key);
 
    if (parentNode != NULL) {
       ((file*)(node->value))->parent = parentNode->value;
@@ -203,10 +534,11 @@ linkFilesToParent(btree_node *node) {
 }
 
 void 
-linkExtentsToFile(btree_node *node) {
+linkExtentsToFile(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
    extentKey *key = (extentKey*)node->key;
    orderedlist *value = (orderedlist*)node->value;
-   btree_node *fileNode = btree_find(files, &key->fileID);
+   btree_node *fileNode = btree_find(r->files, &key->fileID);
    file* f;
    
    if (fileNode == NULL) {
@@ -215,57 +547,276 @@ linkExtentsToFile(btree_node *node) {
       return;
    }
    
-   f = (file*)fileNode->value;
+   /* the overflow records are keyed by CNID, all versions share them */
+   for (f = (file*)fileNode->value; f != NULL; f = f->versions) {
+      if (key->forkType == 0x00) {
+         f->dataExtents = value;
+      } else {
+         f->rsrcExtents = value;
+      }
+   }
+}
+
+void 
+addFileExtents(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f = (file*)node->value;
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
    
-   if (key->forkType == 0x00) {
-      f->dataExtents = value;
-   } else {
-      f->rsrcExtents = value;
+   extcheck_addFork(r->blockOwners, &hfsFile->dataFork, f->dataExtents, f, 
+         0x00);
+   extcheck_addFork(r->blockOwners, &hfsFile->resourceFork, f->rsrcExtents, f, 
+         0xFF);
+}
+
+void 
+countTaggedFile(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f = (file*)node->value;
+   
+   if (f->flags & FILE_OUT_OF_RANGE) {
+      r->outOfRangeFiles++;
+   } else if (f->flags & FILE_OVERLAP) {
+      r->overlappingFiles++;
+   }
+   
+   if (f->flags & FILE_UNALLOCATED) {
+      r->unallocatedFiles++;
    }
 }
 
+/* cross-checks the extents of all files against each other, the volume's
+ * special files and the size of the volume
+ */
+void 
+checkExtents(recoveryState *r) {
+   HFSPlusVolume *vol = r->vol;
+   const HFSPlusForkData *special[] = { &vol->volHeader.extentsFile, 
+      &vol->volHeader.catalogFile, &vol->volHeader.allocationFile, 
+      &vol->volHeader.startupFile, &vol->volHeader.attributesFile };
+   u_int32_t specialIDs[] = { kHFSExtentsFileID, kHFSCatalogFileID, 
+      kHFSAllocationFileID, kHFSStartupFileID, kHFSAttributesFileID };
+   extentKey key;
+   btree_node *node;
+   int i;
+   
+   r->blockOwners = extcheck_create(vol->volHeader.totalBlocks, 
+         vol->allocation);
+   
+   for (i = 0; i < 5; i++) {
+      key.fileID = specialIDs[i];
+      key.forkType = 0x00;
+      node = btree_find(r->extents, &key);
+      extcheck_addFork(r->blockOwners, special[i], 
+            node != NULL ? (orderedlist*)node->value : NULL, NULL, 0x00);
+   }
+   
+   btree_inorderTraverseWithReturn(r->files, &addFileExtents, r);
+   extcheck_run(r->blockOwners);
+   btree_inorderTraverseWithReturn(r->files, &countTaggedFile, r);
+   printf("%llu files with overlapping extents, %llu files with extents past "
+         "the end of the volume\n", (unsigned long long)r->overlappingFiles, 
+         (unsigned long long)r->outOfRangeFiles);
+   
+   if (vol->allocation != NULL) {
+      printf("%llu files with blocks marked as free, %llu of %llu bytes "
+            "referenced by files are allocated\n", 
+            (unsigned long long)r->unallocatedFiles, 
+            (unsigned long long)r->blockOwners->allocatedBlocks 
+               * vol->volHeader.blockSize, 
+            (unsigned long long)r->blockOwners->blocks 
+               * vol->volHeader.blockSize);
+   }
+   
+}
+
+/* loads the allocation file including its overflow extents */
 void 
-buildPath(btree_node *node) {
+loadAllocationBitmap(recoveryState *r) {
+   HFSPlusVolume *vol = r->vol;
+   extentKey key;
+   btree_node *node;
+   bitmap *bm;
+   
+   if (vol->volHeader.allocationFile.totalBlocks == 0) {
+      fprintf(stderr, "no allocation file, not checking allocation\n");
+      return;
+   }
+   
+   key.fileID = kHFSAllocationFileID;
+   key.forkType = 0x00;
+   node = btree_find(r->extents, &key);
+   
+   if ((bm = bitmap_load(vol, &vol->volHeader.allocationFile, 
+               node != NULL ? (orderedlist*)node->value : NULL, 
+               vol->volHeader.totalBlocks)) == NULL) {
+      fprintf(stderr, "unable to load the allocation bitmap\n");
+      return;
+   }
+   
+   printf("%u blocks allocated, %u free (volume header: %u free)\n", 
+         bm->allocated, bm->totalBlocks - bm->allocated, 
+         vol->volHeader.freeBlocks);
+   vol->allocation = bm;
+}
+
+char *
+folderPath(folder *fldr) {
    int initialSize = 8;
    int growthFactor = 2;
    int currentSize = initialSize;
    int top = 0;
-   long key = ((file*)node->value)->parentID;
-   btree_node *fldrNode = btree_find(folders, &key);
-   folder *fldr;
+   char** folderStack = (char**)calloc(initialSize, sizeof(char*));
    char *pathName;
    int i, pathLen = 0;
    
-   if (fldrNode != NULL) {
-      char** folderStack = (char**)calloc(initialSize, sizeof(char*));
-      fldr = (folder*)fldrNode->value;
+   folderStack[top++] = fldr->name;
+
+   while ((fldr = (folder*)fldr->parent) != NULL) {
+      if (top == currentSize) {
+         if ((folderStack = (char**)realloc(folderStack, 
+                     (currentSize *= growthFactor)*sizeof(char*))) == NULL) {
+            perror("realloc");
+            exit(1);
+         }
+      }
+
       folderStack[top++] = fldr->name;
+   }
    
-      while ((fldr = (folder*)fldr->parent) != NULL) {
-         if (top == currentSize) {
-            if ((folderStack = (char**)realloc(folderStack, 
-                        (currentSize *= growthFactor)*sizeof(char*))) == NULL) {
-               perror("realloc");
-               exit(1);
-            }
-         }
+   for (i = 0; i < top; i++) {
+      pathLen += strlen(folderStack[i]);
+   }
+   
+   pathLen += top + 1;
+   pathName = (char*)malloc(pathLen);
+   pathName[0] = '/';
+   pathName[pathLen-1] = '\0';
+   strrjoin(folderStack, top-1, '/', pathName+1);
+   free(folderStack);
+   return pathName;
+}
 
-         folderStack[top++] = fldr->name;
+void 
+buildPath(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f;
+   btree_node *fldrNode;
+   
+   for (f = (file*)node->value; f != NULL; f = f->versions) {
+      if ((fldrNode = btree_find(r->folders, &f->parentID)) != NULL) {
+         f->path = folderPath((folder*)fldrNode->value);
       }
+   }
+}
+
+/* the private folders below the root keep the indirect nodes of hard links. 
+ * the name of the one for files starts with four nul characters, so its 
+ * converted name is empty.
+ */
+void 
+findPrivateFolders(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   folder *fldr = (folder*)node->value;
+   
+   if (fldr->parentID != kHFSRootFolderID || fldr->name == NULL) {
+      return;
+   }
+   
+   if (fldr->name[0] == '\0') {
+      r->privateFilesID = fldr->folderID;
+   } else if (strcmp(fldr->name, PRIVATE_DIR_NAME) == 0) {
+      r->privateDirsID = fldr->folderID;
+   }
+}
+
+/* parses the link reference from the name of an indirect node */
+int 
+linkReference(const char *const name, const char *const prefix, 
+      u_int32_t *ref) {
+   size_t len = strlen(prefix);
+   char *end;
+   
+   if (name == NULL || strncmp(name, prefix, len) != 0 
+         || name[len] < '0' || name[len] > '9') {
+      return 0;
+   }
+   
+   *ref = (u_int32_t)strtoul(name + len, &end, 10);
+   return *end == '\0';
+}
+
+void 
+addIndirectFile(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f = (file*)node->value;
+   u_int32_t ref, *key;
+   
+   if (f->parentID == r->privateFilesID 
+         && linkReference(f->name, "iNode", &ref)) {
+      key = (u_int32_t*)malloc(sizeof(u_int32_t));
+      *key = ref;
+      btree_insert(r->indirectFiles, key, f);
+   }
+}
+
+void 
+addIndirectFolder(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   folder *fldr = (folder*)node->value;
+   u_int32_t ref, *key;
+   
+   if (fldr->parentID == r->privateDirsID 
+         && linkReference(fldr->name, "dir_", &ref)) {
+      key = (u_int32_t*)malloc(sizeof(u_int32_t));
+      *key = ref;
+      btree_insert(r->indirectFolders, key, fldr);
+   }
+}
+
+void 
+resolveLink(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f = (file*)node->value;
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   btree_node *target;
+   
+   if (hfsFile->userInfo.fdType == HARDLINK_FILE_TYPE 
+         && hfsFile->userInfo.fdCreator == HARDLINK_CREATOR) {
+      target = btree_find(r->indirectFiles, &hfsFile->bsdInfo.special.iNodeNum);
       
-      for (i = 0; i < top; i++) {
-         pathLen += strlen(folderStack[i]);
+      if (target == NULL) {
+         fprintf(stderr, "indirect node of hard link not found: %d - %s\n", 
+               f->fileID, f->name);
+         return;
       }
       
-      pathLen += top + 1;
-      pathName = (char*)malloc(pathLen);
-      pathName[0] = '/';
-      pathName[pathLen-1] = '\0';
-      strrjoin(folderStack, top-1, '/', pathName+1);
-      free(folderStack);
-      
-      ((file*)node->value)->path = pathName;
+      f->link = (file*)target->value;
+      f->link->flags |= FILE_LINKED;
+      r->hardLinks++;
+   } else if (hfsFile->userInfo.fdType == DIRLINK_FILE_TYPE 
+         && hfsFile->userInfo.fdCreator == DIRLINK_CREATOR) {
+      f->flags |= FILE_DIRLINK;
+      r->dirLinks++;
+   }
+}
+
+void 
+resolveHardLinks(recoveryState *r) {
+   btree_inorderTraverseWithReturn(r->folders, &findPrivateFolders, r);
+   
+   if (r->privateFilesID == 0 && r->privateDirsID == 0) {
+      return;
    }
+   
+   r->indirectFiles = btree_create(&CNIDComparator);
+   r->indirectFolders = btree_create(&CNIDComparator);
+   btree_inorderTraverseWithReturn(r->files, &addIndirectFile, r);
+   btree_inorderTraverseWithReturn(r->folders, &addIndirectFolder, r);
+   btree_inorderTraverseWithReturn(r->files, &resolveLink, r);
+   printf("%llu hard links to %d files, %llu directory links to %d folders\n", 
+         (unsigned long long)r->hardLinks, r->indirectFiles->nodeCount, 
+         (unsigned long long)r->dirLinks, r->indirectFolders->nodeCount);
 }
 
 void 
@@ -322,18 +873,55 @@ concat(const char *const s1, const char *const s2) {
    return str;
 }
 
+char *
+lostAndFoundPath(const file *const f) {
+   char *cnidStr = (char*)malloc(maxCnidLen+1);
+   char *path;
+   
+   sprintf(cnidStr, "%d", f->parentID);
+   path = concatPath(lostPath, cnidStr);
+   free(cnidStr);
+   return path;
+}
+
+/* the data of an indirect node is copied once, to the first of its links. 
+ * the other links become hard links to that copy.
+ */
+void 
+restoreLink(recoveryState *r, file *target, const char *const dstFile) {
+   if (target->linkPath != NULL) {
+      if (r->vol->output->link(r->vol->output, dstFile, target->linkPath, 
+               SINK_HARDLINK) == 0) {
+         return;
+      }
+      
+      fprintf(stderr, "couldn't link %s (errno=%d), copying it\n", dstFile, 
+            errno);
+   }
+   
+   /* a copy that failed isn't linked to, the next link copies again */
+   if (copyFile(r->vol, target, dstFile) == 0 && target->linkPath == NULL) {
+      target->linkPath = strdup(dstFile);
+   }
+}
+
 int 
-restoreFile(file *f, char *path) {
+restoreFile(recoveryState *r, file *f, char *path) {
+   sink *output = r->vol->output;
    char *dstFile;
-   /*TODO: apply the original mask*/
-   mode_t mask = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
 
-   if (mkdirr(path, mask) != 0 && errno != EEXIST) {
+   if (output->makeDirectory(output, path) != 0) {
       fprintf(stderr, "couldn't create path (errno=%d): %s\n", errno, path);
       return -1;
    } else {
       dstFile = concatPath(path, f->name);
-      copyFile(f, dstFile);
+      
+      if (f->link != NULL) {
+         restoreLink(r, f->link, dstFile);
+      } else {
+         copyFile(r->vol, f, dstFile);
+      }
+      
       free(dstFile);
    }
    
@@ -341,15 +929,14 @@ restoreFile(file *f, char *path) {
 }
 
 void 
-restore(btree_node *node) {
-   file *f = (file*)node->value;
-   char *path, *tmpPath, *cnidStr;
+recoverFile(recoveryState *r, file *f) {
+   char *path, *tmpPath;
    int error = 0;
 
    if (f->path != NULL) {
-      path = concat(recoveryPath, f->path);
+      path = concat(r->recoveryPath, f->path);
       
-      if (restoreFile(f, path) == -1) {
+      if (restoreFile(r, f, path) == -1) {
          error = 1;
       }
       
@@ -357,14 +944,11 @@ restore(btree_node *node) {
    }
    
    if (f->path == NULL || error) {
-      cnidStr = (char*)malloc(maxCnidLen+1);
-      sprintf(cnidStr, "%d", f->parentID);
-      tmpPath = concat(recoveryPath, lostPath);
-      path = concatPath(tmpPath, cnidStr);
+      tmpPath = lostAndFoundPath(f);
+      path = concat(r->recoveryPath, tmpPath);
       free(tmpPath);
-      free(cnidStr);
    
-      if (restoreFile(f, path) == -1) {
+      if (restoreFile(r, f, path) == -1) {
          fprintf(stderr, "unable to restore file: %s\n", f->name);
       }
       
@@ -372,59 +956,1178 @@ restore(btree_node *node) {
    }
 }
 
+/* directories can't be hard linked on the target, a directory link becomes 
+ * a relative symbolic link to its dir_<N> folder in the private directory.
+ */
 void 
-recovery() {
-   printf("building folder and file tree from catalog\n");
-   sequentiallyReadCatalog(&folderAndFileRecordFilter, &addFolderAndFileRecord);
-   printf("node count in folder tree: %d\n", folders->nodeCount);
-   printf("node count in file tree: %d\n", files->nodeCount);
-   printf("link all folders to their parents\n");
-   btree_inorderTraverse(folders, &linkFolderToParent);
-   printf("link all files to their parent folders\n");
-   btree_inorderTraverse(files, &linkFilesToParent);
-   printf("determine path of files\n");
-   btree_inorderTraverse(files, &buildPath);
-   printf("building tree from extent overflow file\n");
-   sequentiallyReadExtents(&addExtentRecord);
-   printf("node count in extent overflow tree: %d\n", extents->nodeCount);
-   printf("linking overflow extents to files\n");
-   btree_inorderTraverse(extents, &linkExtentsToFile);
-   printf("restoring files...\n");
-   btree_inorderTraverse(files, &restore);
-   printf("finished\n");
-
-}
-
-int 
-main (int argc, const char * argv[]) {
-
-   if (argc < 3 || argc > 4) {
-      fprintf(stderr, "usage: %s <device> <recovery-path> [<offset>]\n", argv[0]);
-      exit(1);
+restoreDirLink(recoveryState *r, file *f) {
+   sink *output = r->vol->output;
+   u_int32_t ref = f->hfsFile->bsdInfo.special.iNodeNum;
+   btree_node *target = r->indirectFolders != NULL 
+      ? btree_find(r->indirectFolders, &ref) : NULL;
+   char *targetDir, *targetPath, *relPath, *path, *linkName;
+   const char *c;
+   int depth = 0;
+   
+   if (target == NULL || f->path == NULL) {
+      fprintf(stderr, "skipping directory link without target: %d - %s\n", 
+            f->fileID, f->name);
+      return;
    }
    
-   char *device = (char *)argv[1];
-
-   if (*(char *)argv[2] != '/') {
-      char *cwd = getcwd(NULL);
-      recoveryPath = concatPath(cwd, (char *)argv[2]);
-      free(cwd);
+   targetDir = folderPath((folder*)target->value);
+   targetPath = concat(r->recoveryPath, targetDir);
+   path = concat(r->recoveryPath, f->path);
+   
+   /* linked folders without files wouldn't be created otherwise */
+   if (output->makeDirectory(output, targetPath) != 0 
+         || output->makeDirectory(output, path) != 0) {
+      fprintf(stderr, "couldn't create path (errno=%d): %s\n", errno, path);
    } else {
-      recoveryPath = (char *)argv[2];
+      for (c = f->path; *c != '\0'; c++) {
+         depth += *c == '/';
+      }
+      
+      relPath = (char*)malloc(depth * 3 + strlen(targetDir));
+      relPath[0] = '\0';
+      
+      while (depth-- > 0) {
+         strcat(relPath, "../");
+      }
+      
+      strcat(relPath, targetDir + 1);
+      linkName = concatPath(path, f->name);
+      
+      if (output->link(output, linkName, relPath, SINK_SYMLINK) != 0) {
+         fprintf(stderr, "couldn't create directory link (errno=%d): %s\n", 
+               errno, linkName);
+      }
+      
+      free(linkName);
+      free(relPath);
    }
+   
+   free(path);
+   free(targetPath);
+   free(targetDir);
+}
 
-   recoveryPathLen = strlen(recoveryPath);
+void 
+restoreBatched(void *item, void *retVal) {
+   recoverFile((recoveryState*)retVal, (file*)item);
+}
 
-   u_int64_t offset = argc == 4 ? atoll(argv[3]) : 0;
+int 
+isSmallFile(const HFSPlusVolume *const vol, const file *const f, 
+      u_int32_t *start, u_int32_t *end) {
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   const HFSPlusForkData *forks[2];
+   int i, e;
+   
+   if (vol->options.smallFileSize == 0 
+         || f->dataExtents != NULL || f->rsrcExtents != NULL 
+         || hfsFile->dataFork.logicalSize + hfsFile->resourceFork.logicalSize
+            > vol->options.smallFileSize) {
+      return 0;
+   }
+   
+   forks[0] = &hfsFile->dataFork;
+   forks[1] = &hfsFile->resourceFork;
+   *start = 0xFFFFFFFF;
+   *end = 0;
+   
+   for (i = 0; i < 2; i++) {
+      for (e = 0; e < 8 && forks[i]->extents[e].blockCount != 0; e++) {
+         u_int32_t s = forks[i]->extents[e].startBlock;
+         u_int32_t n = forks[i]->extents[e].blockCount;
+         *start = s < *start ? s : *start;
+         *end = s + n > *end ? s + n : *end;
+      }
+   }
+   
+   return *end > *start 
+      && *end - *start <= BATCH_SPAN_SIZE / vol->volHeader.blockSize;
+}
 
-   folders = btree_create(&CNIDComparator);
-   files = btree_create(&CNIDComparator);
-   extents = btree_create(&CNIDComparator);
+void 
+restore(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f = (file*)node->value;
+   file *src = f->link != NULL ? f->link : f;
+   u_int32_t start, end;
    
-   openVolume(device, offset);
-   dumpVolumeHeader();
+   /* indirect nodes are restored through their links */
+   if (f->flags & FILE_LINKED) {
+      return;
+   }
+   
+   if (f->flags & FILE_DIRLINK) {
+      restoreDirLink(r, f);
+      return;
+   }
+   
+   if (src->flags & FILE_OUT_OF_RANGE) {
+      fprintf(stderr, "skipping file with extents past the end of the "
+            "volume: %d - %s\n", f->fileID, f->name);
+      return;
+   }
+   
+   /* files sharing blocks are likely stale, restore them last */
+   if (src->flags & FILE_OVERLAP) {
+      return;
+   }
    
-   recovery();
+   /* small files are restored later, grouped by their position */
+   if (isSmallFile(r->vol, src, &start, &end)) {
+      batch_add(r->smallFiles, start, end, f);
+   } else {
+      recoverFile(r, f);
+   }
+}
 
-   return 0;
+void 
+restoreOverlapping(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f = (file*)node->value;
+   file *src = f->link != NULL ? f->link : f;
+   
+   if ((f->flags & FILE_LINKED) == 0 
+         && (src->flags & (FILE_OVERLAP | FILE_OUT_OF_RANGE)) == FILE_OVERLAP) {
+      recoverFile(r, f);
+   }
+}
+
+void 
+planFileVersion(recoveryState *r, file *f, int superseded) {
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   int status = MANIFEST_OK;
+   int dataExtents = countForkExtents(&hfsFile->dataFork, f->dataExtents);
+   int rsrcExtents = countForkExtents(&hfsFile->resourceFork, f->rsrcExtents);
+   char *dir = f->path != NULL ? f->path : lostAndFoundPath(f);
+   char *path = concatPath(dir, f->name);
+   
+   if (dataExtents == -1 || rsrcExtents == -1) {
+      status = MANIFEST_INCONSISTENT;
+   } else if (f->flags & FILE_OUT_OF_RANGE) {
+      status = MANIFEST_OUT_OF_RANGE;
+   } else if (f->flags & FILE_OVERLAP) {
+      status = MANIFEST_OVERLAP;
+   } else if (f->flags & FILE_UNALLOCATED) {
+      status = MANIFEST_UNALLOCATED;
+   } else if (f->path == NULL) {
+      status = MANIFEST_ORPHAN;
+   }
+   
+   if (superseded) {
+      status = MANIFEST_SUPERSEDED;
+   }
+   
+   manifest_addFile(r->plan, f, path, status, dataExtents, rsrcExtents);
+   
+   if (f->path == NULL) {
+      free(dir);
+   }
+   
+   free(path);
+}
+
+void 
+planFile(btree_node *node, void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   file *f = (file*)node->value;
+   file *v;
+   
+   planFileVersion(r, f, 0);
+   
+   for (v = f->versions; v != NULL; v = v->versions) {
+      planFileVersion(r, v, 1);
+   }
+}
+
+void 
+addFolderName(btree_node *node, void *retVal) {
+   search_add(((recoveryState*)retVal)->names, ((folder*)node->value)->name, 
+         node->value, 1);
+}
+
+void 
+addFileName(btree_node *node, void *retVal) {
+   search_add(((recoveryState*)retVal)->names, ((file*)node->value)->name, 
+         node->value, 0);
+}
+
+void 
+printSearchResult(search_entry *entry) {
+   char *path, *dir;
+   
+   if (entry->isFolder) {
+      path = folderPath((folder*)entry->item);
+      printf("%14s  %s\n", "<dir>", path);
+   } else {
+      file *f = (file*)entry->item;
+      HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+      dir = f->path != NULL ? f->path : lostAndFoundPath(f);
+      path = concatPath(dir, f->name);
+      printf("%14llu  %s\n", (unsigned long long)
+            (hfsFile->dataFork.logicalSize + hfsFile->resourceFork.logicalSize),
+            path);
+      
+      if (f->path == NULL) {
+         free(dir);
+      }
+   }
+   
+   free(path);
+}
+
+void 
+search(recoveryState *r) {
+   u_int32_t found;
+   
+   r->names = search_create();
+   btree_inorderTraverseWithReturn(r->folders, &addFolderName, r);
+   btree_inorderTraverseWithReturn(r->files, &addFileName, r);
+   printf("searching for %s in %u names\n", query, r->names->count);
+   found = search_query(r->names, query, &printSearchResult);
+   printf("%u matches\n", found);
+   search_destroy(r->names);
+   r->names = NULL;
+}
+
+/* prints the data fork of a file, given by its path or CNID, through the 
+ * read api instead of the trees of the recovery
+ */
+int 
+catFile(const char *const device, u_int64_t offset) {
+   char *end, *buf = (char*)malloc(READ_CHUNK_SIZE);
+   u_int32_t cnid = (u_int32_t)strtoul(catPath, &end, 10);
+   u_int64_t pos = 0;
+   hfsvol *v;
+   hfsvol_fork *fork;
+   writer *w;
+   file *f;
+   ssize_t n;
+   int fd, ret = -1;
+   
+   /* the messages printed go to stderr from now on */
+   fflush(stdout);
+   
+   if ((fd = dup(STDOUT_FILENO)) == -1 
+         || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+      perror("dup");
+      return -1;
+   }
+   
+   if ((v = hfsvol_open(device, offset, &options)) == NULL) {
+      return -1;
+   }
+   
+   f = *end == '\0' ? hfsvol_lookupID(v, cnid) 
+      : hfsvol_lookupPath(v, catPath);
+   
+   if (f == NULL) {
+      fprintf(stderr, "no file %s on the volume\n", catPath);
+   } else if ((fork = hfsvol_openFork(v, f, 0x00)) == NULL) {
+      fprintf(stderr, "the extents of %s don't cover its data\n", catPath);
+   } else if ((w = writer_openStream(fd, 0, 0)) != NULL) {
+      while ((n = hfsvol_pread(fork, buf, READ_CHUNK_SIZE, pos)) > 0 
+            && writer_write(w, buf, n) == 0) {
+         pos += n;
+      }
+      
+      ret = writer_close(w) == 0 && pos == fork->size ? 0 : -1;
+      hfsvol_closeFork(fork);
+   }
+   
+   hfsvol_close(v);
+   free(buf);
+   close(fd);
+   return ret;
+}
+
+int 
+isDecompressed(const file *const f) {
+   const attribute *compressed = decmpfs_attribute(f);
+   return compressed != NULL && decmpfs_supported(compressed);
+}
+
+char *
+restoredPath(const recoveryState *const r, const file *const f, 
+      u_int8_t forkType) {
+   char *dir, *fullDir, *path, *rsrcPath;
+   
+   /* indirect nodes are restored under the path of their first link */
+   if (f->linkPath != NULL) {
+      path = strdup(f->linkPath);
+   } else {
+      dir = f->path != NULL ? f->path : lostAndFoundPath(f);
+      fullDir = concat(r->recoveryPath, dir);
+      path = concatPath(fullDir, f->name);
+      
+      if (f->path == NULL) {
+         free(dir);
+      }
+      
+      free(fullDir);
+   }
+   
+   /* a decompressed resource fork ends up in the data fork */
+   if (forkType == 0xFF && !isDecompressed(f)) {
+      rsrcPath = concat(path, RSRC_FORK_NAME);
+      free(path);
+      return rsrcPath;
+   }
+   
+   return path;
+}
+
+/* writes the part of a retried piece falling into an extent of a file 
+ * into the restored file. files that weren't restored are left alone.
+ */
+void 
+patchExtent(const extcheck_extent *const ext, void *retVal) {
+   rescuedPiece *piece = (rescuedPiece*)retVal;
+   HFSPlusVolume *vol = piece->r->vol;
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int64_t extStart = vol->volOffset 
+      + (u_int64_t)ext->startBlock*blockSize;
+   u_int64_t extEnd = extStart + (u_int64_t)ext->blockCount*blockSize;
+   u_int64_t start = piece->offset > extStart ? piece->offset : extStart;
+   u_int64_t end = piece->offset + piece->len;
+   u_int64_t forkOffset, size;
+   HFSPlusCatalogFile *hfsFile;
+   char *path;
+   
+   if (ext->owner == NULL) {
+      return;
+   }
+   
+   hfsFile = (HFSPlusCatalogFile*)ext->owner->hfsFile;
+   
+   /* the resource fork of a compressed file was restored decompressed */
+   if (ext->forkType == 0xFF && isDecompressed(ext->owner)) {
+      return;
+   }
+   
+   size = ext->forkType == 0xFF ? hfsFile->resourceFork.logicalSize 
+      : hfsFile->dataFork.logicalSize;
+   forkOffset = (u_int64_t)ext->forkBlock*blockSize + (start - extStart);
+   end = end < extEnd ? end : extEnd;
+   
+   if (forkOffset >= size) {
+      return;
+   }
+   
+   end = end - start < size - forkOffset ? end : start + size - forkOffset;
+   path = restoredPath(piece->r, ext->owner, ext->forkType);
+   
+   if (vol->output->patch(vol->output, path, forkOffset, 
+            piece->data + (start - piece->offset), end - start) == -1) {
+      fprintf(stderr, "unable to patch %s (errno=%d)\n", path, errno);
+   }
+   
+   free(path);
+}
+
+void 
+patchRestoredFiles(u_int64_t offset, const char *data, u_int32_t len, 
+      void *retVal) {
+   recoveryState *r = (recoveryState*)retVal;
+   u_int32_t blockSize = r->vol->volHeader.blockSize;
+   rescuedPiece piece = { r, offset, data, len };
+   u_int64_t first, last;
+   
+   if (offset < r->vol->volOffset) {
+      return;
+   }
+   
+   first = (offset - r->vol->volOffset) / blockSize;
+   last = (offset + len - 1 - r->vol->volOffset) / blockSize;
+   extcheck_owners(r->blockOwners, first, last - first + 1, &patchExtent, 
+         &piece);
+}
+
+void 
+flagDamagedFile(const extcheck_extent *const ext, void *retVal) {
+   char *path;
+   
+   if (ext->owner != NULL) {
+      path = restoredPath((recoveryState*)retVal, ext->owner, ext->forkType);
+      fprintf(stderr, "unreadable blocks zero-filled in: %s\n", path);
+      free(path);
+   }
+}
+
+void 
+saveBadRanges(recoveryState *r) {
+   if (badRangesPath != NULL) {
+      badmap_save(r->vol->badRanges, badRangesPath);
+   }
+}
+
+/* the retry passes, after everything readable has been restored. pieces 
+ * read now are written into the restored files. files that still have 
+ * holes are listed.
+ */
+void 
+rescueBadRanges(recoveryState *r) {
+   HFSPlusVolume *vol = r->vol;
+   u_int32_t blockSize = vol->volHeader.blockSize;
+   u_int64_t skipped, first, last;
+   badmap_range *ranges;
+   u_int32_t pass, count, i;
+   char status;
+   
+   saveBadRanges(r);
+   
+   for (pass = 0; pass < vol->options.retryPasses; pass++) {
+      if ((skipped = badmap_bytes(vol->badRanges, BADMAP_SKIPPED)) == 0) {
+         break;
+      }
+      
+      printf("retry pass %u: %llu bytes\n", pass + 1, 
+            (unsigned long long)skipped);
+      printf("%llu bytes recovered\n", (unsigned long long)retryBadRanges(
+               vol, pass, &patchRestoredFiles, r));
+      saveBadRanges(r);
+   }
+   
+   for (status = BADMAP_SKIPPED; status != 0; 
+         status = status == BADMAP_SKIPPED ? BADMAP_BAD : 0) {
+      ranges = badmap_copy(vol->badRanges, status, &count);
+      
+      for (i = 0; i < count; i++) {
+         if (ranges[i].offset + ranges[i].length <= vol->volOffset) {
+            continue;
+         }
+         
+         first = ranges[i].offset > vol->volOffset 
+            ? (ranges[i].offset - vol->volOffset) / blockSize : 0;
+         last = (ranges[i].offset + ranges[i].length - 1 - vol->volOffset) 
+            / blockSize;
+         extcheck_owners(r->blockOwners, first, last - first + 1, 
+               &flagDamagedFile, r);
+      }
+      
+      free(ranges);
+   }
+}
+
+void 
+carveLostFiles(recoveryState *r) {
+   HFSPlusVolume *vol = r->vol;
+   char *lost = concat(r->recoveryPath, lostPath);
+   char *dir = concatPath(lost, "carved");
+   sigcarve *c;
+   
+   if (vol->output->makeDirectory(vol->output, dir) != 0) {
+      fprintf(stderr, "couldn't create path (errno=%d): %s\n", errno, dir);
+      free(lost);
+      free(dir);
+      return;
+   }
+   
+   c = sigcarve_create(vol, dir);
+   
+   /* only the free space, unless there is no allocation bitmap */
+   if (vol->allocation != NULL && !carveAllBlocks) {
+      printf("carving files from %u free blocks...\n", 
+            vol->allocation->totalBlocks - vol->allocation->allocated);
+      bitmap_freeRanges(vol->allocation, &sigcarve_range, c);
+   } else {
+      printf("carving files from all %u blocks...\n", 
+            vol->volHeader.totalBlocks);
+      sigcarve_range(0, vol->volHeader.totalBlocks, c);
+   }
+   
+   printf("%llu files carved, %llu bytes, %llu without a footer discarded\n", 
+         (unsigned long long)c->carved, (unsigned long long)c->bytes, 
+         (unsigned long long)c->discarded);
+   sigcarve_destroy(c);
+   free(lost);
+   free(dir);
+}
+
+/* parses the volume and restores it, or only writes the plan or searches 
+ * it. returns -1 if its catalog couldn't be read or the restored files 
+ * couldn't be written.
+ */
+int 
+recovery(recoveryState *r) {
+   HFSPlusVolume *vol = r->vol;
+   int ret = 0;
+   
+   if (indexPath != NULL && catindex_load(vol, indexPath, r->folders, 
+            r->files, r->extents) == 0) {
+      printf("loaded catalog index from %s\n", indexPath);
+      r->indexed = 1;
+   } else if (vol->options.scanFlags & SCAN_CARVE) {
+      printf("carving catalog and extents nodes from the device\n");
+      
+      if (carveBTrees(vol, &folderAndFileRecordFilter, 
+               &addFolderAndFileRecord, &addExtentRecord, r) == -1) {
+         return -1;
+      }
+      
+      if (indexPath != NULL) {
+         printf("saving catalog index to %s\n", indexPath);
+         catindex_save(vol, indexPath, r->folders, r->files, r->extents);
+      }
+   } else {
+      printf("building folder and file tree from catalog\n");
+      
+      if (sequentiallyReadCatalog(vol, &folderAndFileRecordFilter, 
+               &addFolderAndFileRecord, r) == -1) {
+         return -1;
+      }
+      
+      printf("building tree from extent overflow file\n");
+      
+      if (sequentiallyReadExtents(vol, &addExtentRecord, r) == -1) {
+         return -1;
+      }
+      
+      if (indexPath != NULL) {
+         printf("saving catalog index to %s\n", indexPath);
+         catindex_save(vol, indexPath, r->folders, r->files, r->extents);
+      }
+   }
+   
+   printf("node count in folder tree: %d\n", r->folders->nodeCount);
+   printf("node count in file tree: %d\n", r->files->nodeCount);
+   printf("node count in extent overflow tree: %d\n", r->extents->nodeCount);
+   printf("link all folders to their parents\n");
+   btree_inorderTraverseWithReturn(r->folders, &linkFolderToParent, r);
+   printf("link all files to their parent folders\n");
+   btree_inorderTraverseWithReturn(r->files, &linkFilesToParent, r);
+   printf("determine path of files\n");
+   btree_inorderTraverseWithReturn(r->files, &buildPath, r);
+   printf("resolving hard links\n");
+   resolveHardLinks(r);
+   
+   if (query != NULL) {
+      search(r);
+      return 0;
+   }
+   
+   printf("linking overflow extents to files\n");
+   btree_inorderTraverseWithReturn(r->extents, &linkExtentsToFile, r);
+   
+   printf("reading attributes file\n");
+   
+   if (sequentiallyReadAttributes(vol, &addAttributeRecord, r) == -1) {
+      printf("no attributes, compressed files keep their resource forks\n");
+   } else {
+      printf("%llu attributes, %llu stored in forks\n", 
+            (unsigned long long)r->attributeCount, 
+            (unsigned long long)r->attributeForks);
+      loadAttributeForks(r);
+   }
+   
+   printf("loading allocation bitmap\n");
+   loadAllocationBitmap(r);
+   
+   printf("checking extents for overlaps\n");
+   checkExtents(r);
+   
+   if (planPath != NULL) {
+      printf("writing restore plan to %s\n", planPath);
+      
+      if ((r->plan = manifest_open(planPath, planFormat)) == NULL) {
+         return -1;
+      }
+      
+      r->plan->folders = r->folders->nodeCount;
+      r->plan->orphanFolders = r->orphanFolders;
+      btree_inorderTraverseWithReturn(r->files, &planFile, r);
+      printf("%llu files, %llu bytes in data forks, %llu bytes in resource "
+            "forks\n", r->plan->files, r->plan->dataBytes, 
+            r->plan->rsrcBytes);
+      manifest_close(r->plan);
+      r->plan = NULL;
+      printf("finished\n");
+      return 0;
+   }
+   
+   if (digestPath != NULL && (vol->digests = digest_open(digestPath, 
+               r->recoveryPath)) == NULL) {
+      return -1;
+   }
+   
+   printf("restoring files...\n");
+   gettimeofday(&vol->output->start, NULL);
+   btree_inorderTraverseWithReturn(r->files, &restore, r);
+   printf("restoring %d small files in batches...\n", r->smallFiles->count);
+   batch_run(r->smallFiles, vol, &restoreBatched, r);
+   
+   if (!skipOverlapping && r->overlappingFiles > 0) {
+      printf("restoring %llu files with overlapping extents...\n", 
+            (unsigned long long)r->overlappingFiles);
+      btree_inorderTraverseWithReturn(r->files, &restoreOverlapping, r);
+   }
+   
+   if (vol->holeBytes > 0 || badRangesPath != NULL) {
+      rescueBadRanges(r);
+   }
+   
+   if (carveFiles) {
+      carveLostFiles(r);
+      saveBadRanges(r);
+   }
+   
+   if (vol->digests != NULL) {
+      digest_close(vol->digests);
+      vol->digests = NULL;
+   }
+   
+   if (sink_close(vol->output) == -1) {
+      ret = -1;
+   }
+   
+   vol->output = NULL;
+   
+   if (watchdog_timeouts(vol->watchdog) > 0) {
+      printf("%llu reads timed out\n", 
+            (unsigned long long)watchdog_timeouts(vol->watchdog));
+   }
+   
+   printf("finished\n");
+   return ret;
+}
+
+void 
+freeFolder(btree_node *node) {
+   folder *fldr = (folder*)node->value;
+   free(fldr->name);
+   free(fldr);
+}
+
+void 
+freeExtentList(orderedlist *list) {
+   ol_node *n, *next;
+   
+   for (n = list->head; n != NULL; n = next) {
+      next = n->next;
+      free(n->key);
+      free(n->value);
+      ol_destroy_node(n);
+   }
+   
+   free(list);
+}
+
+void 
+freeFile(btree_node *node) {
+   file *f, *next;
+   attribute *attr, *nextAttr;
+   
+   for (f = (file*)node->value; f != NULL; f = next) {
+      next = f->versions;
+      
+      for (attr = f->attributes; attr != NULL; attr = nextAttr) {
+         nextAttr = attr->next;
+         
+         if (attr->extents != NULL) {
+            freeExtentList(attr->extents);
+         }
+         
+         free(attr->name);
+         free(attr->data);
+         free(attr->fork);
+         free(attr);
+      }
+      
+      free(f->name);
+      free(f->path);
+      free(f->linkPath);
+      free(f->hfsFile);
+      free(f);
+   }
+}
+
+void 
+freeExtents(btree_node *node) {
+   freeExtentList((orderedlist*)node->value);
+   free(node->key);
+}
+
+void 
+freeKey(btree_node *node) {
+   free(node->key);
+}
+
+/* frees the trees and closes the volume. records loaded from an index 
+ * belong to its mapping.
+ */
+void 
+releaseRecovery(recoveryState *r) {
+   if (!r->indexed) {
+      btree_inorderTraverse(r->folders, &freeFolder);
+      btree_inorderTraverse(r->files, &freeFile);
+      btree_inorderTraverse(r->extents, &freeExtents);
+   }
+   
+   if (r->indirectFiles != NULL) {
+      btree_inorderTraverse(r->indirectFiles, &freeKey);
+      btree_inorderTraverse(r->indirectFolders, &freeKey);
+      btree_destroy(r->indirectFiles);
+      btree_destroy(r->indirectFolders);
+   }
+   
+   if (r->blockOwners != NULL) {
+      extcheck_destroy(r->blockOwners);
+   }
+   
+   btree_destroy(r->folders);
+   btree_destroy(r->files);
+   btree_destroy(r->extents);
+   batch_destroy(r->smallFiles);
+   closeVolume(r->vol);
+   free(r);
+}
+
+/* the sink the restored files are written to, NULL if it can't be opened */
+sink *
+createSink() {
+   if (archivePath != NULL) {
+      return sink_tar(archivePath, options.writerFlags, archiveLevel);
+   } else if (discardOutput) {
+      return sink_null(options.writerFlags);
+   }
+   
+   return sink_fs(options.writerFlags);
+}
+
+/* opens a volume and recovers it into the sink, which may be NULL when 
+ * nothing is restored. the sink and the bad ranges belong to the volume. 
+ * returns -1 if the volume couldn't be opened or recovered.
+ */
+int 
+recoverVolume(const char *const device, u_int64_t offset, 
+      char *recoveryPath, sink *output, badmap *badRanges) {
+   HFSPlusRecoveryOptions volOptions = options;
+   HFSPlusVolume *vol;
+   recoveryState *r;
+   int ret;
+   
+   /* entries in an archive can't be patched by the retry passes */
+   if (output != NULL && output->patch == NULL) {
+      volOptions.retryPasses = 0;
+   }
+   
+   if ((vol = openVolume(device, offset, &volOptions, badRanges)) == NULL) {
+      if (output != NULL) {
+         sink_close(output);
+      }
+      
+      return -1;
+   }
+   
+   vol->output = output;
+   dumpVolumeHeader(vol);
+   
+   r = (recoveryState*)calloc(1, sizeof(recoveryState));
+   r->vol = vol;
+   r->recoveryPath = recoveryPath;
+   r->folders = btree_create(&CNIDComparator);
+   r->files = btree_create(&CNIDComparator);
+   r->extents = btree_create(&extentKeyComparator);
+   r->smallFiles = batch_create();
+   
+   ret = recovery(r);
+   
+   /* a recovery that failed early leaves the sink open */
+   if (vol->output != NULL && sink_close(vol->output) == -1) {
+      ret = -1;
+   }
+   
+   releaseRecovery(r);
+   return ret;
+}
+
+/* a line of the list of the batch mode */
+typedef struct {
+   char *device;
+   char *recoveryPath;
+   u_int64_t offset;
+   int failed;
+} volumeJob;
+
+/* a task of the pool, the messages of the volumes restored at the same 
+ * time are interleaved
+ */
+void 
+recoverListedVolume(void *arg) {
+   volumeJob *job = (volumeJob*)arg;
+   badmap *badRanges;
+   sink *output;
+   
+   printf("restoring %s to %s\n", job->device, job->recoveryPath);
+   
+   if ((badRanges = badmap_load(NULL)) == NULL) {
+      job->failed = 1;
+   } else if ((output = createSink()) == NULL) {
+      badmap_destroy(badRanges);
+      job->failed = 1;
+   } else {
+      job->failed = recoverVolume(job->device, job->offset, 
+            job->recoveryPath, output, badRanges) == -1;
+   }
+   
+   printf("%s %s\n", job->failed ? "failed to restore" : "restored", 
+         job->device);
+}
+
+/* restores the volumes of a list with lines of <device> <recovery-path> 
+ * [<offset>], up to concurrentJobs at a time. blank lines and lines 
+ * starting with # are skipped. returns the number of volumes that failed, 
+ * -1 if the list couldn't be read.
+ */
+int 
+recoverBatch(const char *const listPath) {
+   volumeJob *jobList = NULL;
+   u_int32_t count = 0, size = 0, i;
+   char line[4096], *device, *path, *offset, *last, *cwd;
+   int lineNum = 0, failed = 0;
+   FILE *list;
+   pool *p;
+   
+   if ((list = fopen(listPath, "r")) == NULL) {
+      perror("fopen");
+      return -1;
+   }
+   
+   while (fgets(line, sizeof(line), list) != NULL) {
+      lineNum++;
+      
+      if ((device = strtok_r(line, " \t\r\n", &last)) == NULL 
+            || *device == '#') {
+         continue;
+      }
+      
+      if ((path = strtok_r(NULL, " \t\r\n", &last)) == NULL) {
+         fprintf(stderr, "%s:%d: no recovery path\n", listPath, lineNum);
+         failed = -1;
+         break;
+      }
+      
+      offset = strtok_r(NULL, " \t\r\n", &last);
+      
+      if (count == size) {
+         size = size == 0 ? 16 : size*2;
+         
+         if ((jobList = (volumeJob*)realloc(jobList, 
+                     size*sizeof(volumeJob))) == NULL) {
+            perror("realloc");
+            exit(1);
+         }
+      }
+      
+      if (*path != '/') {
+         if ((cwd = getcwd(NULL, 0)) == NULL) {
+            perror("getcwd");
+            failed = -1;
+            break;
+         }
+         
+         jobList[count].recoveryPath = concatPath(cwd, path);
+         free(cwd);
+      } else {
+         jobList[count].recoveryPath = strdup(path);
+      }
+      
+      jobList[count].device = strdup(device);
+      
+      jobList[count].offset = offset != NULL ? atoll(offset) : 0;
+      jobList[count].failed = 0;
+      count++;
+   }
+   
+   fclose(list);
+   
+   if (failed == 0) {
+      printf("restoring %u volumes, %d at a time\n", count, concurrentJobs);
+      p = pool_create(concurrentJobs);
+      
+      for (i = 0; i < count; i++) {
+         pool_submit(p, &recoverListedVolume, &jobList[i]);
+      }
+      
+      pool_destroy(p);
+      
+      for (i = 0; i < count; i++) {
+         failed += jobList[i].failed;
+      }
+      
+      printf("%u of %u volumes restored\n", count - failed, count);
+   }
+   
+   for (i = 0; i < count; i++) {
+      free(jobList[i].device);
+      free(jobList[i].recoveryPath);
+   }
+   
+   free(jobList);
+   return failed;
+}
+
+void 
+usage(const char *const name) {
+   fprintf(stderr, "usage: %s [-W] [-D] [-e] [-R] [-S <size>] [-P <plan> [-c]] "
+         "[-I <index>] [-H <digests> [-s]] [-O] [-F] [-C [-b <size>]] "
+         "[-X [-A]] [-M <map>] [-r <passes>] [-T <seconds>] [-J] "
+         "[-t <archive> [-z <level>] | -n] <device> "
+         "<recovery-path> [<offset>]\n", name);
+   fprintf(stderr, "       %s [-I <index>] -q <pattern> <device> [<offset>]\n", 
+         name);
+   fprintf(stderr, "       %s -x <path> <device> [<offset>]\n", name);
+   fprintf(stderr, "       %s -V <digests> <recovery-path>\n", name);
+   fprintf(stderr, "       %s [-W] [-D] [-e] [-R] [-S <size>] [-O] [-F] "
+         "[-C [-b <size>]] [-X [-A]] [-r <passes>] [-T <seconds>] [-J] [-n] "
+         "[-j <jobs>] -B <list>\n", name);
+   fprintf(stderr, "  -W  write-behind: flush and drop restored data from "
+         "the page cache\n");
+   fprintf(stderr, "  -D  write restored data with direct i/o\n");
+   fprintf(stderr, "  -e  leave blocks of zeros as holes in restored files\n");
+   fprintf(stderr, "  -R  read file data from the device with direct i/o\n");
+   fprintf(stderr, "  -S  files up to this size are read in batches "
+         "(default %d, 0 disables)\n", DEFAULT_SMALL_FILE_SIZE);
+   fprintf(stderr, "  -P  don't restore, write a manifest of all files "
+         "as JSON lines\n");
+   fprintf(stderr, "  -c  write the manifest as CSV\n");
+   fprintf(stderr, "  -I  load the parsed catalog from this index file or "
+         "create it\n");
+   fprintf(stderr, "  -q  list files and folders whose name contains the "
+         "pattern or matches it as a glob\n");
+   fprintf(stderr, "  -H  hash restored forks with xxh64 and write the "
+         "digests to this file\n");
+   fprintf(stderr, "  -s  also hash with sha-256\n");
+   fprintf(stderr, "  -O  don't restore files sharing blocks with other "
+         "files\n");
+   fprintf(stderr, "  -F  also scan catalog and extents nodes marked as "
+         "free (deep recovery)\n");
+   fprintf(stderr, "  -C  carve catalog and extents nodes from the whole "
+         "device\n");
+   fprintf(stderr, "  -b  block size if the volume header is lost "
+         "(default %d)\n", DEFAULT_CARVE_BLOCK_SIZE);
+   fprintf(stderr, "  -X  carve jpeg, png, pdf, zip and quicktime files "
+         "from free blocks\n");
+   fprintf(stderr, "  -A  carve from all blocks, not only the free ones\n");
+   fprintf(stderr, "  -M  keep the ranges that couldn't be read in this "
+         "map file\n");
+   fprintf(stderr, "  -r  number of retry passes over unreadable ranges "
+         "(default and maximum %d)\n", RETRY_PASSES);
+   fprintf(stderr, "  -T  give up on reads that take longer than this "
+         "(default 0, no limit)\n");
+   fprintf(stderr, "  -J  ignore the transactions in the journal\n");
+   fprintf(stderr, "  -t  write the files to this pax archive instead, "
+         "- for stdout\n");
+   fprintf(stderr, "  -z  compress the archive with zstd at this level, "
+         "1 to %d\n", ZSTREAM_MAX_LEVEL);
+   fprintf(stderr, "  -n  read the files but discard their data, to measure "
+         "the read throughput\n");
+   fprintf(stderr, "  -x  print the data of the file with this path below "
+         "the root folder, or this CNID, to stdout\n");
+   fprintf(stderr, "  -V  re-hash a restored tree and compare it against "
+         "the digests\n");
+   fprintf(stderr, "  -B  restore the volumes listed in this file, one "
+         "<device> <recovery-path> [<offset>] per line\n");
+   fprintf(stderr, "  -j  number of volumes of the list restored at the "
+         "same time (default %d)\n", DEFAULT_JOBS);
+   exit(1);
+}
+
+int 
+main (int argc, const char * argv[]) {
+   const char *name = argv[0];
+   int ch;
+   
+   options.smallFileSize = DEFAULT_SMALL_FILE_SIZE;
+   options.carveBlockSize = DEFAULT_CARVE_BLOCK_SIZE;
+   options.retryPasses = RETRY_PASSES;
+
+   while ((ch = getopt(argc, (char *const *)argv, "WDeRS:P:cI:q:H:sOFCb:XAM:r:T:Jt:z:nx:V:B:j:")) != -1) {
+      switch (ch) {
+         case 'W':
+            options.writerFlags |= WRITER_WRITE_BEHIND;
+            break;
+         case 'D':
+            options.writerFlags |= WRITER_DIRECT;
+            break;
+         case 'e':
+            options.writerFlags |= WRITER_SPARSE;
+            break;
+         case 'R':
+            options.readFlags |= READ_DIRECT;
+            break;
+         case 'S':
+            options.smallFileSize = atoll(optarg);
+            break;
+         case 'P':
+            planPath = optarg;
+            break;
+         case 'c':
+            planFormat = MANIFEST_CSV;
+            break;
+         case 'I':
+            indexPath = optarg;
+            break;
+         case 'q':
+            query = optarg;
+            break;
+         case 'H':
+            digestPath = optarg;
+            options.writerFlags |= WRITER_HASH_XXH64;
+            break;
+         case 's':
+            options.writerFlags |= WRITER_HASH_SHA256;
+            break;
+         case 'O':
+            skipOverlapping = 1;
+            break;
+         case 'F':
+            options.scanFlags |= SCAN_FREE_NODES;
+            break;
+         case 'C':
+            options.scanFlags |= SCAN_CARVE;
+            break;
+         case 'b':
+            options.carveBlockSize = atoi(optarg);
+            break;
+         case 'X':
+            carveFiles = 1;
+            break;
+         case 'A':
+            carveAllBlocks = 1;
+            break;
+         case 'M':
+            badRangesPath = optarg;
+            break;
+         case 'r':
+            options.retryPasses = atoi(optarg);
+            break;
+         case 'T':
+            options.readTimeout = atoi(optarg)*1000;
+            break;
+         case 'J':
+            options.readFlags |= READ_NO_JOURNAL;
+            break;
+         case 't':
+            archivePath = optarg;
+            break;
+         case 'z':
+            archiveLevel = atoi(optarg);
+            break;
+         case 'n':
+            discardOutput = 1;
+            break;
+         case 'x':
+            catPath = optarg;
+            break;
+         case 'V':
+            verifyPath = optarg;
+            break;
+         case 'B':
+            batchPath = optarg;
+            break;
+         case 'j':
+            concurrentJobs = atoi(optarg);
+            break;
+         default:
+            usage(name);
+      }
+   }
+   
+   argc -= optind;
+   argv += optind;
+   
+   if (options.retryPasses > RETRY_PASSES || options.carveBlockSize < 512 
+         || (options.carveBlockSize & (options.carveBlockSize - 1)) != 0 
+         || archivePath != NULL && (discardOutput || planPath != NULL 
+            || query != NULL) 
+         || archiveLevel != 0 && (archivePath == NULL || archiveLevel < 1 
+            || archiveLevel > ZSTREAM_MAX_LEVEL) 
+         || (options.writerFlags & WRITER_HASH_SHA256) && digestPath == NULL 
+         || concurrentJobs < 1) {
+      usage(name);
+   }
+   
+   /* the files written per run can't be shared by the volumes of a list */
+   if (batchPath != NULL) {
+      if (argc != 0 || planPath != NULL || indexPath != NULL 
+            || query != NULL || digestPath != NULL || badRangesPath != NULL 
+            || archivePath != NULL || catPath != NULL || verifyPath != NULL) {
+         usage(name);
+      }
+      
+      return recoverBatch(batchPath) == 0 ? 0 : 1;
+   }
+   
+
+   /* verifying only reads the restored tree, there is no device */
+   if (verifyPath != NULL) {
+      if (argc != 1) {
+         usage(name);
+      }
+      
+      return digest_verify(verifyPath, argv[0]) == 0 ? 0 : 1;
+   }
+   
+   /* printing a file reads nothing but the catalog and extents files */
+   if (catPath != NULL) {
+      if (argc < 1 || argc > 2 || query != NULL || archivePath != NULL) {
+         usage(name);
+      }
+      
+      return catFile(argv[0], argc == 2 ? atoll(argv[1]) : 0) == 0 ? 0 : 1;
+   }
+
+   if (query != NULL) {
+      /* searching doesn't restore anything, so there is no recovery path */
+      if (argc < 1 || argc > 2) {
+         usage(name);
+      }
+   } else if (argc < 2 || argc > 3) {
+      usage(name);
+   }
+   
+   char *device = (char *)argv[0];
+   char *recoveryPath;
+   u_int64_t offset;
+   badmap *badRanges;
+   sink *output = NULL;
+
+   if (query != NULL) {
+      recoveryPath = NULL;
+      offset = argc == 2 ? atoll(argv[1]) : 0;
+   } else {
+      /* in an archive the paths are relative to the recovery path */
+      if (*(char *)argv[1] != '/' && archivePath == NULL) {
+         char *cwd = getcwd(NULL, 0);
+         
+         if (cwd == NULL) {
+            perror("getcwd");
+            exit(1);
+         }
+         
+         recoveryPath = concatPath(cwd, (char *)argv[1]);
+         free(cwd);
+      } else {
+         recoveryPath = (char *)argv[1];
+      }
+      
+      offset = argc == 3 ? atoll(argv[2]) : 0;
+   }
+
+   /* opened first, an archive written to stdout moves the messages away */
+   if (query == NULL && (output = createSink()) == NULL) {
+      exit(1);
+   }
+   
+   if ((badRanges = badmap_load(badRangesPath)) == NULL) {
+      exit(1);
+   }
+   
+   return recoverVolume(device, offset, recoveryPath, output, badRanges) == 0 
+      ? 0 : 1;
 }
@@ -0,0 +1,173 @@
+/*
+ *  manifest.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "manifest.h"
+
+static const char *const statusNames[] = { "ok", "orphan", "inconsistent", 
+   "overlap", "out_of_range", "unallocated", "superseded" };
+
+manifest *
+manifest_open(const char *const fileName, int format) {
+   manifest *m = (manifest*)calloc(1, sizeof(manifest));
+   
+   if ((m->out = fopen(fileName, "w")) == NULL) {
+      perror("fopen");
+      free(m);
+      return NULL;
+   }
+   
+   m->format = format;
+   
+   if (format == MANIFEST_CSV) {
+      fprintf(m->out, "cnid,parent,status,data_size,rsrc_size,"
+            "data_extents,rsrc_extents,source,node,path\n");
+   }
+   
+   return m;
+}
+
+static void 
+manifest_writeJSONString(FILE *out, const char *str) {
+   fputc('"', out);
+   
+   for (; *str != '\0'; str++) {
+      unsigned char c = (unsigned char)*str;
+      
+      if (c == '"' || c == '\\') {
+         fputc('\\', out);
+         fputc(c, out);
+      } else if (c < 0x20 || c >= 0x7f) {
+         fprintf(out, "\\u%04x", c);
+      } else {
+         fputc(c, out);
+      }
+   }
+   
+   fputc('"', out);
+}
+
+static void 
+manifest_writeCSVString(FILE *out, const char *str) {
+   if (strpbrk(str, ",\"\r\n") == NULL) {
+      fputs(str, out);
+      return;
+   }
+   
+   fputc('"', out);
+   
+   for (; *str != '\0'; str++) {
+      if (*str == '"') {
+         fputc('"', out);
+      }
+      fputc(*str, out);
+   }
+   
+   fputc('"', out);
+}
+
+static void 
+manifest_count(manifest *m, const file *const f, int status, 
+      int dataExtents, int rsrcExtents) {
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   
+   m->files++;
+   m->dataBytes += hfsFile->dataFork.logicalSize;
+   m->rsrcBytes += hfsFile->resourceFork.logicalSize;
+   m->extents += (dataExtents > 0 ? dataExtents : 0) 
+      + (rsrcExtents > 0 ? rsrcExtents : 0);
+   
+   if (status == MANIFEST_ORPHAN) {
+      m->orphanFiles++;
+   } else if (status == MANIFEST_INCONSISTENT) {
+      m->inconsistent++;
+   } else if (status == MANIFEST_OVERLAP) {
+      m->overlapping++;
+   } else if (status == MANIFEST_OUT_OF_RANGE) {
+      m->outOfRange++;
+   } else if (status == MANIFEST_UNALLOCATED) {
+      m->unallocated++;
+   }
+}
+
+void 
+manifest_addFile(manifest *m, const file *const f, const char *const path, 
+      int status, int dataExtents, int rsrcExtents) {
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   const char *source = f->flags & FILE_STALE ? "free" : "live";
+   
+   /* other versions of a file are listed but not counted */
+   if (status == MANIFEST_SUPERSEDED) {
+      m->superseded++;
+   } else {
+      manifest_count(m, f, status, dataExtents, rsrcExtents);
+   }
+   
+   if (m->format == MANIFEST_CSV) {
+      fprintf(m->out, "%u,%u,%s,%llu,%llu,%d,%d,%s,%u,", f->fileID, 
+            f->parentID, statusNames[status], 
+            (unsigned long long)hfsFile->dataFork.logicalSize, 
+            (unsigned long long)hfsFile->resourceFork.logicalSize, 
+            dataExtents, rsrcExtents, source, f->node);
+      manifest_writeCSVString(m->out, path);
+      fputc('\n', m->out);
+   } else {
+      fprintf(m->out, "{\"cnid\":%u,\"parent\":%u,\"status\":\"%s\","
+            "\"data_size\":%llu,\"rsrc_size\":%llu,"
+            "\"data_extents\":%d,\"rsrc_extents\":%d,\"source\":\"%s\","
+            "\"node\":%u,\"path\":", 
+            f->fileID, f->parentID, statusNames[status], 
+            (unsigned long long)hfsFile->dataFork.logicalSize, 
+            (unsigned long long)hfsFile->resourceFork.logicalSize, 
+            dataExtents, rsrcExtents, source, f->node);
+      manifest_writeJSONString(m->out, path);
+      fputs("}\n", m->out);
+   }
+}
+
+void 
+manifest_close(manifest *m) {
+   const char *fmt = m->format == MANIFEST_CSV
+      ? "# totals: files=%llu folders=%llu orphan_files=%llu "
+        "orphan_folders=%llu inconsistent=%llu overlap=%llu "
+        "out_of_range=%llu unallocated=%llu superseded=%llu data_bytes=%llu "
+        "rsrc_bytes=%llu extents=%llu\n"
+      : "{\"totals\":{\"files\":%llu,\"folders\":%llu,\"orphan_files\":%llu,"
+        "\"orphan_folders\":%llu,\"inconsistent\":%llu,\"overlap\":%llu,"
+        "\"out_of_range\":%llu,\"unallocated\":%llu,\"superseded\":%llu,"
+        "\"data_bytes\":%llu,\"rsrc_bytes\":%llu,\"extents\":%llu}}\n";
+   
+   fprintf(m->out, fmt, m->files, m->folders, m->orphanFiles, 
+         m->orphanFolders, m->inconsistent, m->overlapping, m->outOfRange, 
+         m->unallocated, m->superseded, m->dataBytes, m->rsrcBytes, m->extents);
+   
+   if (fclose(m->out) != 0) {
+      perror("fclose");
+   }
+   
+   free(m);
+}
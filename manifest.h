@@ -0,0 +1,72 @@
+/*
+ *  manifest.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "definitions.h"
+
+#ifndef __MANIFEST_H_
+#define __MANIFEST_H_
+
+#define MANIFEST_JSON 0
+#define MANIFEST_CSV  1
+
+#define MANIFEST_OK           0
+#define MANIFEST_ORPHAN       1
+#define MANIFEST_INCONSISTENT 2
+#define MANIFEST_OVERLAP      3
+#define MANIFEST_OUT_OF_RANGE 4
+#define MANIFEST_UNALLOCATED  5
+#define MANIFEST_SUPERSEDED   6
+
+typedef struct {
+   FILE *out;
+   int format;
+   u_int64_t files;
+   u_int64_t folders;
+   u_int64_t orphanFiles;
+   u_int64_t orphanFolders;
+   u_int64_t inconsistent;
+   u_int64_t overlapping;
+   u_int64_t outOfRange;
+   u_int64_t unallocated;
+   u_int64_t superseded;
+   u_int64_t dataBytes;
+   u_int64_t rsrcBytes;
+   u_int64_t extents;
+} manifest;
+
+manifest *
+manifest_open(const char *const fileName, int format);
+
+void 
+manifest_addFile(manifest *m, const file *const f, const char *const path, 
+      int status, int dataExtents, int rsrcExtents);
+
+void 
+manifest_close(manifest *m);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ *  pool.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "pool.h"
+
+static void *
+pool_worker(void *arg) {
+   pool *p = (pool*)arg;
+   pool_task *task;
+   
+   for (;;) {
+      pthread_mutex_lock(&p->lock);
+      
+      while (p->head == NULL && !p->closing) {
+         pthread_cond_wait(&p->ready, &p->lock);
+      }
+      
+      if ((task = p->head) == NULL) {
+         pthread_mutex_unlock(&p->lock);
+         break;
+      }
+      
+      if ((p->head = task->next) == NULL) {
+         p->tail = NULL;
+      }
+      
+      pthread_mutex_unlock(&p->lock);
+      (*task->run)(task->arg);
+      free(task);
+   }
+   
+   return NULL;
+}
+
+pool *
+pool_create(int threads) {
+   pool *p = (pool*)calloc(1, sizeof(pool));
+   
+   p->threads = (pthread_t*)malloc(threads*sizeof(pthread_t));
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->ready, NULL);
+   
+   for (; p->threadCount < threads; p->threadCount++) {
+      if (pthread_create(&p->threads[p->threadCount], NULL, &pool_worker, p) 
+            != 0) {
+         perror("pthread_create");
+         break;
+      }
+   }
+   
+   return p;
+}
+
+void 
+pool_submit(pool *p, void(*run)(void *arg), void *arg) {
+   pool_task *task;
+   
+   if (p->threadCount == 0) {
+      (*run)(arg);
+      return;
+   }
+   
+   task = (pool_task*)malloc(sizeof(pool_task));
+   task->run = run;
+   task->arg = arg;
+   task->next = NULL;
+   
+   pthread_mutex_lock(&p->lock);
+   
+   if (p->tail != NULL) {
+      p->tail->next = task;
+   } else {
+      p->head = task;
+   }
+   
+   p->tail = task;
+   pthread_cond_signal(&p->ready);
+   pthread_mutex_unlock(&p->lock);
+}
+
+/* waits until all submitted tasks have run */
+void 
+pool_destroy(pool *p) {
+   int t;
+   
+   pthread_mutex_lock(&p->lock);
+   p->closing = 1;
+   pthread_cond_broadcast(&p->ready);
+   pthread_mutex_unlock(&p->lock);
+   
+   for (t = 0; t < p->threadCount; t++) {
+      pthread_join(p->threads[t], NULL);
+   }
+   
+   pthread_cond_destroy(&p->ready);
+   pthread_mutex_destroy(&p->lock);
+   free(p->threads);
+   free(p);
+}
@@ -31,10 +31,12 @@
 
 #include "rec_handler.h"
 #include "util.h"
+#include "io.h"
 
 
 void 
-dumpRecordType(HFSPlusCatalogKey *key, sint16 recType, void *record) {
+dumpRecordType(HFSPlusCatalogKey *key, sint16 recType, void *record, 
+      void *retVal) {
    char *kind;
       
    switch (recType) {
@@ -58,7 +60,8 @@ dumpRecordType(HFSPlusCatalogKey *key, sint16 recType, void *record) {
 }
 
 void 
-dumpRecord(HFSPlusCatalogKey *key, sint16 recType, void *record) {
+dumpRecord(HFSPlusCatalogKey *key, sint16 recType, void *record, 
+      void *retVal) {
    char *name = HFSUniStr255ToCString(&key->nodeName);
          
    printf("%d %s:\n", key->parentID, name);
@@ -82,7 +85,8 @@ dumpRecord(HFSPlusCatalogKey *key, sint16 recType, void *record) {
 }
 
 void 
-fileRecordDump(HFSPlusCatalogKey *key, sint16 recType, void *file) {
+fileRecordDump(HFSPlusCatalogKey *key, sint16 recType, void *file, 
+      void *retVal) {
    char *fileName = HFSUniStr255ToCString(&key->nodeName);
    file = (HFSPlusCatalogFile*)file;
    printf("%s:\n", fileName);
@@ -90,7 +94,8 @@ fileRecordDump(HFSPlusCatalogKey *key, sint16 recType, void *file) {
 }
 
 void 
-fileRecordHandler(HFSPlusCatalogKey *key, sint16 recType, void *file) {
+fileRecordHandler(HFSPlusCatalogKey *key, sint16 recType, void *file, 
+      void *retVal) {
    char *fileName = HFSUniStr255ToCString(&key->nodeName);
    printf("%s:\n", fileName);
    dumpFile(file);
@@ -102,7 +107,7 @@ fileRecordHandler(HFSPlusCatalogKey *key, sint16 recType, void *file) {
    HFSCatalogNodeID id = ((HFSPlusCatalogFile*)file)->fileID;
    printf("%lx: %s\n", id, dstFileName);
    
-   copyFile(file, dstFileName);
+   copyFile((HFSPlusVolume*)retVal, file, dstFileName);
    free(fileName);
    free(dstFileName);
 }
@@ -32,13 +32,17 @@
 #include <CoreServices/CoreServices.h>
 
 void 
-dumpRecordType(HFSPlusCatalogKey *key, sint16 recType, void *record);
+dumpRecordType(HFSPlusCatalogKey *key, sint16 recType, void *record, 
+      void *retVal);
 
 void 
-dumpRecord(HFSPlusCatalogKey *key, sint16 recType, void *record);
+dumpRecord(HFSPlusCatalogKey *key, sint16 recType, void *record, 
+      void *retVal);
 
 void 
-fileRecordDump(HFSPlusCatalogKey *key, sint16 recType, void *file);
+fileRecordDump(HFSPlusCatalogKey *key, sint16 recType, void *file, 
+      void *retVal);
 
 void 
-fileRecordHandler(HFSPlusCatalogKey *key, sint16 recType, void *file);
+fileRecordHandler(HFSPlusCatalogKey *key, sint16 recType, void *file, 
+      void *retVal);
@@ -0,0 +1,91 @@
+/*
+ *  search.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <fnmatch.h>
+#include "search.h"
+
+search_index *
+search_create() {
+   search_index *idx = (search_index*)calloc(1, sizeof(search_index));
+   idx->size = 1024;
+   idx->entries = (search_entry*)malloc(idx->size*sizeof(search_entry));
+   return idx;
+}
+
+void 
+search_add(search_index *idx, const char *const name, void *item, 
+      int isFolder) {
+   if (idx->count == idx->size) {
+      if ((idx->entries = (search_entry*)realloc(idx->entries, 
+                  (idx->size *= 2)*sizeof(search_entry))) == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   idx->entries[idx->count].name = name;
+   idx->entries[idx->count].item = item;
+   idx->entries[idx->count].isFolder = isFolder;
+   idx->count++;
+}
+
+/* the names belong to the catalog records and aren't freed */
+void 
+search_destroy(search_index *idx) {
+   free(idx->entries);
+   free(idx);
+}
+
+static int 
+search_matches(const char *const name, const char *const pattern, int glob) {
+   if (glob) {
+      return fnmatch(pattern, name, FNM_CASEFOLD) == 0;
+   }
+   
+   return strcasestr(name, pattern) != NULL;
+}
+
+/* plain patterns match as case insensitive substrings, patterns containing
+ * wildcards as globs against the whole name. a single query scans all names,
+ * which is cheaper than building an index for it.
+ */
+u_int32_t 
+search_query(search_index *idx, const char *const pattern, 
+      void(*handler)(search_entry *entry)) {
+   int glob = strpbrk(pattern, "*?[") != NULL;
+   u_int32_t i, found = 0;
+   
+   for (i = 0; i < idx->count; i++) {
+      if (search_matches(idx->entries[i].name, pattern, glob)) {
+         (*handler)(&idx->entries[i]);
+         found++;
+      }
+   }
+   
+   return found;
+}
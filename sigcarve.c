@@ -0,0 +1,471 @@
+/*
+ *  sigcarve.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "sigcarve.h"
+#include "io.h"
+#include "digest.h"
+
+typedef struct {
+   const char *ext;
+   unsigned char header[16];
+   unsigned char mask[16];
+   const char *footer;
+   u_int32_t footerLen;
+   /* bytes that belong to the file after its footer */
+   u_int32_t footerExtra;
+   /* the file ends with the last footer found, not the first one */
+   int lastFooter;
+   u_int64_t maxSize;
+   /* where to start looking for the footer, 0 if the header is invalid */
+   u_int64_t(*skip)(sigcarve *c, u_int64_t start);
+   /* the size of files without a footer, 0 if the header is invalid */
+   u_int64_t(*size)(sigcarve *c, u_int64_t start, u_int64_t maxSize);
+} signature;
+
+static u_int64_t 
+sigcarve_jpegSkip(sigcarve *c, u_int64_t start);
+
+static u_int64_t 
+sigcarve_atomSize(sigcarve *c, u_int64_t start, u_int64_t maxSize);
+
+#define MiB (1024ULL*1024)
+#define ANY 0x00, 0x00, 0x00, 0x00
+
+/* the first matching signature is used, so more specific ones come first */
+static const signature signatures[] = {
+   { "jpg", { 0xFF, 0xD8, 0xFF }, { 0xFF, 0xFF, 0xFF }, 
+      "\xFF\xD9", 2, 0, 0, 64*MiB, &sigcarve_jpegSkip, NULL },
+   { "png", { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A }, 
+      { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }, 
+      "IEND\xAE\x42\x60\x82", 8, 0, 0, 64*MiB, NULL, NULL },
+   /* incrementally updated and linearized pdfs have several trailers */
+   { "pdf", { '%', 'P', 'D', 'F', '-' }, { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }, 
+      "%%EOF", 5, 0, 1, 256*MiB, NULL, NULL },
+   /* the end of central directory record, without the archive comment */
+   { "zip", { 'P', 'K', 0x03, 0x04 }, { 0xFF, 0xFF, 0xFF, 0xFF }, 
+      "PK\x05\x06", 4, 18, 1, 1024*MiB, NULL, NULL },
+   { "mov", { ANY, 'f', 't', 'y', 'p', 'q', 't', ' ', ' ' }, 
+      { ANY, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }, 
+      NULL, 0, 0, 0, 4096*MiB, NULL, &sigcarve_atomSize },
+   { "mp4", { ANY, 'f', 't', 'y', 'p' }, { ANY, 0xFF, 0xFF, 0xFF, 0xFF }, 
+      NULL, 0, 0, 0, 4096*MiB, NULL, &sigcarve_atomSize },
+   { "mov", { ANY, 'm', 'o', 'o', 'v' }, { ANY, 0xFF, 0xFF, 0xFF, 0xFF }, 
+      NULL, 0, 0, 0, 4096*MiB, NULL, &sigcarve_atomSize },
+   { "mov", { ANY, 'w', 'i', 'd', 'e' }, { ANY, 0xFF, 0xFF, 0xFF, 0xFF }, 
+      NULL, 0, 0, 0, 4096*MiB, NULL, &sigcarve_atomSize }
+};
+
+#define SIGNATURE_COUNT (sizeof(signatures)/sizeof(signature))
+
+/* the headers and masks as native words, so all signatures are matched 
+ * against a block with two masked compares each
+ */
+static u_int64_t headerBits[SIGNATURE_COUNT][2];
+static u_int64_t headerMask[SIGNATURE_COUNT][2];
+static pthread_once_t headerOnce = PTHREAD_ONCE_INIT;
+
+/* the top-level atoms of quicktime and mp4 files */
+static const char atomTypes[] = 
+   "ftypmoovmdatfreeskipwidepnotuuidmetamoofmfrapdinsidxstyp";
+
+/* the words are shared by the carvers of all volumes */
+static void 
+sigcarve_initHeaders() {
+   int s;
+   
+   for (s = 0; s < SIGNATURE_COUNT; s++) {
+      memcpy(headerBits[s], signatures[s].header, 16);
+      memcpy(headerMask[s], signatures[s].mask, 16);
+   }
+}
+
+sigcarve *
+sigcarve_create(HFSPlusVolume *vol, const char *const dir) {
+   sigcarve *c = (sigcarve*)calloc(1, sizeof(sigcarve));
+   void *buf;
+   
+   pthread_once(&headerOnce, &sigcarve_initHeaders);
+   
+   c->vol = vol;
+   c->dir = strdup(dir);
+   c->blockSize = vol->volHeader.blockSize;
+   c->bufBlocks = SIGCARVE_CHUNK_SIZE / c->blockSize;
+   c->bufBlocks = c->bufBlocks == 0 ? 1 : c->bufBlocks;
+   c->sig = -1;
+   
+   /* read through the data path, which may bypass the page cache */
+   if (posix_memalign(&buf, READ_ALIGNMENT, 
+            (size_t)c->bufBlocks*c->blockSize) != 0) {
+      perror("posix_memalign");
+      exit(1);
+   }
+   
+   c->buf = (char*)buf;
+   
+   if (posix_memalign(&buf, READ_ALIGNMENT, 2*c->blockSize) != 0) {
+      perror("posix_memalign");
+      exit(1);
+   }
+   
+   c->peekBuf = (char*)buf;
+   return c;
+}
+
+void 
+sigcarve_destroy(sigcarve *c) {
+   free(c->dir);
+   free(c->buf);
+   free(c->peekBuf);
+   free(c);
+}
+
+static inline u_int32_t 
+sigcarve_u32(const unsigned char *p) {
+   return (u_int32_t)p[0] << 24 | (u_int32_t)p[1] << 16 
+      | (u_int32_t)p[2] << 8 | p[3];
+}
+
+/* reads a few bytes at a volume offset ahead of the scan */
+static int 
+sigcarve_peek(sigcarve *c, u_int64_t offset, unsigned char *const out, 
+      u_int32_t len) {
+   u_int32_t block = offset / c->blockSize;
+   u_int32_t count = (offset + len - 1) / c->blockSize - block + 1;
+   
+   if (offset + len > (u_int64_t)c->vol->volHeader.totalBlocks*c->blockSize 
+         || readBlocks(c->vol, block, count, c->peekBuf) == -1) {
+      return -1;
+   }
+   
+   memcpy(out, c->peekBuf + offset % c->blockSize, len);
+   return 0;
+}
+
+/* skips the marker segments in front of the scan data, the exif 
+ * thumbnail in app1 has an end of image marker of its own
+ */
+static u_int64_t 
+sigcarve_jpegSkip(sigcarve *c, u_int64_t start) {
+   unsigned char m[4];
+   u_int64_t offset = start + 2;
+   int i;
+   
+   for (i = 0; i < 64; i++) {
+      if (sigcarve_peek(c, offset, m, 4) == -1 || m[0] != 0xFF) {
+         return 0;
+      }
+      
+      if (m[1] == 0xDA) {
+         return offset - start;
+      } else if (m[1] == 0x01 || (m[1] >= 0xD0 && m[1] <= 0xD7)) {
+         offset += 2;
+      } else {
+         offset += 2 + (m[2] << 8 | m[3]);
+      }
+   }
+   
+   return 0;
+}
+
+/* follows the top-level atoms until one is not a known atom. files 
+ * without movie and media data atoms are rejected.
+ */
+static u_int64_t 
+sigcarve_atomSize(sigcarve *c, u_int64_t start, u_int64_t maxSize) {
+   unsigned char a[16];
+   u_int64_t offset = start, size;
+   int moov = 0, mdat = 0, i, t;
+   
+   for (i = 0; i < 256 && offset - start < maxSize; i++) {
+      if (sigcarve_peek(c, offset, a, 8) == -1) {
+         break;
+      }
+      
+      for (t = 0; t < sizeof(atomTypes) - 1; t += 4) {
+         if (memcmp(a + 4, atomTypes + t, 4) == 0) {
+            break;
+         }
+      }
+      
+      if (t == sizeof(atomTypes) - 1) {
+         break;
+      }
+      
+      size = sigcarve_u32(a);
+      
+      /* a 64 bit size follows the type */
+      if (size == 1) {
+         if (sigcarve_peek(c, offset + 8, a + 8, 8) == -1) {
+            break;
+         }
+         
+         size = (u_int64_t)sigcarve_u32(a + 8) << 32 | sigcarve_u32(a + 12);
+      }
+      
+      if (size < 8) {
+         break;
+      }
+      
+      moov |= memcmp(a + 4, "moov", 4) == 0;
+      mdat |= memcmp(a + 4, "mdat", 4) == 0;
+      offset += size;
+   }
+   
+   return moov && mdat && offset - start <= maxSize ? offset - start : 0;
+}
+
+static int 
+sigcarve_match(const char *const block) {
+   u_int64_t w[2];
+   int s;
+   
+   memcpy(w, block, sizeof(w));
+   
+   for (s = 0; s < SIGNATURE_COUNT; s++) {
+      if ((((w[0] & headerMask[s][0]) ^ headerBits[s][0]) 
+               | ((w[1] & headerMask[s][1]) ^ headerBits[s][1])) == 0) {
+         return s;
+      }
+   }
+   
+   return -1;
+}
+
+/* copies a carved file through the data path into the carving directory */
+static void 
+sigcarve_extract(sigcarve *c, u_int64_t end) {
+   const signature *sig = &signatures[c->sig];
+   HFSPlusVolume *vol = c->vol;
+   u_int32_t blockSize = c->blockSize;
+   u_int64_t chunk = vol->dataBufSize - vol->dataBufSize % blockSize;
+   u_int64_t offset, len;
+   char *path = (char*)malloc(strlen(c->dir) + 32);
+   sink_fork fork = { path, NULL, 0, end - c->start };
+   hash_digest digest;
+   writer *dst;
+   int failed = 0;
+   
+   sprintf(path, "%s/%llu.%s", c->dir, 
+         (unsigned long long)(c->start / blockSize), sig->ext);
+   printf("carving file: %s (%llu bytes)\n", path, 
+         (unsigned long long)(end - c->start));
+   
+   if ((dst = vol->output->createFork(vol->output, &fork)) == NULL) {
+      fprintf(stderr, "failed to carve: %s\n", path);
+      free(path);
+      return;
+   }
+   
+   for (offset = c->start; offset < end && !failed; offset += len) {
+      len = end - offset < chunk ? end - offset : chunk;
+      failed = offset + len 
+            > (u_int64_t)vol->volHeader.totalBlocks*blockSize
+         || readBlocks(vol, offset / blockSize, 
+               (len + blockSize - 1) / blockSize, vol->dataBuf) == -1 
+         || writer_write(dst, vol->dataBuf, len) == -1;
+   }
+   
+   writer_digest(dst, &digest);
+   
+   if (vol->output->closeFork(vol->output, dst, &fork) == -1 || failed) {
+      fprintf(stderr, "failed to carve: %s\n", path);
+   } else {
+      c->carved++;
+      c->bytes += end - c->start;
+      
+      if (vol->digests != NULL) {
+         digest_add(vol->digests, path, &digest);
+      }
+   }
+   
+   free(path);
+}
+
+/* ends the file being carved. files with a footer are only kept if it 
+ * was found.
+ */
+static void 
+sigcarve_finish(sigcarve *c) {
+   const signature *sig = &signatures[c->sig];
+   
+   if (sig->size != NULL) {
+      sigcarve_extract(c, c->end);
+   } else if (c->lastEnd != 0) {
+      sigcarve_extract(c, c->lastEnd);
+   } else {
+      c->discarded++;
+   }
+   
+   c->sig = -1;
+}
+
+static void 
+sigcarve_begin(sigcarve *c, int s, u_int64_t start) {
+   const signature *sig = &signatures[s];
+   u_int64_t n;
+   
+   c->start = start;
+   c->lastEnd = 0;
+   c->carryLen = 0;
+   
+   if (sig->size != NULL) {
+      if ((n = (*sig->size)(c, start, sig->maxSize)) != 0) {
+         c->sig = s;
+         c->end = start + n;
+      }
+   } else if (sig->skip == NULL) {
+      c->sig = s;
+      c->searchFrom = start;
+   } else if ((n = (*sig->skip)(c, start)) != 0) {
+      c->sig = s;
+      c->searchFrom = start + n;
+   }
+}
+
+/* looks for the footer starting in the first starts bytes of the data, 
+ * base being the volume offset of the data. returns 1 if the file ends.
+ */
+static int 
+sigcarve_findFooter(sigcarve *c, const unsigned char *const data, 
+      u_int32_t len, u_int32_t starts, u_int64_t base) {
+   const signature *sig = &signatures[c->sig];
+   const unsigned char *p = data, *end = data + starts;
+   
+   /* memchr is vectorized by the c library, the footer's first byte is 
+    * rare enough to let it skip most of the data
+    */
+   while (p < end && (p = (const unsigned char*)memchr(p, sig->footer[0], 
+               end - p)) != NULL) {
+      if (p + sig->footerLen <= data + len 
+            && memcmp(p, sig->footer, sig->footerLen) == 0 
+            && base + (p - data) >= c->searchFrom) {
+         c->lastEnd = base + (p - data) + sig->footerLen + sig->footerExtra;
+         
+         if (!sig->lastFooter) {
+            return 1;
+         }
+      }
+      
+      p++;
+   }
+   
+   return 0;
+}
+
+static void 
+sigcarve_block(sigcarve *c, const char *const block, u_int64_t offset) {
+   const signature *sig;
+   unsigned char joined[2*SIGCARVE_MAX_FOOTER];
+   u_int32_t keep;
+   int s;
+   
+   /* files with a known size are skipped over */
+   if (c->sig != -1 && signatures[c->sig].size != NULL) {
+      if (offset < c->end) {
+         return;
+      }
+      
+      sigcarve_finish(c);
+   }
+   
+   if ((s = sigcarve_match(block)) != -1) {
+      if (c->sig != -1) {
+         sigcarve_finish(c);
+      }
+      
+      sigcarve_begin(c, s, offset);
+   }
+   
+   if (c->sig == -1 || (sig = &signatures[c->sig])->size != NULL) {
+      return;
+   }
+   
+   /* a footer spanning the previous block and this one */
+   keep = sig->footerLen - 1;
+   
+   if (c->carryLen > 0) {
+      memcpy(joined, c->carry, c->carryLen);
+      memcpy(joined + c->carryLen, block, keep);
+      
+      if (sigcarve_findFooter(c, joined, c->carryLen + keep, c->carryLen, 
+               offset - c->carryLen)) {
+         sigcarve_finish(c);
+         return;
+      }
+   }
+   
+   if (offset + c->blockSize > c->searchFrom 
+         && sigcarve_findFooter(c, (const unsigned char*)block, 
+            c->blockSize, c->blockSize, offset)) {
+      sigcarve_finish(c);
+      return;
+   }
+   
+   memcpy(c->carry, block + c->blockSize - keep, keep);
+   c->carryLen = keep;
+   
+   if (offset + c->blockSize - c->start >= sig->maxSize) {
+      sigcarve_finish(c);
+   }
+}
+
+/* carves the files in a run of blocks. files don't continue past its end.
+ * the signature of a bitmap_freeRanges handler.
+ */
+void 
+sigcarve_range(u_int32_t start, u_int32_t count, void *carver) {
+   sigcarve *c = (sigcarve*)carver;
+   u_int32_t end = start + count, block, n, i;
+   
+   for (block = start; block < end; block += n) {
+      n = end - block < c->bufBlocks ? end - block : c->bufBlocks;
+      
+      if (block + n < end) {
+         adviseRead(c->vol, 
+               c->vol->volOffset + (u_int64_t)(block + n)*c->blockSize, 
+               (u_int64_t)c->bufBlocks*c->blockSize, ADVISE_WILLNEED);
+      }
+      
+      /* an unreadable chunk ends the file being carved */
+      if (readBlocks(c->vol, block, n, c->buf) == -1) {
+         if (c->sig != -1) {
+            sigcarve_finish(c);
+         }
+         continue;
+      }
+      
+      for (i = 0; i < n; i++) {
+         sigcarve_block(c, c->buf + (size_t)i*c->blockSize, 
+               (u_int64_t)(block + i)*c->blockSize);
+      }
+   }
+   
+   if (c->sig != -1) {
+      sigcarve_finish(c);
+   }
+}
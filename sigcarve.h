@@ -0,0 +1,73 @@
+/*
+ *  sigcarve.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+
+#ifndef __SIGCARVE_H_
+#define __SIGCARVE_H_
+
+/* the free space is read in chunks of this many bytes */
+#define SIGCARVE_CHUNK_SIZE (4*1024*1024)
+#define SIGCARVE_MAX_FOOTER 16
+
+/* carves files by their signatures. headers are only looked for at the 
+ * start of allocation blocks, files are assumed to be contiguous.
+ */
+struct _HFSPlusVolume;
+
+typedef struct {
+   struct _HFSPlusVolume *vol;
+   char *dir;
+   u_int32_t blockSize;
+   char *buf;
+   u_int32_t bufBlocks;
+   char *peekBuf;
+   
+   /* the file being carved, sig is -1 if there is none */
+   int sig;
+   u_int64_t start;
+   u_int64_t searchFrom;
+   u_int64_t end;
+   u_int64_t lastEnd;
+   unsigned char carry[SIGCARVE_MAX_FOOTER];
+   u_int32_t carryLen;
+   
+   u_int64_t carved;
+   u_int64_t discarded;
+   u_int64_t bytes;
+} sigcarve;
+
+sigcarve *
+sigcarve_create(struct _HFSPlusVolume *vol, const char *const dir);
+
+void 
+sigcarve_range(u_int32_t start, u_int32_t count, void *carver);
+
+void 
+sigcarve_destroy(sigcarve *c);
+
+#endif
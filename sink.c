@@ -0,0 +1,388 @@
+/*
+ *  sink.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <fcntl.h>
+#include "sink.h"
+#include "io.h"
+#include "tar.h"
+#include "util.h"
+#include "btree.h"
+
+#define SINK_DIR_MODE (S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH)
+
+static sink *
+sink_create(const char *const name, int flags, int writerFlags) {
+   sink *s = (sink*)calloc(1, sizeof(sink));
+   
+   s->name = name;
+   s->flags = flags;
+   s->writerFlags = writerFlags;
+   gettimeofday(&s->start, NULL);
+   return s;
+}
+
+/* the file system below the recovery path */
+
+static int 
+sink_fsMakeDirectory(sink *s, const char *const path) {
+   /*TODO: apply the original mask*/
+   if (mkdirr((char*)path, SINK_DIR_MODE) != 0 && errno != EEXIST) {
+      return -1;
+   }
+   
+   return 0;
+}
+
+static writer *
+sink_fsCreateFork(sink *s, const sink_fork *const fork) {
+   char *path;
+   writer *w;
+   
+   if (fork->forkType == 0) {
+      return writer_open(fork->path, s->writerFlags, fork->size);
+   }
+   
+   path = (char*)malloc(strlen(fork->path) + RSRC_FORK_NAME_LEN + 1);
+   sprintf(path, "%s%s", fork->path, RSRC_FORK_NAME);
+   w = writer_open(path, s->writerFlags, fork->size);
+   free(path);
+   return w;
+}
+
+/* the attributes are set on the open data fork */
+static int 
+sink_fsCloseFork(sink *s, writer *w, const sink_fork *const fork) {
+   if (fork->forkType == 0 && fork->f != NULL) {
+      restoreAttributes(fork->f, w->fd, fork->path);
+   }
+   
+   s->forks++;
+   s->bytes += w->offset + w->used;
+   return writer_close(w);
+}
+
+/* last, a read-only mode would keep the resource fork from being written */
+static void 
+sink_fsSetMetadata(sink *s, const file *const f, const char *const path) {
+   HFSPlusCatalogFile *hfsFile = (HFSPlusCatalogFile*)f->hfsFile;
+   
+   setFinderInfo(path, &hfsFile->userInfo);
+   
+   /* volumes without permissions leave the mode zeroed */
+   if ((hfsFile->bsdInfo.fileMode & ALLPERMS) != 0) {
+      chmod(path, hfsFile->bsdInfo.fileMode & ALLPERMS);
+   }
+}
+
+static int 
+sink_fsLink(sink *s, const char *const path, const char *const target, 
+      int type) {
+   return type == SINK_HARDLINK ? link(target, path) : symlink(target, path);
+}
+
+static int 
+sink_fsPatch(sink *s, const char *const path, u_int64_t offset, 
+      const char *const data, u_int32_t len) {
+   int fd, ret = 0;
+   
+   /* files that weren't restored are left alone */
+   if ((fd = open(path, O_WRONLY)) == -1) {
+      return 0;
+   }
+   
+   if (pwrite(fd, data, len, offset) != (ssize_t)len) {
+      ret = -1;
+   }
+   
+   close(fd);
+   return ret;
+}
+
+static int 
+sink_fsClose(sink *s) {
+   return 0;
+}
+
+sink *
+sink_fs(int writerFlags) {
+   sink *s = sink_create("files", 0, writerFlags);
+   
+   s->makeDirectory = &sink_fsMakeDirectory;
+   s->createFork = &sink_fsCreateFork;
+   s->closeFork = &sink_fsCloseFork;
+   s->setMetadata = &sink_fsSetMetadata;
+   s->link = &sink_fsLink;
+   s->patch = &sink_fsPatch;
+   s->close = &sink_fsClose;
+   return s;
+}
+
+/* a pax archive. extractors apply an AppleDouble file to the entry 
+ * following it, so the resource fork goes first.
+ */
+
+typedef struct {
+   tar *archive;
+   btree *dirs;
+} sink_tarContext;
+
+static int 
+sink_pathComparator(void *key1, void *key2) {
+   return strcmp((const char*)key1, (const char*)key2);
+}
+
+/* the archive is useless once a write failed */
+static void 
+sink_tarCheck(int ret) {
+   if (ret == -1) {
+      exit(1);
+   }
+}
+
+/* every folder gets one entry, before the first file in it */
+static int 
+sink_tarMakeDirectory(sink *s, const char *const path) {
+   sink_tarContext *ctx = (sink_tarContext*)s->ctx;
+   tar_entry e;
+   
+   if (btree_find(ctx->dirs, (void*)path) != NULL) {
+      return 0;
+   }
+   
+   btree_insert(ctx->dirs, strdup(path), ctx);
+   memset(&e, 0, sizeof(tar_entry));
+   e.path = path;
+   e.type = TAR_DIRECTORY;
+   e.mode = SINK_DIR_MODE;
+   e.mtime = s->start.tv_sec;
+   sink_tarCheck(tar_add(ctx->archive, &e));
+   return 0;
+}
+
+/* the metadata of a file in the archive, carved files get defaults */
+static void 
+sink_tarEntry(const sink *const s, const sink_fork *const fork, 
+      tar_entry *const e) {
+   HFSPlusCatalogFile *hfsFile;
+   
+   memset(e, 0, sizeof(tar_entry));
+   e->path = fork->path;
+   e->type = TAR_FILE;
+   e->size = fork->size;
+   e->mtime = s->start.tv_sec;
+   
+   if (fork->f != NULL) {
+      hfsFile = (HFSPlusCatalogFile*)fork->f->hfsFile;
+      e->mode = hfsFile->bsdInfo.fileMode & ALLPERMS;
+      e->uid = hfsFile->bsdInfo.ownerID;
+      e->gid = hfsFile->bsdInfo.groupID;
+      e->mtime = hfsFile->contentModDate > HFS_EPOCH_OFFSET 
+         ? hfsFile->contentModDate - HFS_EPOCH_OFFSET : 0;
+      e->attributes = fork->f->attributes;
+   }
+   
+   e->mode = e->mode != 0 ? e->mode : S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+}
+
+static writer *
+sink_tarCreateFork(sink *s, const sink_fork *const fork) {
+   sink_tarContext *ctx = (sink_tarContext*)s->ctx;
+   char finderInfo[APPLEDOUBLE_INFO_SIZE];
+   HFSPlusCatalogFile *hfsFile;
+   u_int32_t v;
+   u_int16_t flags;
+   writer *w;
+   tar_entry e;
+   
+   sink_tarEntry(s, fork, &e);
+   
+   if (fork->forkType == 0) {
+      w = tar_beginFile(ctx->archive, &e);
+   } else {
+      /* the fields setFinderInfo sets, in big endian */
+      hfsFile = (HFSPlusCatalogFile*)fork->f->hfsFile;
+      memset(finderInfo, 0, sizeof(finderInfo));
+      v = CFSwapInt32HostToBig(hfsFile->userInfo.fdType);
+      memcpy(&finderInfo[0], &v, 4);
+      v = CFSwapInt32HostToBig(hfsFile->userInfo.fdCreator);
+      memcpy(&finderInfo[4], &v, 4);
+      flags = CFSwapInt16HostToBig(hfsFile->userInfo.fdFlags);
+      memcpy(&finderInfo[8], &flags, 2);
+      e.attributes = NULL;
+      w = tar_beginAppleDouble(ctx->archive, &e, finderInfo);
+   }
+   
+   sink_tarCheck(w == NULL ? -1 : 0);
+   return w;
+}
+
+/* a fork that couldn't be read completely is zero-filled by tar_endFile */
+static int 
+sink_tarCloseFork(sink *s, writer *w, const sink_fork *const fork) {
+   s->forks++;
+   s->bytes += fork->size;
+   sink_tarCheck(tar_endFile(((sink_tarContext*)s->ctx)->archive));
+   return 0;
+}
+
+/* the metadata is in the headers already */
+static void 
+sink_tarSetMetadata(sink *s, const file *const f, const char *const path) {
+}
+
+static int 
+sink_tarLink(sink *s, const char *const path, const char *const target, 
+      int type) {
+   tar_entry e;
+   
+   memset(&e, 0, sizeof(tar_entry));
+   e.path = path;
+   e.linkName = target;
+   e.type = type == SINK_HARDLINK ? TAR_HARDLINK : TAR_SYMLINK;
+   e.mode = ACCESSPERMS;
+   e.mtime = s->start.tv_sec;
+   sink_tarCheck(tar_add(((sink_tarContext*)s->ctx)->archive, &e));
+   return 0;
+}
+
+static void 
+sink_freeDir(btree_node *node) {
+   free(node->key);
+}
+
+static int 
+sink_tarClose(sink *s) {
+   sink_tarContext *ctx = (sink_tarContext*)s->ctx;
+   int ret;
+   
+   printf("%llu entries in the archive\n", 
+         (unsigned long long)ctx->archive->entries);
+   ret = tar_close(ctx->archive);
+   btree_inorderTraverse(ctx->dirs, &sink_freeDir);
+   btree_destroy(ctx->dirs);
+   free(ctx);
+   return ret;
+}
+
+/* the archive is written to stdout for "-" */
+sink *
+sink_tar(const char *const fileName, int writerFlags, int zstdLevel) {
+   sink *s = sink_create("archive", SINK_RSRC_FIRST, writerFlags);
+   sink_tarContext *ctx = (sink_tarContext*)calloc(1, 
+         sizeof(sink_tarContext));
+   
+   if ((ctx->archive = tar_open(fileName, writerFlags, zstdLevel)) == NULL) {
+      free(ctx);
+      free(s);
+      return NULL;
+   }
+   
+   ctx->dirs = btree_create(&sink_pathComparator);
+   s->ctx = ctx;
+   s->makeDirectory = &sink_tarMakeDirectory;
+   s->createFork = &sink_tarCreateFork;
+   s->closeFork = &sink_tarCloseFork;
+   s->setMetadata = &sink_tarSetMetadata;
+   s->link = &sink_tarLink;
+   s->patch = NULL;
+   s->close = &sink_tarClose;
+   return s;
+}
+
+/* discards the data but counts it, to measure the read side alone */
+
+static int 
+sink_nullMakeDirectory(sink *s, const char *const path) {
+   return 0;
+}
+
+static writer *
+sink_nullCreateFork(sink *s, const sink_fork *const fork) {
+   return writer_openNull(s->writerFlags);
+}
+
+static int 
+sink_nullCloseFork(sink *s, writer *w, const sink_fork *const fork) {
+   s->forks++;
+   s->bytes += w->offset;
+   return writer_close(w);
+}
+
+static void 
+sink_nullSetMetadata(sink *s, const file *const f, const char *const path) {
+}
+
+static int 
+sink_nullLink(sink *s, const char *const path, const char *const target, 
+      int type) {
+   return 0;
+}
+
+static int 
+sink_nullPatch(sink *s, const char *const path, u_int64_t offset, 
+      const char *const data, u_int32_t len) {
+   return 0;
+}
+
+static int 
+sink_nullClose(sink *s) {
+   return 0;
+}
+
+sink *
+sink_null(int writerFlags) {
+   sink *s = sink_create("null", 0, writerFlags);
+   
+   s->makeDirectory = &sink_nullMakeDirectory;
+   s->createFork = &sink_nullCreateFork;
+   s->closeFork = &sink_nullCloseFork;
+   s->setMetadata = &sink_nullSetMetadata;
+   s->link = &sink_nullLink;
+   s->patch = &sink_nullPatch;
+   s->close = &sink_nullClose;
+   return s;
+}
+
+/* prints how much was written and how fast */
+int 
+sink_close(sink *s) {
+   struct timeval now;
+   double secs;
+   int ret;
+   
+   gettimeofday(&now, NULL);
+   secs = (now.tv_sec - s->start.tv_sec) 
+      + (now.tv_usec - s->start.tv_usec) / 1000000.0;
+   printf("%llu forks, %llu bytes written to %s output in %.1f s "
+         "(%.1f MB/s)\n", (unsigned long long)s->forks, 
+         (unsigned long long)s->bytes, s->name, secs, 
+         secs > 0 ? s->bytes / secs / 1000000 : 0);
+   ret = s->close(s);
+   free(s);
+   return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ *  sink.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <sys/time.h>
+#include "definitions.h"
+#include "writer.h"
+
+#ifndef __SINK_H_
+#define __SINK_H_
+
+/* the resource fork of a file is written before its data fork */
+#define SINK_RSRC_FIRST 0x01
+
+#define SINK_HARDLINK   1
+#define SINK_SYMLINK    2
+
+/* a fork to be written. path is the path of the file, without the suffix 
+ * of the resource fork. carved files have no catalog record.
+ */
+typedef struct {
+   const char *path;
+   const file *f;
+   u_int8_t forkType;           /* 0 data, 0xFF resource, like extent keys */
+   u_int64_t size;
+} sink_fork;
+
+/* where the restored files go. the data of every fork passes through the 
+ * writer returned by createFork, metadata is set once all forks of a file
+ * are closed. sinks that can't write at an offset leave patch NULL, the 
+ * retry passes are skipped then.
+ */
+typedef struct _sink {
+   const char *name;
+   int flags;
+   int writerFlags;
+   void *ctx;
+   u_int64_t forks;
+   u_int64_t bytes;
+   struct timeval start;
+   int (*makeDirectory)(struct _sink *s, const char *const path);
+   writer *(*createFork)(struct _sink *s, const sink_fork *const fork);
+   int (*closeFork)(struct _sink *s, writer *w, const sink_fork *const fork);
+   void (*setMetadata)(struct _sink *s, const file *const f, 
+         const char *const path);
+   int (*link)(struct _sink *s, const char *const path, 
+         const char *const target, int type);
+   int (*patch)(struct _sink *s, const char *const path, u_int64_t offset, 
+         const char *const data, u_int32_t len);
+   int (*close)(struct _sink *s);
+} sink;
+
+sink *
+sink_fs(int writerFlags);
+
+sink *
+sink_tar(const char *const fileName, int writerFlags, int zstdLevel);
+
+sink *
+sink_null(int writerFlags);
+
+int 
+sink_close(sink *s);
+
+#endif
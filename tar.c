@@ -0,0 +1,357 @@
+/*
+ *  tar.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <fcntl.h>
+#include "tar.h"
+#include "io.h"
+
+static const char zeros[TAR_BLOCK_SIZE];
+
+/* the paths in the archive are relative */
+static const char *
+tar_relative(const char *path) {
+   while (*path == '/') {
+      path++;
+   }
+   
+   return path;
+}
+
+static u_int64_t 
+tar_position(const tar *const t) {
+   return t->out->offset + t->out->used;
+}
+
+static int 
+tar_zeros(tar *t, u_int64_t len) {
+   u_int32_t n;
+   
+   while (len > 0) {
+      n = len < TAR_BLOCK_SIZE ? (u_int32_t)len : TAR_BLOCK_SIZE;
+      
+      if (writer_write(t->out, zeros, n) == -1) {
+         return -1;
+      }
+      
+      len -= n;
+   }
+   
+   return 0;
+}
+
+/* fills an entry up to the next block */
+static int 
+tar_pad(tar *t, u_int64_t size) {
+   return tar_zeros(t, (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) 
+         % TAR_BLOCK_SIZE);
+}
+
+/* appends a "<length> <key>=<value>\n" record, the length counting 
+ * its own digits
+ */
+static void 
+tar_paxRecord(char **pax, u_int32_t *len, u_int32_t *size, 
+      const char *const key, const char *const value, u_int32_t valueLen) {
+   u_int32_t n = strlen(key) + valueLen + 3, digits, p;
+   char num[16];
+   
+   for (digits = 1; sprintf(num, "%u", n + digits) != (int)digits; digits++);
+   n += digits;
+   
+   if (*len + n + 1 > *size) {
+      *size = (*len + n + 1) * 2;
+      
+      if ((*pax = (char*)realloc(*pax, *size)) == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+   }
+   
+   p = sprintf(*pax + *len, "%u %s=", n, key);
+   memcpy(*pax + *len + p, value, valueLen);
+   (*pax)[*len + n - 1] = '\n';
+   *len += n;
+}
+
+static void 
+tar_header(char *const h, const char *const name, const char *const link, 
+      char type, u_int64_t size, const tar_entry *const e) {
+   u_int32_t sum = 0, i;
+   
+   memset(h, 0, TAR_BLOCK_SIZE);
+   strncpy(h, name, TAR_NAME_LEN);
+   sprintf(h + 100, "%07o", e->mode & 07777);
+   sprintf(h + 108, "%07o", e->uid > TAR_MAX_ID ? 0 : e->uid);
+   sprintf(h + 116, "%07o", e->gid > TAR_MAX_ID ? 0 : e->gid);
+   sprintf(h + 124, "%011llo", 
+         (unsigned long long)(size > TAR_MAX_SIZE ? 0 : size));
+   sprintf(h + 136, "%011llo", (unsigned long long)e->mtime);
+   h[156] = type;
+   strncpy(h + 157, link, TAR_NAME_LEN);
+   memcpy(h + 257, "ustar", 6);
+   memcpy(h + 263, "00", 2);
+   
+   /* summed with the checksum field set to blanks */
+   memset(h + 148, ' ', 8);
+   
+   for (i = 0; i < TAR_BLOCK_SIZE; i++) {
+      sum += (unsigned char)h[i];
+   }
+   
+   sprintf(h + 148, "%06o", sum);
+   h[155] = ' ';
+}
+
+/* writes the ustar header of an entry, preceded by a pax header with the 
+ * values that don't fit into it and the extended attributes
+ */
+static int 
+tar_writeHeader(tar *t, const tar_entry *const e, u_int64_t size) {
+   const char *path = tar_relative(e->path);
+   const char *link = e->linkName != NULL ? tar_relative(e->linkName) : "";
+   char header[TAR_BLOCK_SIZE], num[24], *key, *pax = NULL;
+   u_int32_t len = 0, paxSize = 0;
+   const attribute *attr;
+   int ret = 0;
+   
+   if (strlen(path) > TAR_NAME_LEN) {
+      tar_paxRecord(&pax, &len, &paxSize, "path", path, strlen(path));
+   }
+   
+   if (strlen(link) > TAR_NAME_LEN) {
+      tar_paxRecord(&pax, &len, &paxSize, "linkpath", link, strlen(link));
+   }
+   
+   if (size > TAR_MAX_SIZE) {
+      sprintf(num, "%llu", (unsigned long long)size);
+      tar_paxRecord(&pax, &len, &paxSize, "size", num, strlen(num));
+   }
+   
+   if (e->uid > TAR_MAX_ID) {
+      sprintf(num, "%u", e->uid);
+      tar_paxRecord(&pax, &len, &paxSize, "uid", num, strlen(num));
+   }
+   
+   if (e->gid > TAR_MAX_ID) {
+      sprintf(num, "%u", e->gid);
+      tar_paxRecord(&pax, &len, &paxSize, "gid", num, strlen(num));
+   }
+   
+   for (attr = e->attributes; attr != NULL; attr = attr->next) {
+      if (!isRestorableAttribute(attr)) {
+         continue;
+      }
+      
+      if (attr->data == NULL) {
+         fprintf(stderr, "value of attribute %s not read: %s\n", attr->name, 
+               e->path);
+         continue;
+      }
+      
+      key = (char*)malloc(strlen(TAR_XATTR_PREFIX) + strlen(attr->name) + 1);
+      sprintf(key, "%s%s", TAR_XATTR_PREFIX, attr->name);
+      tar_paxRecord(&pax, &len, &paxSize, key, attr->data, attr->size);
+      free(key);
+   }
+   
+   if (len > 0) {
+      tar_header(header, "PaxHeader", "", TAR_PAX_HEADER, len, e);
+      ret = writer_write(t->out, header, TAR_BLOCK_SIZE) == -1 
+         || writer_write(t->out, pax, len) == -1 || tar_pad(t, len) == -1;
+      free(pax);
+   }
+   
+   tar_header(header, path, link, e->type, size, e);
+   
+   if (ret || writer_write(t->out, header, TAR_BLOCK_SIZE) == -1) {
+      fprintf(stderr, "unable to write to the archive\n");
+      return -1;
+   }
+   
+   t->entries++;
+   return 0;
+}
+
+/* the archive is written to stdout for "-", compressed with a zstd level */
+tar *
+tar_open(const char *const fileName, int writerFlags, int zstdLevel) {
+   tar *t = (tar*)calloc(1, sizeof(tar));
+   
+   if (strcmp(fileName, "-") == 0) {
+      /* the messages printed go to stderr from now on */
+      fflush(stdout);
+      
+      if ((t->fd = dup(STDOUT_FILENO)) == -1 
+            || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+         perror("dup");
+         free(t);
+         return NULL;
+      }
+   } else if ((t->fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) 
+         == -1) {
+      perror("open");
+      free(t);
+      return NULL;
+   }
+   
+   if ((t->out = writer_openStream(t->fd, writerFlags, zstdLevel)) == NULL) {
+      close(t->fd);
+      free(t);
+      return NULL;
+   }
+   
+   /* headers and padding aren't hashed */
+   t->hashFlags = t->out->hash.flags;
+   t->out->hash.flags = 0;
+   return t;
+}
+
+/* an entry without data: a directory or a link */
+int 
+tar_add(tar *t, const tar_entry *const e) {
+   return tar_writeHeader(t, e, 0);
+}
+
+/* writes the header of a file, its data is written to the writer returned 
+ * and the entry completed with tar_endFile
+ */
+writer *
+tar_beginFile(tar *t, const tar_entry *const e) {
+   if (tar_writeHeader(t, e, e->size) == -1) {
+      return NULL;
+   }
+   
+   t->entryStart = tar_position(t);
+   t->entrySize = e->size;
+   hash_init(&t->out->hash, t->hashFlags);
+   return t->out;
+}
+
+/* like tar_beginFile, for the resource fork of the file of the entry. the
+ * finder info is expected in big endian.
+ */
+writer *
+tar_beginAppleDouble(tar *t, const tar_entry *const e, 
+      const char *const finderInfo) {
+   const char *name = strrchr(e->path, '/');
+   int dirLen = name != NULL ? name - e->path + 1 : 0;
+   char header[APPLEDOUBLE_HEADER_SIZE];
+   char *path = (char*)malloc(strlen(e->path) 
+         + strlen(APPLEDOUBLE_PREFIX) + 1);
+   tar_entry ad = *e;
+   u_int32_t v;
+   
+   memcpy(path, e->path, dirLen);
+   sprintf(path + dirLen, "%s%s", APPLEDOUBLE_PREFIX, e->path + dirLen);
+   ad.path = path;
+   ad.type = TAR_FILE;
+   ad.size = APPLEDOUBLE_HEADER_SIZE + e->size;
+   ad.attributes = NULL;
+   
+   memset(header, 0, sizeof(header));
+   v = CFSwapInt32HostToBig(APPLEDOUBLE_MAGIC);
+   memcpy(header, &v, 4);
+   v = CFSwapInt32HostToBig(APPLEDOUBLE_VERSION);
+   memcpy(header + 4, &v, 4);
+   header[25] = 2;
+   
+   /* the entry descriptors: id, offset and length */
+   v = CFSwapInt32HostToBig(APPLEDOUBLE_FINDER_INFO);
+   memcpy(header + 26, &v, 4);
+   v = CFSwapInt32HostToBig(APPLEDOUBLE_HEADER_SIZE - APPLEDOUBLE_INFO_SIZE);
+   memcpy(header + 30, &v, 4);
+   v = CFSwapInt32HostToBig(APPLEDOUBLE_INFO_SIZE);
+   memcpy(header + 34, &v, 4);
+   v = CFSwapInt32HostToBig(APPLEDOUBLE_RSRC);
+   memcpy(header + 38, &v, 4);
+   v = CFSwapInt32HostToBig(APPLEDOUBLE_HEADER_SIZE);
+   memcpy(header + 42, &v, 4);
+   v = CFSwapInt32HostToBig((u_int32_t)e->size);
+   memcpy(header + 46, &v, 4);
+   memcpy(header + APPLEDOUBLE_HEADER_SIZE - APPLEDOUBLE_INFO_SIZE, 
+         finderInfo, APPLEDOUBLE_INFO_SIZE);
+   
+   if (tar_writeHeader(t, &ad, ad.size) == -1) {
+      free(path);
+      return NULL;
+   }
+   
+   free(path);
+   t->entryStart = tar_position(t);
+   t->entrySize = ad.size;
+   
+   if (writer_write(t->out, header, APPLEDOUBLE_HEADER_SIZE) == -1) {
+      fprintf(stderr, "unable to write to the archive\n");
+      return NULL;
+   }
+   
+   hash_init(&t->out->hash, t->hashFlags);
+   return t->out;
+}
+
+/* a file that couldn't be read completely is filled up with zeros to the 
+ * size in its header, so the archive stays readable
+ */
+int 
+tar_endFile(tar *t) {
+   u_int64_t written = tar_position(t) - t->entryStart;
+   
+   t->out->hash.flags = 0;
+   
+   if (written > t->entrySize) {
+      fprintf(stderr, "%s:%d archive entry longer than its header\n", 
+            __FILE__, __LINE__);
+      return -1;
+   }
+   
+   if (tar_zeros(t, t->entrySize - written) == -1 
+         || tar_pad(t, t->entrySize) == -1) {
+      fprintf(stderr, "unable to write to the archive\n");
+      return -1;
+   }
+   
+   return 0;
+}
+
+/* ends the archive with two empty blocks */
+int 
+tar_close(tar *t) {
+   int ret = tar_zeros(t, 2*TAR_BLOCK_SIZE);
+   
+   if (writer_close(t->out) == -1) {
+      ret = -1;
+   }
+   
+   if (close(t->fd) == -1) {
+      perror("close");
+      ret = -1;
+   }
+   
+   free(t);
+   return ret;
+}
@@ -0,0 +1,103 @@
+/*
+ *  tar.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "definitions.h"
+#include "writer.h"
+
+#ifndef __TAR_H_
+#define __TAR_H_
+
+#define TAR_BLOCK_SIZE  512
+#define TAR_NAME_LEN    100
+/* the largest values the octal fields of a ustar header hold */
+#define TAR_MAX_SIZE    077777777777ULL
+#define TAR_MAX_ID      07777777
+
+#define TAR_FILE        '0'
+#define TAR_HARDLINK    '1'
+#define TAR_SYMLINK     '2'
+#define TAR_DIRECTORY   '5'
+#define TAR_PAX_HEADER  'x'
+
+#define TAR_XATTR_PREFIX "SCHILY.xattr."
+
+/* a resource fork is stored in an AppleDouble file ._<name> before the 
+ * entry of its file, with the finder info and the fork as entries
+ */
+#define APPLEDOUBLE_PREFIX      "._"
+#define APPLEDOUBLE_MAGIC       0x00051607
+#define APPLEDOUBLE_VERSION     0x00020000
+#define APPLEDOUBLE_RSRC        2
+#define APPLEDOUBLE_FINDER_INFO 9
+#define APPLEDOUBLE_INFO_SIZE   32
+#define APPLEDOUBLE_HEADER_SIZE (26 + 2*12 + APPLEDOUBLE_INFO_SIZE)
+
+typedef struct {
+   const char *path;
+   const char *linkName;
+   char type;
+   u_int64_t size;
+   u_int32_t mode;
+   u_int32_t uid;
+   u_int32_t gid;
+   u_int64_t mtime;
+   const attribute *attributes;
+} tar_entry;
+
+/* a pax archive written as one stream. the data of the entries passes 
+ * through the writer, which hashes only the data of the current file.
+ */
+typedef struct {
+   int fd;
+   writer *out;
+   int hashFlags;
+   u_int64_t entryStart;
+   u_int64_t entrySize;
+   u_int64_t entries;
+} tar;
+
+tar *
+tar_open(const char *const fileName, int writerFlags, int zstdLevel);
+
+int 
+tar_add(tar *t, const tar_entry *const e);
+
+writer *
+tar_beginFile(tar *t, const tar_entry *const e);
+
+writer *
+tar_beginAppleDouble(tar *t, const tar_entry *const e, 
+      const char *const finderInfo);
+
+int 
+tar_endFile(tar *t);
+
+int 
+tar_close(tar *t);
+
+#endif
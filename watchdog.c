@@ -0,0 +1,275 @@
+/*
+ *  watchdog.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <sys/time.h>
+#include "watchdog.h"
+
+static pthread_once_t readerKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t readerKey;
+
+/* the last read of a destroyed watchdog to return frees it */
+static void 
+watchdog_release(watchdog *wd) {
+   int last;
+   
+   pthread_mutex_lock(&wd->lock);
+   wd->hung--;
+   last = wd->destroyed && wd->hung == 0;
+   pthread_mutex_unlock(&wd->lock);
+   
+   if (last) {
+      pthread_mutex_destroy(&wd->lock);
+      free(wd);
+   }
+}
+
+/* the reader frees itself once it is abandoned, either by its thread 
+ * exiting or after a read that timed out has finally returned
+ */
+static void *
+watchdog_readerThread(void *arg) {
+   watchdog_reader *r = (watchdog_reader*)arg;
+   ssize_t n;
+   int error;
+   
+   pthread_mutex_lock(&r->lock);
+   
+   for (;;) {
+      while (r->state != READER_PENDING && !r->abandoned) {
+         pthread_cond_wait(&r->cond, &r->lock);
+      }
+      
+      if (r->state != READER_PENDING) {
+         break;
+      }
+      
+      pthread_mutex_unlock(&r->lock);
+      
+      while ((n = pread(r->fd, r->buf, r->len, r->offset)) == -1 
+            && errno == EINTR);
+      error = errno;
+      
+      pthread_mutex_lock(&r->lock);
+      r->result = n;
+      r->error = error;
+      r->state = READER_DONE;
+      pthread_cond_broadcast(&r->cond);
+      
+      if (r->abandoned) {
+         break;
+      }
+   }
+   
+   pthread_mutex_unlock(&r->lock);
+   
+   if (r->timedOut != NULL) {
+      watchdog_release(r->timedOut);
+   }
+   
+   pthread_cond_destroy(&r->cond);
+   pthread_mutex_destroy(&r->lock);
+   free(r->buf);
+   free(r);
+   return NULL;
+}
+
+static void 
+watchdog_abandon(void *arg) {
+   watchdog_reader *r = (watchdog_reader*)arg;
+   
+   pthread_mutex_lock(&r->lock);
+   r->abandoned = 1;
+   pthread_cond_broadcast(&r->cond);
+   pthread_mutex_unlock(&r->lock);
+}
+
+static watchdog_reader *
+watchdog_reader_create() {
+   watchdog_reader *r = (watchdog_reader*)calloc(1, sizeof(watchdog_reader));
+   pthread_attr_t attr;
+   pthread_t thread;
+   
+   pthread_mutex_init(&r->lock, NULL);
+   pthread_cond_init(&r->cond, NULL);
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   
+   if (pthread_create(&thread, &attr, &watchdog_readerThread, r) != 0) {
+      perror("pthread_create");
+      exit(1);
+   }
+   
+   pthread_attr_destroy(&attr);
+   pthread_setspecific(readerKey, r);
+   return r;
+}
+
+static void 
+watchdog_createKey() {
+   pthread_key_create(&readerKey, &watchdog_abandon);
+}
+
+/* a timeout of 0 reads without a deadline */
+watchdog *
+watchdog_create(u_int32_t timeoutMs, u_int32_t maxHung) {
+   watchdog *wd = (watchdog*)calloc(1, sizeof(watchdog));
+   
+   wd->timeout = timeoutMs;
+   wd->maxHung = maxHung;
+   pthread_mutex_init(&wd->lock, NULL);
+   
+   if (timeoutMs > 0) {
+      pthread_once(&readerKeyOnce, &watchdog_createKey);
+   }
+   
+   return wd;
+}
+
+void 
+watchdog_destroy(watchdog *wd) {
+   int hung;
+   
+   if (wd == NULL) {
+      return;
+   }
+   
+   pthread_mutex_lock(&wd->lock);
+   wd->destroyed = 1;
+   hung = wd->hung;
+   pthread_mutex_unlock(&wd->lock);
+   
+   if (hung == 0) {
+      pthread_mutex_destroy(&wd->lock);
+      free(wd);
+   }
+}
+
+/* pread with a deadline. the read is issued by the calling thread's 
+ * reader into its own buffer, which is copied once the read returned in 
+ * time. a read that doesn't is left to its reader and fails with 
+ * ETIMEDOUT, the next read gets a new reader.
+ */
+ssize_t 
+watchdog_pread(watchdog *wd, int fd, void *buf, size_t len, 
+      u_int64_t offset) {
+   u_int32_t timeout = wd->timeout;
+   watchdog_reader *r;
+   struct timeval now;
+   struct timespec deadline;
+   void *readerBuf;
+   ssize_t n;
+   int rc = 0;
+   
+   if (timeout == 0) {
+      return pread(fd, buf, len, offset);
+   }
+   
+   pthread_mutex_lock(&wd->lock);
+   
+   if (wd->hung >= wd->maxHung) {
+      pthread_mutex_unlock(&wd->lock);
+      errno = ETIMEDOUT;
+      return -1;
+   }
+   
+   pthread_mutex_unlock(&wd->lock);
+   
+   if ((r = (watchdog_reader*)pthread_getspecific(readerKey)) == NULL) {
+      r = watchdog_reader_create();
+   }
+   
+   pthread_mutex_lock(&r->lock);
+   
+   /* the reader is idle, its buffer can be replaced */
+   if (r->bufSize < len) {
+      if (posix_memalign(&readerBuf, WATCHDOG_ALIGNMENT, len) != 0) {
+         perror("posix_memalign");
+         exit(1);
+      }
+      
+      free(r->buf);
+      r->buf = (char*)readerBuf;
+      r->bufSize = len;
+   }
+   
+   r->fd = fd;
+   r->len = len;
+   r->offset = offset;
+   r->state = READER_PENDING;
+   pthread_cond_broadcast(&r->cond);
+   
+   gettimeofday(&now, NULL);
+   deadline.tv_sec = now.tv_sec + timeout / 1000 
+      + (now.tv_usec + (timeout % 1000) * 1000) / 1000000;
+   deadline.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) % 1000000 
+      * 1000;
+   
+   while (r->state != READER_DONE && rc != ETIMEDOUT) {
+      rc = pthread_cond_timedwait(&r->cond, &r->lock, &deadline);
+   }
+   
+   if (r->state == READER_DONE) {
+      if ((n = r->result) > 0) {
+         memcpy(buf, r->buf, n);
+      }
+      
+      errno = r->error;
+      r->state = READER_IDLE;
+      pthread_mutex_unlock(&r->lock);
+      return n;
+   }
+   
+   /* counted before the reader can see it's abandoned and release it */
+   pthread_mutex_lock(&wd->lock);
+   
+   if (++wd->hung == wd->maxHung) {
+      fprintf(stderr, "%u reads are hanging, failing reads until they "
+            "return\n", wd->hung);
+   }
+   
+   wd->timeouts++;
+   pthread_mutex_unlock(&wd->lock);
+   
+   r->abandoned = 1;
+   r->timedOut = wd;
+   pthread_mutex_unlock(&r->lock);
+   pthread_setspecific(readerKey, NULL);
+   
+   errno = ETIMEDOUT;
+   return -1;
+}
+
+u_int64_t 
+watchdog_timeouts(watchdog *wd) {
+   u_int64_t n;
+   
+   pthread_mutex_lock(&wd->lock);
+   n = wd->timeouts;
+   pthread_mutex_unlock(&wd->lock);
+   return n;
+}
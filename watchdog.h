@@ -0,0 +1,88 @@
+/*
+ *  watchdog.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <pthread.h>
+
+#ifndef __WATCHDOG_H_
+#define __WATCHDOG_H_
+
+/* after this many reads of a volume hang at the same time, its reads fail 
+ * right away
+ */
+#define WATCHDOG_MAX_HUNG 16
+/* the readers' buffers suit direct i/o */
+#define WATCHDOG_ALIGNMENT 4096
+
+#define READER_IDLE    0
+#define READER_PENDING 1
+#define READER_DONE    2
+
+/* the deadline of the reads of one volume and the reads that missed it. 
+ * it is freed once it was destroyed and none of its reads hang anymore.
+ */
+typedef struct _watchdog {
+   u_int32_t timeout;          /* in milliseconds, 0 for none */
+   u_int32_t maxHung;
+   pthread_mutex_t lock;
+   u_int32_t hung;
+   u_int64_t timeouts;
+   int destroyed;
+} watchdog;
+
+/* a thread issuing the reads of one calling thread, so a read that 
+ * doesn't return in time can be abandoned
+ */
+typedef struct {
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   int state;
+   int abandoned;
+   watchdog *timedOut;         /* the watchdog of the read that hangs */
+   int fd;
+   size_t len;
+   u_int64_t offset;
+   char *buf;
+   size_t bufSize;
+   ssize_t result;
+   int error;
+} watchdog_reader;
+
+watchdog *
+watchdog_create(u_int32_t timeoutMs, u_int32_t maxHung);
+
+void 
+watchdog_destroy(watchdog *wd);
+
+ssize_t 
+watchdog_pread(watchdog *wd, int fd, void *buf, size_t len, 
+      u_int64_t offset);
+
+u_int64_t 
+watchdog_timeouts(watchdog *wd);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ *  writer.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <fcntl.h>
+#include "writer.h"
+
+static int 
+writer_pwrite(int fd, const char *buf, u_int32_t len, u_int64_t offset) {
+   ssize_t n;
+
+   while (len > 0) {
+      if ((n = pwrite(fd, buf, len, offset)) == -1) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return -1;
+      }
+      buf += n;
+      len -= n;
+      offset += n;
+   }
+
+   return 0;
+}
+
+static int 
+writer_append(int fd, const char *buf, u_int32_t len) {
+   ssize_t n;
+
+   while (len > 0) {
+      if ((n = write(fd, buf, len)) == -1) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return -1;
+      }
+      buf += n;
+      len -= n;
+   }
+
+   return 0;
+}
+
+/* start writeback of the chunk just written and wait for and drop all
+ * older chunks, so the amount of dirty data per file stays at about 
+ * two chunks instead of growing until the kernel flushes it in one stall
+ */
+static void 
+writer_writeBehind(writer *w, u_int64_t offset, u_int32_t len) {
+#ifdef SYNC_FILE_RANGE_WRITE
+   sync_file_range(w->fd, offset, len, SYNC_FILE_RANGE_WRITE);
+
+   if (offset > w->synced) {
+      sync_file_range(w->fd, w->synced, offset - w->synced, 
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE 
+            | SYNC_FILE_RANGE_WAIT_AFTER);
+   }
+#endif
+#ifdef POSIX_FADV_DONTNEED
+   if (offset > w->synced) {
+      posix_fadvise(w->fd, w->synced, offset - w->synced, 
+            POSIX_FADV_DONTNEED);
+   }
+#endif
+   w->synced = offset;
+}
+
+/* the slices are or-ed together without branches, which the compiler 
+ * vectorizes, and most data blocks end the check in the first slice
+ */
+static int 
+writer_isZero(const char *const p, u_int32_t len) {
+   const u_int64_t *words = (const u_int64_t*)p;
+   u_int32_t i, j, n = len / sizeof(u_int64_t);
+   u_int64_t acc = 0;
+   
+   for (i = 0; i < n; i += 32) {
+      for (j = i; j < i + 32 && j < n; j++) {
+         acc |= words[j];
+      }
+      
+      if (acc != 0) {
+         return 0;
+      }
+   }
+   
+   for (i = n*sizeof(u_int64_t); i < len; i++) {
+      if (p[i] != 0) {
+         return 0;
+      }
+   }
+   
+   return 1;
+}
+
+/* writes the runs of blocks in the buffer that aren't all zeros, the 
+ * others are skipped and stay holes in the new file
+ */
+static int 
+writer_writeSparse(writer *w) {
+   u_int32_t pos = 0, start, n;
+   
+   while (pos < w->used) {
+      n = w->used - pos < WRITER_ALIGNMENT ? w->used - pos : WRITER_ALIGNMENT;
+      
+      if (writer_isZero(w->buf + pos, n)) {
+         pos += n;
+         continue;
+      }
+      
+      start = pos;
+      
+      do {
+         pos += n;
+         n = w->used - pos < WRITER_ALIGNMENT 
+            ? w->used - pos : WRITER_ALIGNMENT;
+      } while (pos < w->used && !writer_isZero(w->buf + pos, n));
+      
+      if (writer_pwrite(w->fd, w->buf + start, pos - start, 
+               w->offset + start) == -1) {
+         return -1;
+      }
+   }
+   
+   return 0;
+}
+
+writer *
+writer_open(const char *const fileName, int flags, u_int64_t sizeHint) {
+   writer *w = (writer*)calloc(1, sizeof(writer));
+   int oflags = O_WRONLY | O_CREAT | O_TRUNC;
+   void *buf;
+   
+   w->flags = flags;
+   w->fd = -1;
+   
+#ifdef O_DIRECT
+   if (flags & WRITER_DIRECT) {
+      /* not every file system supports it, fall back to cached i/o */
+      if ((w->fd = open(fileName, oflags | O_DIRECT, 0644)) == -1 
+            && errno != EINVAL) {
+         perror("open");
+         free(w);
+         return NULL;
+      }
+   }
+#endif
+
+   if (w->fd == -1 && (w->fd = open(fileName, oflags, 0644)) == -1) {
+      perror("open");
+      free(w);
+      return NULL;
+   }
+
+#ifdef F_NOCACHE
+   if (flags & (WRITER_WRITE_BEHIND | WRITER_DIRECT)) {
+      fcntl(w->fd, F_NOCACHE, 1);
+   }
+#endif
+
+   /* small files don't need a full chunk */
+   if (sizeHint < WRITER_CHUNK_SIZE) {
+      w->bufSize = (sizeHint + WRITER_ALIGNMENT - 1) & ~(WRITER_ALIGNMENT - 1);
+      w->bufSize = w->bufSize == 0 ? WRITER_ALIGNMENT : w->bufSize;
+   } else {
+      w->bufSize = WRITER_CHUNK_SIZE;
+   }
+   
+   if (posix_memalign(&buf, WRITER_ALIGNMENT, w->bufSize) != 0) {
+      perror("posix_memalign");
+      close(w->fd);
+      free(w);
+      return NULL;
+   }
+   
+   w->buf = (char*)buf;
+   hash_init(&w->hash, (flags & WRITER_HASH_XXH64 ? HASH_XXH64 : 0) 
+         | (flags & WRITER_HASH_SHA256 ? HASH_SHA256 : 0));
+   return w;
+}
+
+/* a writer appending full chunks to a descriptor that may be a pipe. only
+ * the hash flags apply, the others need the offsets of a regular file.
+ * with a zstd level, every chunk is compressed into a frame of its own.
+ */
+writer *
+writer_openStream(int fd, int flags, int zstdLevel) {
+   writer *w = (writer*)calloc(1, sizeof(writer));
+   void *buf;
+   
+   w->flags = WRITER_STREAM 
+      | (flags & (WRITER_HASH_XXH64 | WRITER_HASH_SHA256));
+   w->fd = fd;
+   w->bufSize = WRITER_CHUNK_SIZE;
+   
+   if (zstdLevel > 0 
+         && (w->z = zstream_create(fd, zstdLevel, w->bufSize)) == NULL) {
+      free(w);
+      return NULL;
+   }
+   
+   if (posix_memalign(&buf, WRITER_ALIGNMENT, w->bufSize) != 0) {
+      perror("posix_memalign");
+      
+      if (w->z != NULL) {
+         zstream_close(w->z);
+      }
+      
+      free(w);
+      return NULL;
+   }
+   
+   w->buf = (char*)buf;
+   hash_init(&w->hash, (flags & WRITER_HASH_XXH64 ? HASH_XXH64 : 0) 
+         | (flags & WRITER_HASH_SHA256 ? HASH_SHA256 : 0));
+   return w;
+}
+
+/* a writer without a file, for measuring how fast the data is read */
+writer *
+writer_openNull(int flags) {
+   writer *w = (writer*)calloc(1, sizeof(writer));
+   
+   w->flags = WRITER_DISCARD 
+      | (flags & (WRITER_HASH_XXH64 | WRITER_HASH_SHA256));
+   w->fd = -1;
+   hash_init(&w->hash, (flags & WRITER_HASH_XXH64 ? HASH_XXH64 : 0) 
+         | (flags & WRITER_HASH_SHA256 ? HASH_SHA256 : 0));
+   return w;
+}
+
+int 
+writer_write(writer *w, const char *const data, u_int32_t len) {
+   u_int32_t pos = 0, n;
+   
+   /* hash the caller's buffer while it is still in the cpu cache */
+   if (w->hash.flags != 0) {
+      hash_update(&w->hash, data, len);
+   }
+   
+   if (w->flags & WRITER_DISCARD) {
+      w->offset += len;
+      return 0;
+   }
+   
+   while (pos < len) {
+      n = w->bufSize - w->used;
+      n = n < len - pos ? n : len - pos;
+      memcpy(w->buf + w->used, data + pos, n);
+      w->used += n;
+      pos += n;
+      
+      if (w->used == w->bufSize && writer_flush(w) == -1) {
+         return -1;
+      }
+   }
+   
+   return 0;
+}
+
+int 
+writer_flush(writer *w) {
+   if (w->used == 0) {
+      return 0;
+   }
+
+#ifdef O_DIRECT
+   /* direct i/o needs aligned lengths, write the tail through the cache */
+   if (w->used % WRITER_ALIGNMENT != 0) {
+      int fl = fcntl(w->fd, F_GETFL);
+
+      if (fl != -1 && (fl & O_DIRECT)) {
+         fcntl(w->fd, F_SETFL, fl & ~O_DIRECT);
+      }
+   }
+#endif
+
+   if (w->z != NULL) {
+      if (zstream_write(w->z, w->buf, w->used) == -1) {
+         fprintf(stderr, "unable to write compressed data\n");
+         return -1;
+      }
+   } else if (w->flags & WRITER_STREAM) {
+      if (writer_append(w->fd, w->buf, w->used) == -1) {
+         perror("write");
+         return -1;
+      }
+   } else if ((w->flags & WRITER_SPARSE ? writer_writeSparse(w) 
+            : writer_pwrite(w->fd, w->buf, w->used, w->offset)) == -1) {
+      perror("pwrite");
+      return -1;
+   }
+   
+   if (w->flags & WRITER_WRITE_BEHIND) {
+      writer_writeBehind(w, w->offset, w->used);
+   }
+   
+   w->offset += w->used;
+   w->used = 0;
+   return 0;
+}
+
+/* the digests of everything written so far, the writer must not be 
+ * written to afterwards
+ */
+void 
+writer_digest(writer *w, hash_digest *const digest) {
+   hash_final(&w->hash, digest);
+}
+
+int 
+writer_close(writer *w) {
+   int ret = writer_flush(w);
+   
+   if (w->z != NULL && zstream_close(w->z) == -1) {
+      ret = -1;
+   }
+   
+   /* a hole at the end doesn't extend the file by itself */
+   if (w->flags & WRITER_SPARSE && ret == 0 
+         && ftruncate(w->fd, w->offset) == -1) {
+      perror("ftruncate");
+      ret = -1;
+   }
+   
+   if ((w->flags & (WRITER_STREAM | WRITER_DISCARD)) == 0 
+         && close(w->fd) == -1) {
+      perror("close");
+      ret = -1;
+   }
+   
+   free(w->buf);
+   free(w);
+   return ret;
+}
@@ -0,0 +1,85 @@
+/*
+ *  writer.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include "hash.h"
+#include "zstream.h"
+
+#ifndef __WRITER_H_
+#define __WRITER_H_
+
+/* issue writeback for every full chunk and drop it from the page cache */
+#define WRITER_WRITE_BEHIND 0x01
+/* bypass the page cache entirely (O_DIRECT / F_NOCACHE) */
+#define WRITER_DIRECT       0x02
+/* hash the data while it passes through the buffer */
+#define WRITER_HASH_XXH64   0x04
+#define WRITER_HASH_SHA256  0x08
+/* leave blocks of zeros as holes in the file instead of writing them */
+#define WRITER_SPARSE       0x10
+/* append to a descriptor owned by the caller, set by writer_openStream */
+#define WRITER_STREAM       0x20
+/* count and hash the data but don't write it, set by writer_openNull */
+#define WRITER_DISCARD      0x40
+
+#define WRITER_CHUNK_SIZE   (8*1024*1024)
+#define WRITER_ALIGNMENT    4096
+
+typedef struct {
+   int fd;
+   int flags;
+   char *buf;
+   u_int32_t bufSize;
+   u_int32_t used;
+   u_int64_t offset;
+   u_int64_t synced;
+   hash_ctx hash;
+   zstream *z;
+} writer;
+
+writer *
+writer_open(const char *const fileName, int flags, u_int64_t sizeHint);
+
+writer *
+writer_openStream(int fd, int flags, int zstdLevel);
+
+writer *
+writer_openNull(int flags);
+
+int 
+writer_write(writer *w, const char *const data, u_int32_t len);
+
+int 
+writer_flush(writer *w);
+
+void 
+writer_digest(writer *w, hash_digest *const digest);
+
+int 
+writer_close(writer *w);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ *  zstream.c
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "zstream.h"
+
+static void *
+zstream_worker(void *arg) {
+   zstream_frame *frame = (zstream_frame*)arg;
+   
+#ifdef HAVE_ZSTD
+   frame->outLen = ZSTD_compress(frame->out, frame->outSize, frame->in, 
+         frame->inLen, frame->level);
+   frame->failed = ZSTD_isError(frame->outLen);
+   
+   if (frame->failed) {
+      fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(frame->outLen));
+   }
+#else
+   frame->failed = 1;
+#endif
+   
+   return NULL;
+}
+
+static int 
+zstream_append(int fd, const char *buf, size_t len) {
+   ssize_t n;
+   
+   while (len > 0) {
+      if ((n = write(fd, buf, len)) == -1) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return -1;
+      }
+      buf += n;
+      len -= n;
+   }
+   
+   return 0;
+}
+
+/* waits for the frames of a group and writes them in order */
+static void 
+zstream_finish(zstream *z, zstream_group *g) {
+   u_int32_t i;
+   
+   while (g->running > 0) {
+      pthread_join(g->threads[--g->running], NULL);
+   }
+   
+   for (i = 0; i < g->count; i++) {
+      if (g->frames[i].failed) {
+         z->failed = 1;
+      } else if (!z->failed) {
+         if (zstream_append(z->fd, g->frames[i].out, g->frames[i].outLen) 
+               == -1) {
+            perror("write");
+            z->failed = 1;
+         }
+         
+         z->bytesOut += g->frames[i].outLen;
+      }
+   }
+   
+   g->count = 0;
+}
+
+/* starts compressing the current group and switches to the other one, 
+ * once its frames are written
+ */
+static void 
+zstream_dispatch(zstream *z) {
+   zstream_group *g = &z->groups[z->current];
+   u_int32_t i;
+   
+   zstream_finish(z, &z->groups[1 - z->current]);
+   
+   for (i = 0; i < g->count; i++) {
+      if (pthread_create(&g->threads[g->running], NULL, &zstream_worker, 
+               &g->frames[i]) == 0) {
+         g->running++;
+      } else {
+         zstream_worker(&g->frames[i]);
+      }
+   }
+   
+   z->current = 1 - z->current;
+}
+
+/* returns NULL if the build has no zstd */
+zstream *
+zstream_create(int fd, int level, u_int32_t blockSize) {
+   zstream *z;
+   
+#ifndef HAVE_ZSTD
+   fprintf(stderr, "compressed output needs a build with HAVE_ZSTD\n");
+   return NULL;
+#endif
+   
+   z = (zstream*)calloc(1, sizeof(zstream));
+   z->fd = fd;
+   z->level = level;
+   z->blockSize = blockSize;
+   return z;
+}
+
+int 
+zstream_write(zstream *z, const char *const data, u_int32_t len) {
+   zstream_group *g = &z->groups[z->current];
+   zstream_frame *frame = &g->frames[g->count];
+   
+   if (frame->in == NULL) {
+#ifdef HAVE_ZSTD
+      frame->outSize = ZSTD_compressBound(z->blockSize);
+#endif
+      frame->in = (char*)malloc(z->blockSize);
+      frame->out = (char*)malloc(frame->outSize);
+      
+      if (frame->in == NULL || frame->out == NULL) {
+         perror("malloc");
+         exit(1);
+      }
+   }
+   
+   memcpy(frame->in, data, len);
+   frame->inLen = len;
+   frame->level = z->level;
+   frame->failed = 0;
+   z->bytesIn += len;
+   
+   if (++g->count == ZSTREAM_THREADS) {
+      zstream_dispatch(z);
+   }
+   
+   return z->failed ? -1 : 0;
+}
+
+int 
+zstream_close(zstream *z) {
+   int ret, g, i;
+   
+   if (z->groups[z->current].count > 0) {
+      zstream_dispatch(z);
+   }
+   
+   zstream_finish(z, &z->groups[1 - z->current]);
+   ret = z->failed ? -1 : 0;
+   
+   if (ret == 0) {
+      printf("%llu bytes compressed to %llu\n", 
+            (unsigned long long)z->bytesIn, (unsigned long long)z->bytesOut);
+   }
+   
+   for (g = 0; g < 2; g++) {
+      for (i = 0; i < ZSTREAM_THREADS; i++) {
+         free(z->groups[g].frames[i].in);
+         free(z->groups[g].frames[i].out);
+      }
+   }
+   
+   free(z);
+   return ret;
+}
@@ -0,0 +1,79 @@
+/*
+ *  zstream.h
+ *  HFSPlusRecovery
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <CoreServices/CoreServices.h>
+#include <pthread.h>
+
+#ifndef __ZSTREAM_H_
+#define __ZSTREAM_H_
+
+#define ZSTREAM_THREADS 4
+#define ZSTREAM_MAX_LEVEL 19
+
+/* every block written becomes an independent zstd frame */
+typedef struct {
+   char *in;
+   u_int32_t inLen;
+   char *out;
+   size_t outLen;
+   size_t outSize;
+   int level;
+   int failed;
+} zstream_frame;
+
+typedef struct {
+   zstream_frame frames[ZSTREAM_THREADS];
+   pthread_t threads[ZSTREAM_THREADS];
+   u_int32_t count;
+   u_int32_t running;
+} zstream_group;
+
+/* a zstd stream written to a descriptor. the frames of one group are 
+ * compressed in parallel while the next group is filled, then written 
+ * in order.
+ */
+typedef struct {
+   int fd;
+   int level;
+   u_int32_t blockSize;
+   zstream_group groups[2];
+   int current;
+   int failed;
+   u_int64_t bytesIn;
+   u_int64_t bytesOut;
+} zstream;
+
+zstream *
+zstream_create(int fd, int level, u_int32_t blockSize);
+
+int 
+zstream_write(zstream *z, const char *const data, u_int32_t len);
+
+int 
+zstream_close(zstream *z);
+
+#endif